@@ -7,6 +7,9 @@
 #include <sys/time.h>
 
 #include "util.hpp"
+#include "trace.hpp"
+#include "imageIO.hpp"
+#include "CLDevices.hpp"
 
 /*-------------------------------------------
 This is the GPU compute implementation of 
@@ -25,23 +28,32 @@ CLDepthEstimator::CLDepthEstimator(
 	const unsigned char maxDisparity,
 	const unsigned char maxCrossDifference,
 	const uint32_t occlusionRadius
-){
-	//Save arguments.
-	this->downsampleFactor = downsampleFactor;
-	this->windowRadius = windowRadius;
-	this->maxDisparity = maxDisparity;
-	this->maxCrossDifference = maxCrossDifference;
-	this->occlusionRadius = occlusionRadius;
-
+):
+	DepthEstimator(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius)
+{
 	//Prepare CL.
-	platform = findPlatform();
-	device = findDevice(platform);
-	context = createContext(&device);
-	queue[0] = createQueue(context, device);
-	queue[1] = createQueue(context, device);
+	CLDevice selected = selectDevice(nullptr);
+	platform = selected.platform;
+	device = selected.device;
+	prepare();
+}
 
-	//Prepare kernels.
-	prepareKernels();
+//Stereo image depth estimator running on a given OpenCL device.
+CLDepthEstimator::CLDepthEstimator(
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius,
+	cl_platform_id platform,
+	cl_device_id device
+):
+	DepthEstimator(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius)
+{
+	//Prepare CL.
+	this->platform = platform;
+	this->device = device;
+	prepare();
 }
 
 //Cleanup.
@@ -51,7 +63,6 @@ CLDepthEstimator::~CLDepthEstimator(){
 	clReleaseKernel(k_disparity);
 	clReleaseKernel(k_filter);
 	clReleaseKernel(k_downsample);
-	clReleaseKernel(k_rgba);
 	clReleaseKernel(k_greyscale);
 	clReleaseCommandQueue(queue[1]);
 	clReleaseCommandQueue(queue[0]);
@@ -64,11 +75,11 @@ void CLDepthEstimator::createDepthMap(
 	const char* right_name,
 	const char* out_name
 ){
-	//Load images.
+	//Load images as grey. The greyscale conversion runs while the images load and has its own events.
 	cl_mem img[2];
-	uint32_t w, h;
-	loadImage(queue[0], left_name, &w, &h, &img[0]);
-	loadImage(queue[1], right_name, &w, &h, &img[1]);
+	cl_event greyEvents[2];
+	uint32_t w, h, c;
+	loadImages(left_name, right_name, &w, &h, &c, img, greyEvents);
 
 	uint32_t W = w / downsampleFactor;
 	uint32_t H = h / downsampleFactor;
@@ -78,15 +89,14 @@ void CLDepthEstimator::createDepthMap(
 	cl_mem down[2];
 	cl_mem mean[2];
 
-	grey[0] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, w*h*sizeof(unsigned char), nullptr);
-	grey[1] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, w*h*sizeof(unsigned char), nullptr);
-	down[0] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
-	down[1] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
-	mean[0] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
-	mean[1] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
+	for(uint32_t i=0;i<2;i++){
+		grey[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, w*h*sizeof(unsigned char), nullptr);
+		down[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
+		mean[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
+	}
 
 	//Create a list of events for profiling.
-	cl_event events[11];
+	cl_event events[10];
 
 	//Sync queues.
 	clFinish(queue[0]);
@@ -96,37 +106,22 @@ void CLDepthEstimator::createDepthMap(
 	struct timeval time_start, time_end;
 	gettimeofday(&time_start, NULL);
 
-	//Prepare left and right images.
-	for(uint32_t i=0;i<2;i++){
-		makeImgGrey(queue[i], &img[i], w, h, &grey[i], &events[0+i*3]);
-		downsampleImg(queue[i], &grey[i], w, h, downsampleFactor, &down[i], &events[1+i*3]);
-		filterImg(queue[i], &down[i], W, H, windowRadius, &mean[i], &events[2+i*3]);
-	}
+	//Run every stage up to the occlusion fill.
+	runPipeline(img, w, h, 1, grey, down, mean, events, nullptr);
 
-	//Sync queues.
-	clFinish(queue[0]);
-	clFinish(queue[1]);
-
-	//Create disparity maps.
-	for(uint32_t i=0;i<2;i++){
-		calcDisparity(queue[i], &down[i], &down[1-i], &mean[i], &mean[1-i], W, H, windowRadius, maxDisparity, -1+i*2, &grey[i], &events[6+i]);
-	}
-
-	//Sync queues.
-	clFinish(queue[0]);
-	clFinish(queue[1]);
-
-	//Combine images and do post processing.
-	crossCheck(queue[0], &grey[0], &grey[1], W, H, maxCrossDifference, &events[8]);
-	occlusionFill(queue[0], &grey[0], W, H, occlusionRadius, &mean[0], &events[9]);
+	//The greyscale stage of the run is the conversion done while loading.
+	clReleaseEvent(events[0]);
+	clReleaseEvent(events[3]);
+	events[0] = greyEvents[0];
+	events[3] = greyEvents[1];
+	pipelineStart = loadStart;
 
 	//Finish measuring execution time.
 	clFinish(queue[0]);
 	gettimeofday(&time_end, NULL);
 
-	//Make final image into 8bit rgba and write as png.
-	makeImgRGBA(queue[0], &mean[0], W, H, &grey[1], &events[10]);
-	writeImage(queue[0], out_name, W, H, &grey[1]);
+	//Read the final image back as grey and write it into a file.
+	writeImage(queue[0], out_name, W, H, 1, &mean[0]);
 
 	//Cleanup.
 	clReleaseMemObject(img[0]);
@@ -140,23 +135,202 @@ void CLDepthEstimator::createDepthMap(
 
 	//Print execution times.
 	clFinish(queue[0]);
-	clWaitForEvents(11, events);
+	clWaitForEvents(10, events);
+	traceEvents(events);
 
 	double elapsed = (double)(time_end.tv_usec - time_start.tv_usec) / 1000000 +
 		(double)(time_end.tv_sec - time_start.tv_sec);
 	printf("---OpenCL Depth Estimator---\nTotal execution time: %f S.\n", elapsed);
 
-	profileEvent("Left greyscale      ", events[0]);
-	profileEvent("Left downsample     ", events[1]);
-	profileEvent("Left filter         ", events[2]);
-	profileEvent("Right greyscale     ", events[3]);
-	profileEvent("Right downsample    ", events[4]);
-	profileEvent("Right filter        ", events[5]);
-	profileEvent("Left disparity      ", events[6]);
-	profileEvent("Right disparity     ", events[7]);
-	profileEvent("Cross check         ", events[8]);
-	profileEvent("Occlusion fill      ", events[9]);
-	profileEvent("Convert rgba        ", events[10]);
+	//Device rates, the host peaks do not apply.
+	StageWork work[10];
+	pipelineWork(w, h, c, downsampleFactor, windowRadius, maxDisparity, work);
+
+	profileEvent("Left greyscale      ", events[0], work[0]);
+	profileEvent("Left downsample     ", events[1], work[1]);
+	profileEvent("Left filter         ", events[2], work[2]);
+	profileEvent("Right greyscale     ", events[3], work[3]);
+	profileEvent("Right downsample    ", events[4], work[4]);
+	profileEvent("Right filter        ", events[5], work[5]);
+	profileEvent("Left disparity      ", events[6], work[6]);
+	profileEvent("Right disparity     ", events[7], work[7]);
+	profileEvent("Cross check         ", events[8], work[8]);
+	profileEvent("Occlusion fill      ", events[9], work[9]);
+}
+
+//Create a depth map from caller owned grey or rgba images in memory.
+void CLDepthEstimator::createDepthMap(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	checkLayout(width, stride, channels, outStride);
+	runInMemory(left, right, width, height, stride, channels, out, outStride, nullptr, nullptr);
+}
+
+//Run the pipeline once and report the stage times from the profiling events.
+bool CLDepthEstimator::timeStages(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	double* times
+){
+	checkLayout(width, stride, channels, width / downsampleFactor);
+
+	cl_event events[10];
+	runInMemory(left, right, width, height, stride, channels, out, width / downsampleFactor, events, nullptr);
+	clWaitForEvents(10, events);
+	traceEvents(events);
+
+	double pipelineTimes[10];
+	for(uint32_t i=0;i<10;i++){
+		pipelineTimes[i] = eventSeconds(events[i]);
+		clReleaseEvent(events[i]);
+	}
+	foldStageTimes(pipelineTimes, times);
+	return true;
+}
+
+//Run the pipeline once and copy the output of every stage into planes.
+bool CLDepthEstimator::capturePlanes(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	DepthPlanes* planes
+){
+	checkLayout(width, stride, channels, width / downsampleFactor);
+
+	runInMemory(left, right, width, height, stride, channels, planes->out, width / downsampleFactor, nullptr, planes);
+	return true;
+}
+
+//Uploads images in memory, runs every stage and reads back the depth map.
+//Profiling events of the stages are stored into events and the output of every stage into planes unless they are nullptr.
+void CLDepthEstimator::runInMemory(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	const uint32_t outStride,
+	cl_event* events,
+	DepthPlanes* planes
+){
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
+	//Allocate buffers.
+	cl_mem grey[2];
+	cl_mem down[2];
+	cl_mem mean[2];
+
+	for(uint32_t i=0;i<2;i++){
+		grey[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, width*height*sizeof(unsigned char), nullptr);
+		down[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
+		mean[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
+	}
+
+	//Upload images.
+	const unsigned char* src[2] = {left, right};
+	cl_mem img[2];
+	for(uint32_t i=0;i<2;i++){
+		img[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_ONLY, width*height*channels, nullptr);
+		uploadFrame(queue[i], src[i], width, height, stride, channels, &img[i]);
+	}
+
+	//Run every stage and read back the depth map.
+	runPipeline(img, width, height, channels, grey, down, mean, events, planes);
+	readRows(queue[0], &mean[0], W, 0, H, out, outStride);
+
+	//Cleanup.
+	for(uint32_t i=0;i<2;i++){
+		clReleaseMemObject(img[i]);
+		clReleaseMemObject(grey[i]);
+		clReleaseMemObject(down[i]);
+		clReleaseMemObject(mean[i]);
+	}
+}
+
+//Enqueues every stage from the greyscale conversion to the occlusion fill. The result is left in mean[0].
+//Grey sources (channels 1) are downsampled directly and their greyscale event is an empty marker.
+//The output of every stage is read back into planes unless it is nullptr.
+void CLDepthEstimator::runPipeline(
+	cl_mem* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	cl_mem* grey,
+	cl_mem* down,
+	cl_mem* mean,
+	cl_event* events,
+	DepthPlanes* planes
+){
+	gettimeofday(&pipelineStart, NULL);
+
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
+	//Prepare left and right images.
+	for(uint32_t i=0;i<2;i++){
+		cl_mem* greyImg = &grey[i];
+		if(channels == 4){
+			makeImgGrey(queue[i], &img[i], width, height, greyImg, events ? &events[0+i*3] : nullptr);
+		}else{
+			greyImg = &img[i];
+			if(events){
+				clEnqueueMarkerWithWaitList(queue[i], 0, nullptr, &events[0+i*3]);
+			}
+		}
+		downsampleImg(queue[i], greyImg, width, height, downsampleFactor, &down[i], events ? &events[1+i*3] : nullptr);
+		filterImg(queue[i], &down[i], W, H, windowRadius, &mean[i], events ? &events[2+i*3] : nullptr);
+	}
+
+	//Sync queues.
+	clFinish(queue[0]);
+	clFinish(queue[1]);
+
+	if(planes){
+		for(uint32_t i=0;i<2;i++){
+			readPlane(queue[i], channels == 4 ? &grey[i] : &img[i], width, height, planes->grey[i]);
+			readPlane(queue[i], &down[i], W, H, planes->down[i]);
+			readPlane(queue[i], &mean[i], W, H, planes->mean[i]);
+		}
+	}
+
+	//Create disparity maps.
+	for(uint32_t i=0;i<2;i++){
+		calcDisparity(queue[i], &down[i], &down[1-i], &mean[i], &mean[1-i], W, H, windowRadius, maxDisparity, -1+i*2, &grey[i], events ? &events[6+i] : nullptr);
+	}
+
+	//Sync queues.
+	clFinish(queue[0]);
+	clFinish(queue[1]);
+
+	if(planes){
+		readPlane(queue[0], &grey[0], W, H, planes->disparity[0]);
+		readPlane(queue[1], &grey[1], W, H, planes->disparity[1]);
+	}
+
+	//Combine images and do post processing.
+	crossCheck(queue[0], &grey[0], &grey[1], W, H, maxCrossDifference, events ? &events[8] : nullptr);
+	if(planes){
+		readPlane(queue[0], &grey[0], W, H, planes->cross);
+	}
+	occlusionFill(queue[0], &grey[0], W, H, occlusionRadius, &mean[0], events ? &events[9] : nullptr);
 }
 
 //Print OpenCL information.
@@ -234,77 +408,47 @@ void CLDepthEstimator::printInfo(){
 	}
 }
 
+//Prints the device time of a finished stage event with its achieved rates.
 void CLDepthEstimator::profileEvent(
 	const char* eventName,
+	cl_event event,
+	const StageWork& work
+){
+	printStageTime(eventName, eventSeconds(event), work, nullptr);
+}
+
+//Device execution time of a finished event in seconds.
+double CLDepthEstimator::eventSeconds(
 	cl_event event
 ){
 	cl_ulong event_start, event_end;
 	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(event_start), &event_start, NULL);
 	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(event_end), &event_end, NULL);
-	
-	printf("%s: %f S.\n", eventName, (double)(event_end - event_start)/1000000000);
-}
-
-//Find a suitable platform.
-cl_platform_id CLDepthEstimator::findPlatform(){
-	//Error handle.
-	cl_int err = CL_SUCCESS;
-
-	//Get platforms.
-	uint32_t numPlatforms = 0;
-	err = clGetPlatformIDs(0, nullptr, &numPlatforms);
-	if(err != CL_SUCCESS){
-		printf("Could not get platform count!\n");
-		exit(EXIT_FAILURE);
-	}
-	
-	if(numPlatforms <= 0){
-		//Platform count 0.
-		printf("No supported platforms found!\n");
-		exit(EXIT_FAILURE);
-	}
-
-	std::vector<cl_platform_id> platforms(numPlatforms);
-	err = clGetPlatformIDs(numPlatforms, platforms.data(), nullptr);
-	if(err != CL_SUCCESS){
-		printf("Could not get supported platforms!\n");
-		exit(EXIT_FAILURE);
-	}
 
-	//Just use first available platform.
-	return platforms[0];
+	return (double)(event_end - event_start)/1000000000;
 }
 
-//Find a suitable device.
-cl_device_id CLDepthEstimator::findDevice(
-	cl_platform_id platform
+//Adds the stage events of the last pipeline run to the trace, with the first queued command lined up
+//with the host time the run was started. Left view stages run on queue 0, right view stages on queue 1.
+void CLDepthEstimator::traceEvents(
+	cl_event* events
 ){
-	//Error handle.
-	cl_int err = CL_SUCCESS;
-
-	//Get devices.
-	uint32_t numDevices = 0;
-	err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &numDevices);
-	if(err != CL_SUCCESS){
-		printf("Could not get device count!\n");
-		exit(EXIT_FAILURE);
+	if(!traceEnabled()){return;}
+
+	const uint32_t queues[10] = {0, 0, 0, 1, 1, 1, 0, 1, 0, 0};
+	cl_ulong info[10][4];
+	cl_ulong first = ~(cl_ulong)0;
+	for(uint32_t i=0;i<10;i++){
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &info[i][0], NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &info[i][1], NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &info[i][2], NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &info[i][3], NULL);
+		if(info[i][0] < first){first = info[i][0];}
 	}
 
-	if(numDevices <= 0){
-		//Device count 0.
-		printf("No supported devices found!\n");
-		exit(EXIT_FAILURE);
+	for(uint32_t i=0;i<10;i++){
+		traceDeviceSpan(pipelineStageNames[i], queues[i], pipelineStart, first, info[i][0], info[i][1], info[i][2], info[i][3]);
 	}
-
-	std::vector<cl_device_id> devices(numDevices);
-	err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, numDevices, devices.data(), nullptr);
-	if(err != CL_SUCCESS){
-		printf("Could not get supported devices!\n");
-		exit(EXIT_FAILURE);
-	}
-
-	//Just use the first available device.
-	return devices[0];
 }
 
 //Create a CL context.
@@ -385,6 +529,16 @@ cl_kernel CLDepthEstimator::createKernel(
 	return kernel;
 }
 
+//Create the context, command queues and kernels for the chosen device.
+void CLDepthEstimator::prepare(){
+	context = createContext(&device);
+	queue[0] = createQueue(context, device);
+	queue[1] = createQueue(context, device);
+
+	//Prepare kernels.
+	prepareKernels();
+}
+
 //Create all the needed kernel programs.
 void CLDepthEstimator::prepareKernels(){
 	{
@@ -402,9 +556,9 @@ void CLDepthEstimator::prepareKernels(){
 					unsigned int in_i = m*4;
 					
 					out[m] = (
-						img[in_i  ] + 0.2126,
-						img[in_i+1] + 0.7152,
-						img[in_i+2] + 0.0722
+						img[in_i  ] * 0.2126f +
+						img[in_i+1] * 0.7152f +
+						img[in_i+2] * 0.0722f
 					);
 				}
 			}
@@ -413,30 +567,6 @@ void CLDepthEstimator::prepareKernels(){
 		k_greyscale = createKernel("greyscale", source);
 	}
 
-	{
-		//Create an 8bit rgba image based on a source 8bit greyscale image.
-		const char* source = R"(
-			__kernel void rgba(
-				__global const unsigned char* img,
-				const unsigned int width,
-				const unsigned int height,
-				__global unsigned char* out
-			){
-				int m = get_global_id(0);
-				
-				if(m<width*height){
-					unsigned int out_i = m*4;
-
-					out[out_i  ] = img[m];
-					out[out_i+1] = img[m];
-					out[out_i+2] = img[m];
-					out[out_i+3] = 255;
-				}
-			}
-		)";
-		k_rgba = createKernel("rgba", source);
-	}
-
 	{
 		//Downsample a greyscale image.
 		const char* source = R"(
@@ -486,9 +616,9 @@ void CLDepthEstimator::prepareKernels(){
 
 				int val = 0;
 
-				for(int i=n-radius;i<=n+radius;i++){
-					for(int j=m-radius;j<=m+radius;j++){
-						if(0<=m&&m<width&&0<=n&&n<height){
+				for(int i=n-(int)radius;i<=n+(int)radius;i++){
+					for(int j=m-(int)radius;j<=m+(int)radius;j++){
+						if(0<=i&&i<height&&0<=j&&j<width){
 							val += img[j+i*width];
 						}
 					}
@@ -535,8 +665,8 @@ void CLDepthEstimator::prepareKernels(){
 					denom_0 = 0.0f;
 					denom_1 = 0.0f;
 
-					for(int i=n-radius;i<=n+radius;i++){
-						for(int j=m-radius;j<=m+radius;j++){
+					for(int i=n-(int)radius;i<=n+(int)radius;i++){
+						for(int j=m-(int)radius;j<=m+(int)radius;j++){
 							if(0<=i&&i<height&&0<=(j+direction*d)&&(j+direction*d)<width&&0<=j&&j<width){
 								std_0 = img_0[j+i*width] - mean_0[m+n*width];
 								std_1 = img_1[j+i*width+direction*d] - mean_1[m+n*width+direction*d];
@@ -598,8 +728,8 @@ void CLDepthEstimator::prepareKernels(){
 				}else{
 					float numer = 0.0f;
 					int denom = 0;
-					for(int i=n-radius;i<=n+radius;i++){
-						for(int j=m-radius;j<=m+radius;j++){
+					for(int i=n-(int)radius;i<=n+(int)radius;i++){
+						for(int j=m-(int)radius;j<=m+(int)radius;j++){
 							if(0<=i&&i<height&&0<=j&&j<width){
 								if(img[j+i*width] > 0){
 									numer += img[j+i*width];
@@ -634,30 +764,21 @@ cl_mem CLDepthEstimator::createBuffer(
 	return buf;
 }
 
-//Loads an image from a file and sends it to the GPU via a staging buffer in order to utilize faster local device memory.
-void CLDepthEstimator::loadImage(
+//Sends an image to the GPU via a staging buffer in order to utilize faster local device memory.
+void CLDepthEstimator::uploadImage(
 	cl_command_queue queue,
-	const char* filename,
-	uint32_t* width,
-	uint32_t* height,
+	const unsigned char* img,
+	const uint32_t len,
 	cl_mem* image
 ){
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
 	//Error handle.
 	cl_int err = CL_SUCCESS;
 
-	//Load image.
-	unsigned char* img;
-	uint32_t w, h;
-
-	imgLoad(filename, &w, &h, &img);
-	uint32_t len = w * h * 4 * sizeof(unsigned char);
-
-	*width = w;
-	*height = h;
-
 	//Create a staging buffer.
-	cl_mem d_staging = createBuffer(CL_MEM_COPY_HOST_PTR, len, img);
-	free(img);
+	cl_mem d_staging = createBuffer(CL_MEM_COPY_HOST_PTR, len, (void*)img);
 
 	//Create a buffer for the image.
 	*image = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_ONLY, len, nullptr);
@@ -670,78 +791,218 @@ void CLDepthEstimator::loadImage(
 	}
 
 	clReleaseMemObject(d_staging);
+
+	gettimeofday(&end, NULL);
+	traceSpan("upload", "transfer", start, end);
 }
 
-//Copies the image into a staging buffer and back onto host memory for writing.
-void CLDepthEstimator::writeImage(
+//Copies a range of the image into a staging buffer and back onto host memory.
+void CLDepthEstimator::readImage(
 	cl_command_queue queue,
-	const char* filename,
-	uint32_t width,
-	uint32_t height,
-	cl_mem* image
+	cl_mem* image,
+	const uint32_t offset,
+	const uint32_t len,
+	unsigned char* out
 ){
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
 	//Error handle.
 	cl_int err = CL_SUCCESS;
 
-	uint32_t len = width * height * 4 * sizeof(unsigned char);
-
 	//Create a staging buffer.
 	cl_mem d_staging = createBuffer(CL_MEM_HOST_READ_ONLY, len, nullptr);
 
 	//Copy image to the staging buffer.
-	err = clEnqueueCopyBuffer(queue, *image, d_staging, 0, 0, len, 0, nullptr, nullptr);
+	err = clEnqueueCopyBuffer(queue, *image, d_staging, offset, 0, len, 0, nullptr, nullptr);
 	if(err != CL_SUCCESS){
 		printf("Could not copy contents to the staging buffer!\n");
 		exit(EXIT_FAILURE);
 	}
 
 	//Read contents from the staging buffer.
-	unsigned char* img = (unsigned char*)malloc(len);
-
-	err = clEnqueueReadBuffer(queue, d_staging, CL_TRUE, 0, len, img, 0, NULL, NULL);
+	err = clEnqueueReadBuffer(queue, d_staging, CL_TRUE, 0, len, out, 0, NULL, NULL);
 	if(err != CL_SUCCESS){
 		printf("Could not read results!\n");
 		exit(EXIT_FAILURE);
 	}
 
-	//Write image to a file.
-	imgWrite(filename, width, height, img);
-
 	clReleaseMemObject(d_staging);
-	free(img);
+
+	gettimeofday(&end, NULL);
+	traceSpan("download", "transfer", start, end);
 }
 
-//Executes a kernel program that creates a new 8bit greyscale image from a source 8bit/channel rgba image.
-void CLDepthEstimator::makeImgGrey(
+//Sends a frame with padded rows to the GPU via a staging buffer. The rows are packed on the device.
+void CLDepthEstimator::uploadFrame(
 	cl_command_queue queue,
-	cl_mem* img,
+	const unsigned char* img,
 	const uint32_t width,
 	const uint32_t height,
-	cl_mem* out,
-	cl_event* event
+	const uint32_t stride,
+	const uint32_t channels,
+	cl_mem* image
 ){
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
 	//Error handle.
 	cl_int err = CL_SUCCESS;
 
-	//Create the greyscale image.
-	err = clSetKernelArg(k_greyscale, 0, sizeof(cl_mem), img);
-	err |= clSetKernelArg(k_greyscale, 1, sizeof(uint32_t), &width);
-	err |= clSetKernelArg(k_greyscale, 2, sizeof(uint32_t), &height);
-	err |= clSetKernelArg(k_greyscale, 3, sizeof(cl_mem), out);
+	uint32_t len = width * height * channels;
+
+	//Pack the rows into a staging buffer.
+	cl_mem d_staging = createBuffer(CL_MEM_HOST_WRITE_ONLY|CL_MEM_READ_ONLY, len, nullptr);
+
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {width * channels, height, 1};
+	err = clEnqueueWriteBufferRect(queue, d_staging, CL_TRUE, origin, origin, region,
+		width * channels, 0, stride, 0, img, 0, nullptr, nullptr);
 	if(err != CL_SUCCESS){
-		printf("Could not set greyscale kernel arguments!\n");
+		printf("Could not write the staging buffer!\n");
 		exit(EXIT_FAILURE);
 	}
-	const size_t global[1] = {width*height};
-	err = clEnqueueNDRangeKernel(queue, k_greyscale, 1, 0, global, NULL, 0, NULL, event);
+
+	//Copy image from the staging buffer.
+	err = clEnqueueCopyBuffer(queue, d_staging, *image, 0, 0, len, 0, nullptr, nullptr);
 	if(err != CL_SUCCESS){
-		printf("Could not submit greyscale work!\n");
+		printf("Could not copy contents from the staging buffer!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	clReleaseMemObject(d_staging);
+
+	gettimeofday(&end, NULL);
+	traceSpan("upload", "transfer", start, end);
+}
+
+//Copies the rows [rowBegin, rowEnd) of a packed image into host rows that are outStride bytes apart.
+void CLDepthEstimator::readRows(
+	cl_command_queue queue,
+	cl_mem* image,
+	const uint32_t width,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	uint32_t len = width * (rowEnd - rowBegin);
+
+	//Create a staging buffer.
+	cl_mem d_staging = createBuffer(CL_MEM_HOST_READ_ONLY, len, nullptr);
+
+	//Copy image to the staging buffer.
+	err = clEnqueueCopyBuffer(queue, *image, d_staging, width * rowBegin, 0, len, 0, nullptr, nullptr);
+	if(err != CL_SUCCESS){
+		printf("Could not copy contents to the staging buffer!\n");
 		exit(EXIT_FAILURE);
 	}
+
+	//Read the rows from the staging buffer.
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {width, rowEnd - rowBegin, 1};
+	err = clEnqueueReadBufferRect(queue, d_staging, CL_TRUE, origin, origin, region,
+		width, 0, outStride, 0, out, 0, nullptr, nullptr);
+	if(err != CL_SUCCESS){
+		printf("Could not read results!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	clReleaseMemObject(d_staging);
+
+	gettimeofday(&end, NULL);
+	traceSpan("download", "transfer", start, end);
 }
 
-//Reverse of the greyscale operation. Creates an 8bit rgba image from a source 8bit greyscale image.
-void CLDepthEstimator::makeImgRGBA(
+//Reads a whole buffer of width * height bytes back into a plane.
+void CLDepthEstimator::readPlane(
+	cl_command_queue queue,
+	cl_mem* buffer,
+	const uint32_t width,
+	const uint32_t height,
+	unsigned char* plane
+){
+	readRows(queue, buffer, width, 0, height, plane, width);
+}
+
+//Loads the left and right images and sends them to the GPU as grey images. The images are decoded on two
+//host threads and each thread uploads its image and converts it to grey on its own queue as soon as it is
+//decoded, so the upload and greyscale conversion of one image overlap the decode of the other. channels is
+//set to the channels of the left file and greyEvents to the conversion events, empty markers for grey files.
+void CLDepthEstimator::loadImages(
+	const char* left_name,
+	const char* right_name,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	cl_mem* images,
+	cl_event* greyEvents
+){
+	const char* names[2] = {left_name, right_name};
+	uint32_t w[2], h[2], c[2] = {0, 0};
+	bool queued = false;
+
+	#pragma omp parallel for num_threads(2)
+	for(uint32_t i=0;i<2;i++){
+		unsigned char* img;
+		imgLoad(names[i], &w[i], &h[i], &c[i], &img);
+		uploadImage(queue[i], img, w[i] * h[i] * c[i] * sizeof(unsigned char), &images[i]);
+		free(img);
+
+		//The kernel arguments are shared, so one thread enqueues at a time.
+		#pragma omp critical
+		{
+			if(!queued){
+				gettimeofday(&loadStart, NULL);
+				queued = true;
+			}
+			if(c[i] == 4){
+				cl_mem rgba = images[i];
+				images[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, w[i] * h[i] * sizeof(unsigned char), nullptr);
+				makeImgGrey(queue[i], &rgba, w[i], h[i], &images[i], &greyEvents[i]);
+				clReleaseMemObject(rgba);
+			}else{
+				clEnqueueMarkerWithWaitList(queue[i], 0, nullptr, &greyEvents[i]);
+			}
+		}
+	}
+
+	checkPair(names, w, h);
+
+	*width = w[0];
+	*height = h[0];
+	*channels = c[0];
+}
+
+//Copies a grey or rgba image back onto host memory for writing.
+void CLDepthEstimator::writeImage(
+	cl_command_queue queue,
+	const char* filename,
+	uint32_t width,
+	uint32_t height,
+	uint32_t channels,
+	cl_mem* image
+){
+	uint32_t len = width * height * channels * sizeof(unsigned char);
+
+	//Read contents from the device.
+	unsigned char* img = (unsigned char*)malloc(len);
+	readImage(queue, image, 0, len, img);
+
+	//Write image to a file.
+	imgWrite(filename, width, height, channels, img);
+
+	free(img);
+}
+
+//Executes a kernel program that creates a new 8bit greyscale image from a source 8bit/channel rgba image.
+void CLDepthEstimator::makeImgGrey(
 	cl_command_queue queue,
 	cl_mem* img,
 	const uint32_t width,
@@ -753,18 +1014,18 @@ void CLDepthEstimator::makeImgRGBA(
 	cl_int err = CL_SUCCESS;
 
 	//Create the greyscale image.
-	err = clSetKernelArg(k_rgba, 0, sizeof(cl_mem), img);
-	err |= clSetKernelArg(k_rgba, 1, sizeof(uint32_t), &width);
-	err |= clSetKernelArg(k_rgba, 2, sizeof(uint32_t), &height);
-	err |= clSetKernelArg(k_rgba, 3, sizeof(cl_mem), out);
+	err = clSetKernelArg(k_greyscale, 0, sizeof(cl_mem), img);
+	err |= clSetKernelArg(k_greyscale, 1, sizeof(uint32_t), &width);
+	err |= clSetKernelArg(k_greyscale, 2, sizeof(uint32_t), &height);
+	err |= clSetKernelArg(k_greyscale, 3, sizeof(cl_mem), out);
 	if(err != CL_SUCCESS){
-		printf("Could not set rgba kernel arguments!\n");
+		printf("Could not set greyscale kernel arguments!\n");
 		exit(EXIT_FAILURE);
 	}
 	const size_t global[1] = {width*height};
-	err = clEnqueueNDRangeKernel(queue, k_rgba, 1, 0, global, NULL, 0, NULL, event);
+	err = clEnqueueNDRangeKernel(queue, k_greyscale, 1, 0, global, NULL, 0, NULL, event);
 	if(err != CL_SUCCESS){
-		printf("Could not submit rgba work!\n");
+		printf("Could not submit greyscale work!\n");
 		exit(EXIT_FAILURE);
 	}
 }
@@ -3,9 +3,13 @@
 #define CL_TARGET_OPENCL_VERSION 220
 
 #include <cinttypes>
+#include <sys/time.h>
 #include <CL/cl.h>
 
-struct CLDepthEstimator{
+#include "DepthEstimator.hpp"
+#include "roofline.hpp"
+
+struct CLDepthEstimator : DepthEstimator{
 	CLDepthEstimator(
 		const uint32_t downsampleFactor,
 		const uint32_t windowRadius,
@@ -13,21 +17,58 @@ struct CLDepthEstimator{
 		const unsigned char maxCrossDifference,
 		const uint32_t occlusionRadius
 	);
+	CLDepthEstimator(
+		const uint32_t downsampleFactor,
+		const uint32_t windowRadius,
+		const unsigned char maxDisparity,
+		const unsigned char maxCrossDifference,
+		const uint32_t occlusionRadius,
+		cl_platform_id platform,
+		cl_device_id device
+	);
 	~CLDepthEstimator();
 
 	void createDepthMap(
 		const char* left_name,
 		const char* right_name,
 		const char* out_name
-	);
+	) override;
+
+	void createDepthMap(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		const uint32_t outStride
+	) override;
+
+	using DepthEstimator::createDepthMap;
+
+	bool timeStages(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		double* times
+	) override;
 
-	void printInfo();
+	bool capturePlanes(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		DepthPlanes* planes
+	) override;
 
-	uint32_t downsampleFactor;
-	uint32_t windowRadius;
-	unsigned char maxDisparity;
-	unsigned char maxCrossDifference;
-	uint32_t occlusionRadius;
+	void printInfo() override;
 
 	private:
 	cl_platform_id platform;
@@ -35,17 +76,40 @@ struct CLDepthEstimator{
 	cl_context context;
 	cl_command_queue queue[2];
 
+	double eventSeconds(
+		cl_event event
+	);
+
+	void runInMemory(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		const uint32_t outStride,
+		cl_event* events,
+		DepthPlanes* planes
+	);
+
 	void profileEvent(
 		const char* eventName,
-		cl_event event
+		cl_event event,
+		const StageWork& work
 	);
 
-	cl_platform_id findPlatform();
-	
-	cl_device_id findDevice(
-		cl_platform_id platform
+	//Adds the stage events of the last pipeline run to the trace.
+	void traceEvents(
+		cl_event* events
 	);
 
+	//Host time the last pipeline run was started, for lining up device timestamps.
+	struct timeval pipelineStart;
+
+	//Host time loadImages enqueued its first greyscale conversion.
+	struct timeval loadStart;
+
 	cl_context createContext(
 		cl_device_id* device
 	);
@@ -66,22 +130,81 @@ struct CLDepthEstimator{
 	cl_kernel k_disparity;
 	cl_kernel k_cross;
 	cl_kernel k_occlusion;
-	cl_kernel k_rgba;
 
 	void prepareKernels();
 
+	void prepare();
+
+	void runPipeline(
+		cl_mem* img,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t channels,
+		cl_mem* grey,
+		cl_mem* down,
+		cl_mem* mean,
+		cl_event* events,
+		DepthPlanes* planes
+	);
+
+	//Reads a whole buffer of width * height bytes back into a plane.
+	void readPlane(
+		cl_command_queue queue,
+		cl_mem* buffer,
+		const uint32_t width,
+		const uint32_t height,
+		unsigned char* plane
+	);
+
 	cl_mem createBuffer(
 		cl_mem_flags flags,
 		uint32_t size,
 		void* copy
 	);
 
-	void loadImage(
+	void uploadImage(
 		cl_command_queue queue,
-		const char* filename,
+		const unsigned char* img,
+		const uint32_t len,
+		cl_mem* image
+	);
+
+	void readImage(
+		cl_command_queue queue,
+		cl_mem* image,
+		const uint32_t offset,
+		const uint32_t len,
+		unsigned char* out
+	);
+
+	void uploadFrame(
+		cl_command_queue queue,
+		const unsigned char* img,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		cl_mem* image
+	);
+
+	void readRows(
+		cl_command_queue queue,
+		cl_mem* image,
+		const uint32_t width,
+		const uint32_t rowBegin,
+		const uint32_t rowEnd,
+		unsigned char* out,
+		const uint32_t outStride
+	);
+
+	void loadImages(
+		const char* left_name,
+		const char* right_name,
 		uint32_t* width,
 		uint32_t* height,
-		cl_mem* image
+		uint32_t* channels,
+		cl_mem* images,
+		cl_event* greyEvents
 	);
 
 	void writeImage(
@@ -89,6 +212,7 @@ struct CLDepthEstimator{
 		const char* filename,
 		uint32_t width,
 		uint32_t height,
+		uint32_t channels,
 		cl_mem* image
 	);
 
@@ -101,15 +225,6 @@ struct CLDepthEstimator{
 		cl_event* event
 	);
 
-	void makeImgRGBA(
-		cl_command_queue queue,
-		cl_mem* img,
-		const uint32_t width,
-		const uint32_t height,
-		cl_mem* out,
-		cl_event* event
-	);
-
 	void downsampleImg(
 		cl_command_queue queue,
 		cl_mem* img,
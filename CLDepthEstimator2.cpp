@@ -3,15 +3,23 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cmath>
+#include <cstring>
 #include <vector>
+#include <algorithm>
 #include <sys/time.h>
 
 #include "util.hpp"
+#include "trace.hpp"
+#include "imageIO.hpp"
+#include "CLDevices.hpp"
 
 #define LOCAL_SIZE 64
 #define LOCAL_SIZE_X 8
 #define LOCAL_SIZE_Y 8
 
+#define AUTOTUNE_CACHE "autotune.cache"
+#define AUTOTUNE_RUNS 3
+
 /*-------------------------------------------
 This is the GPU compute implementation of 
 the depth estimator for phase 5. OpenCL is 
@@ -29,33 +37,48 @@ CLDepthEstimator2::CLDepthEstimator2(
 	const unsigned char maxDisparity,
 	const unsigned char maxCrossDifference,
 	const uint32_t occlusionRadius
-){
-	//Save arguments.
-	this->downsampleFactor = downsampleFactor;
-	this->windowRadius = windowRadius;
-	this->maxDisparity = maxDisparity;
-	this->maxCrossDifference = maxCrossDifference;
-	this->occlusionRadius = occlusionRadius;
-
+):
+	DepthEstimator(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius)
+{
 	//Prepare CL.
-	platform = findPlatform();
-	device = findDevice(platform);
-	context = createContext(&device);
-	queue[0] = createQueue(context, device);
-	queue[1] = createQueue(context, device);
+	CLDevice selected = selectDevice(nullptr);
+	platform = selected.platform;
+	device = selected.device;
+	prepare();
+}
 
-	//Prepare kernels.
-	prepareKernels();
+//Stereo image depth estimator running on a given OpenCL device.
+CLDepthEstimator2::CLDepthEstimator2(
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius,
+	cl_platform_id platform,
+	cl_device_id device
+):
+	DepthEstimator(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius)
+{
+	//Prepare CL.
+	this->platform = platform;
+	this->device = device;
+	prepare();
 }
 
 //Cleanup.
 CLDepthEstimator2::~CLDepthEstimator2(){
+	if(useImages){
+		clReleaseKernel(k_occlusionImage);
+		clReleaseKernel(k_crossImage);
+		clReleaseKernel(k_disparityImage);
+		clReleaseKernel(k_filterImage);
+		clReleaseKernel(k_downsampleImage);
+	}
 	clReleaseKernel(k_occlusion);
 	clReleaseKernel(k_cross);
 	clReleaseKernel(k_disparity);
 	clReleaseKernel(k_filter);
 	clReleaseKernel(k_downsample);
-	clReleaseKernel(k_rgba);
 	clReleaseKernel(k_greyscale);
 	clReleaseCommandQueue(queue[1]);
 	clReleaseCommandQueue(queue[0]);
@@ -68,29 +91,24 @@ void CLDepthEstimator2::createDepthMap(
 	const char* right_name,
 	const char* out_name
 ){
-	//Load images.
+	//Load images as grey. The greyscale conversion runs while the images load and has its own events.
 	cl_mem img[2];
-	uint32_t w, h;
-	loadImage(queue[0], left_name, &w, &h, &img[0]);
-	loadImage(queue[1], right_name, &w, &h, &img[1]);
+	cl_event greyEvents[2];
+	uint32_t w, h, c;
+	loadImages(left_name, right_name, &w, &h, &c, img, greyEvents);
+
+	//Use the tuned workgroup sizes for this frame size, for grey and rgba files alike.
+	applyTuning(w, h);
 
 	uint32_t W = w / downsampleFactor;
 	uint32_t H = h / downsampleFactor;
 
 	//Allocate buffers.
-	cl_mem grey[2];
-	cl_mem down[2];
-	cl_mem mean[2];
-
-	grey[0] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, w*h*sizeof(unsigned char), nullptr);
-	grey[1] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, w*h*sizeof(unsigned char), nullptr);
-	down[0] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
-	down[1] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
-	mean[0] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
-	mean[1] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
+	Buffers buf;
+	allocateBuffers(w, h, &buf);
 
 	//Create a list of events for profiling.
-	cl_event events[11];
+	cl_event events[10];
 
 	//Sync queues.
 	clFinish(queue[0]);
@@ -100,67 +118,317 @@ void CLDepthEstimator2::createDepthMap(
 	struct timeval time_start, time_end;
 	gettimeofday(&time_start, NULL);
 
+	//Run every stage up to the occlusion fill.
+	runPipeline(img, w, h, 1, &buf, events, nullptr);
+
+	//The greyscale stage of the run is the conversion done while loading.
+	clReleaseEvent(events[0]);
+	clReleaseEvent(events[3]);
+	events[0] = greyEvents[0];
+	events[3] = greyEvents[1];
+	pipelineStart = loadStart;
+
+	//Finish measuring execution time.
+	clFinish(queue[0]);
+	gettimeofday(&time_end, NULL);
+
+	//Read the final image back as grey and write it into a file.
+	writeImage(queue[0], out_name, W, H, 1, &buf.mean[0]);
+
+	//Cleanup.
+	clReleaseMemObject(img[0]);
+	clReleaseMemObject(img[1]);
+	releaseBuffers(&buf);
+
+	//Print execution times.
+	clFinish(queue[0]);
+	clWaitForEvents(10, events);
+	traceEvents(events);
+
+	double elapsed = (double)(time_end.tv_usec - time_start.tv_usec) / 1000000 +
+		(double)(time_end.tv_sec - time_start.tv_sec);
+	printf("---OpenCL Depth Estimator 2---\nTotal execution time: %f S.\n", elapsed);
+
+	//Device rates, the host peaks do not apply.
+	StageWork work[10];
+	pipelineWork(w, h, c, downsampleFactor, windowRadius, maxDisparity, work);
+
+	profileEvent("Left greyscale      ", events[0], work[0]);
+	profileEvent("Left downsample     ", events[1], work[1]);
+	profileEvent("Left filter         ", events[2], work[2]);
+	profileEvent("Right greyscale     ", events[3], work[3]);
+	profileEvent("Right downsample    ", events[4], work[4]);
+	profileEvent("Right filter        ", events[5], work[5]);
+	profileEvent("Left disparity      ", events[6], work[6]);
+	profileEvent("Right disparity     ", events[7], work[7]);
+	profileEvent("Cross check         ", events[8], work[8]);
+	profileEvent("Occlusion fill      ", events[9], work[9]);
+}
+
+//Create a depth map from caller owned grey or rgba images in memory.
+void CLDepthEstimator2::createDepthMap(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	checkLayout(width, stride, channels, outStride);
+
+	//Use the tuned workgroup sizes for this frame size.
+	applyTuning(width, height);
+
+	createDepthBand(left, right, width, height, stride, channels, 0, height / downsampleFactor, out, outStride);
+}
+
+//Use the tuned workgroup sizes of the frame size for all of its bands.
+void CLDepthEstimator2::prepareFrame(
+	const uint32_t width,
+	const uint32_t height
+){
+	applyTuning(width, height);
+}
+
+//Create the rows [outBegin, outEnd) of a downsampled depth map from a horizontal band of the source images.
+//The band must carry enough halo rows around the output rows for the window and occlusion radii.
+//Runs with the workgroup sizes of the frame, see prepareFrame, bands are never tuned on their own.
+void CLDepthEstimator2::createDepthBand(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	const uint32_t outBegin,
+	const uint32_t outEnd,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	runBand(left, right, width, height, stride, channels, outBegin, outEnd, out, outStride, nullptr, nullptr);
+}
+
+//Run the pipeline once and report the stage times from the profiling events.
+bool CLDepthEstimator2::timeStages(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	double* times
+){
+	checkLayout(width, stride, channels, width / downsampleFactor);
+
+	//Use the tuned workgroup sizes for this frame size.
+	applyTuning(width, height);
+
+	cl_event events[10];
+	runBand(left, right, width, height, stride, channels, 0, height / downsampleFactor, out, width / downsampleFactor, events, nullptr);
+	clWaitForEvents(10, events);
+	traceEvents(events);
+
+	double pipelineTimes[10];
+	for(uint32_t i=0;i<10;i++){
+		pipelineTimes[i] = eventSeconds(events[i]);
+		clReleaseEvent(events[i]);
+	}
+	foldStageTimes(pipelineTimes, times);
+	return true;
+}
+
+//Run the pipeline once and copy the output of every stage into planes.
+bool CLDepthEstimator2::capturePlanes(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	DepthPlanes* planes
+){
+	checkLayout(width, stride, channels, width / downsampleFactor);
+
+	//Use the tuned workgroup sizes for this frame size.
+	applyTuning(width, height);
+
+	runBand(left, right, width, height, stride, channels, 0, height / downsampleFactor, planes->out, width / downsampleFactor, nullptr, planes);
+	return true;
+}
+
+//Uploads a band of the source images, runs every stage and reads back the rows [outBegin, outEnd).
+//Profiling events of the stages are stored into events and the output of every stage into planes unless they are nullptr.
+void CLDepthEstimator2::runBand(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	const uint32_t outBegin,
+	const uint32_t outEnd,
+	unsigned char* out,
+	const uint32_t outStride,
+	cl_event* events,
+	DepthPlanes* planes
+){
+	uint32_t W = width / downsampleFactor;
+
+	//Allocate buffers.
+	Buffers buf;
+	allocateBuffers(width, height, &buf);
+
+	//Upload band images.
+	const unsigned char* src[2] = {left, right};
+	cl_mem img[2];
+	for(uint32_t i=0;i<2;i++){
+		img[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_ONLY, width*height*channels, nullptr);
+		uploadFrame(queue[i], src[i], width, height, stride, channels, &img[i]);
+	}
+
+	//Run every stage and read back the output rows.
+	runPipeline(img, width, height, channels, &buf, events, planes);
+	readRows(queue[0], &buf.mean[0], W, outBegin, outEnd, out, outStride);
+
+	//Cleanup.
+	for(uint32_t i=0;i<2;i++){
+		clReleaseMemObject(img[i]);
+	}
+	releaseBuffers(&buf);
+}
+
+//Enqueues every stage from the greyscale conversion to the occlusion fill. The result is left in mean[0].
+//Grey sources (channels 1) are downsampled directly and their greyscale event is an empty marker.
+//The output of every stage is read back into planes unless it is nullptr.
+void CLDepthEstimator2::runPipeline(
+	cl_mem* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	Buffers* buf,
+	cl_event* events,
+	DepthPlanes* planes
+){
+	gettimeofday(&pipelineStart, NULL);
+
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
 	//Prepare left and right images.
 	for(uint32_t i=0;i<2;i++){
-		makeImgGrey(queue[i], &img[i], w, h, &grey[i], &events[0+i*3]);
-		downsampleImg(queue[i], &grey[i], w, h, downsampleFactor, &down[i], &events[1+i*3]);
-		filterImg(queue[i], &down[i], W, H, windowRadius, &mean[i], &events[2+i*3]);
+		cl_mem* greyImg = &buf->grey[i];
+		if(channels == 4){
+			makeImgGrey(queue[i], &img[i], width, height, greyImg, events ? &events[0+i*3] : nullptr);
+		}else{
+			greyImg = &img[i];
+			if(events){
+				clEnqueueMarkerWithWaitList(queue[i], 0, nullptr, &events[0+i*3]);
+			}
+		}
+		if(useImages){
+			downsampleImage(queue[i], greyImg, width, height, downsampleFactor, &buf->downTex[i], events ? &events[1+i*3] : nullptr);
+			filterImage(queue[i], &buf->downTex[i], W, H, windowRadius, &buf->meanTex[i], events ? &events[2+i*3] : nullptr);
+		}else{
+			downsampleImg(queue[i], greyImg, width, height, downsampleFactor, &buf->down[i], events ? &events[1+i*3] : nullptr);
+			filterImg(queue[i], &buf->down[i], W, H, windowRadius, &buf->mean[i], events ? &events[2+i*3] : nullptr);
+		}
 	}
 
 	//Sync queues.
 	clFinish(queue[0]);
 	clFinish(queue[1]);
 
+	if(planes){
+		for(uint32_t i=0;i<2;i++){
+			readPlane(queue[i], channels == 4 ? &buf->grey[i] : &img[i], width, height, planes->grey[i]);
+			if(useImages){
+				readImagePlane(queue[i], &buf->downTex[i], W, H, planes->down[i]);
+				readImagePlane(queue[i], &buf->meanTex[i], W, H, planes->mean[i]);
+			}else{
+				readPlane(queue[i], &buf->down[i], W, H, planes->down[i]);
+				readPlane(queue[i], &buf->mean[i], W, H, planes->mean[i]);
+			}
+		}
+	}
+
 	//Create disparity maps.
 	for(uint32_t i=0;i<2;i++){
-		calcDisparity(queue[i], &down[i], &down[1-i], &mean[i], &mean[1-i], W, H, windowRadius, maxDisparity, -1+i*2, &grey[i], &events[6+i]);
+		if(useImages){
+			calcDisparityImage(queue[i], &buf->downTex[i], &buf->downTex[1-i], &buf->meanTex[i], &buf->meanTex[1-i], W, H, windowRadius, maxDisparity, -1+i*2, &buf->grey[i], events ? &events[6+i] : nullptr);
+		}else{
+			calcDisparity(queue[i], &buf->down[i], &buf->down[1-i], &buf->mean[i], &buf->mean[1-i], W, H, windowRadius, maxDisparity, -1+i*2, &buf->grey[i], events ? &events[6+i] : nullptr);
+		}
 	}
 
 	//Sync queues.
 	clFinish(queue[0]);
 	clFinish(queue[1]);
 
-	//Combine images and do post processing.
-	crossCheck(queue[0], &grey[0], &grey[1], W, H, maxCrossDifference, &events[8]);
-	occlusionFill(queue[0], &grey[0], W, H, occlusionRadius, &mean[0], &events[9]);
+	if(planes){
+		readPlane(queue[0], &buf->grey[0], W, H, planes->disparity[0]);
+		readPlane(queue[1], &buf->grey[1], W, H, planes->disparity[1]);
+	}
 
-	//Finish measuring execution time.
-	clFinish(queue[0]);
-	gettimeofday(&time_end, NULL);
+	//Combine images and do post processing.
+	if(useImages){
+		crossCheckImage(queue[0], &buf->grey[0], &buf->grey[1], W, H, maxCrossDifference, &buf->crossTex, events ? &events[8] : nullptr);
+		if(planes){
+			readImagePlane(queue[0], &buf->crossTex, W, H, planes->cross);
+		}
+		occlusionFillImage(queue[0], &buf->crossTex, W, H, occlusionRadius, &buf->mean[0], events ? &events[9] : nullptr);
+	}else{
+		crossCheck(queue[0], &buf->grey[0], &buf->grey[1], W, H, maxCrossDifference, events ? &events[8] : nullptr);
+		if(planes){
+			readPlane(queue[0], &buf->grey[0], W, H, planes->cross);
+		}
+		occlusionFill(queue[0], &buf->grey[0], W, H, occlusionRadius, &buf->mean[0], events ? &events[9] : nullptr);
+	}
+}
 
-	//Make final image into 8bit rgba and write as png.
-	makeImgRGBA(queue[0], &mean[0], W, H, &grey[1], &events[10]);
-	writeImage(queue[0], out_name, W, H, &grey[1]);
+//Allocates the device memory used by the pipeline for a given frame size.
+void CLDepthEstimator2::allocateBuffers(
+	const uint32_t width,
+	const uint32_t height,
+	Buffers* buf
+){
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
 
-	//Cleanup.
-	clReleaseMemObject(img[0]);
-	clReleaseMemObject(img[1]);
-	clReleaseMemObject(grey[0]);
-	clReleaseMemObject(grey[1]);
-	clReleaseMemObject(down[0]);
-	clReleaseMemObject(down[1]);
-	clReleaseMemObject(mean[0]);
-	clReleaseMemObject(mean[1]);
+	for(uint32_t i=0;i<2;i++){
+		buf->grey[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, width*height*sizeof(unsigned char), nullptr);
+		buf->down[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
+		buf->mean[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H*sizeof(unsigned char), nullptr);
+	}
 
-	//Print execution times.
-	clFinish(queue[0]);
-	clWaitForEvents(11, events);
+	if(useImages){
+		for(uint32_t i=0;i<2;i++){
+			buf->downTex[i] = createImage(W, H);
+			buf->meanTex[i] = createImage(W, H);
+		}
+		buf->crossTex = createImage(W, H);
+	}
+}
 
-	double elapsed = (double)(time_end.tv_usec - time_start.tv_usec) / 1000000 +
-		(double)(time_end.tv_sec - time_start.tv_sec);
-	printf("---OpenCL Depth Estimator 2---\nTotal execution time: %f S.\n", elapsed);
+//Releases the device memory used by the pipeline.
+void CLDepthEstimator2::releaseBuffers(
+	Buffers* buf
+){
+	for(uint32_t i=0;i<2;i++){
+		clReleaseMemObject(buf->grey[i]);
+		clReleaseMemObject(buf->down[i]);
+		clReleaseMemObject(buf->mean[i]);
+	}
 
-	profileEvent("Left greyscale      ", events[0]);
-	profileEvent("Left downsample     ", events[1]);
-	profileEvent("Left filter         ", events[2]);
-	profileEvent("Right greyscale     ", events[3]);
-	profileEvent("Right downsample    ", events[4]);
-	profileEvent("Right filter        ", events[5]);
-	profileEvent("Left disparity      ", events[6]);
-	profileEvent("Right disparity     ", events[7]);
-	profileEvent("Cross check         ", events[8]);
-	profileEvent("Occlusion fill      ", events[9]);
-	profileEvent("Convert rgba        ", events[10]);
+	if(useImages){
+		for(uint32_t i=0;i<2;i++){
+			clReleaseMemObject(buf->downTex[i]);
+			clReleaseMemObject(buf->meanTex[i]);
+		}
+		clReleaseMemObject(buf->crossTex);
+	}
 }
 
 //Print OpenCL information.
@@ -238,77 +506,47 @@ void CLDepthEstimator2::printInfo(){
 	}
 }
 
+//Prints the device time of a finished stage event with its achieved rates.
 void CLDepthEstimator2::profileEvent(
 	const char* eventName,
+	cl_event event,
+	const StageWork& work
+){
+	printStageTime(eventName, eventSeconds(event), work, nullptr);
+}
+
+//Device execution time of a finished event in seconds.
+double CLDepthEstimator2::eventSeconds(
 	cl_event event
 ){
 	cl_ulong event_start, event_end;
 	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(event_start), &event_start, NULL);
 	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(event_end), &event_end, NULL);
-	
-	printf("%s: %f S.\n", eventName, (double)(event_end - event_start)/1000000000);
-}
-
-//Find a suitable platform.
-cl_platform_id CLDepthEstimator2::findPlatform(){
-	//Error handle.
-	cl_int err = CL_SUCCESS;
-
-	//Get platforms.
-	uint32_t numPlatforms = 0;
-	err = clGetPlatformIDs(0, nullptr, &numPlatforms);
-	if(err != CL_SUCCESS){
-		printf("Could not get platform count!\n");
-		exit(EXIT_FAILURE);
-	}
-	
-	if(numPlatforms <= 0){
-		//Platform count 0.
-		printf("No supported platforms found!\n");
-		exit(EXIT_FAILURE);
-	}
-
-	std::vector<cl_platform_id> platforms(numPlatforms);
-	err = clGetPlatformIDs(numPlatforms, platforms.data(), nullptr);
-	if(err != CL_SUCCESS){
-		printf("Could not get supported platforms!\n");
-		exit(EXIT_FAILURE);
-	}
 
-	//Just use first available platform.
-	return platforms[0];
+	return (double)(event_end - event_start)/1000000000;
 }
 
-//Find a suitable device.
-cl_device_id CLDepthEstimator2::findDevice(
-	cl_platform_id platform
+//Adds the stage events of the last pipeline run to the trace, with the first queued command lined up
+//with the host time the run was started. Left view stages run on queue 0, right view stages on queue 1.
+void CLDepthEstimator2::traceEvents(
+	cl_event* events
 ){
-	//Error handle.
-	cl_int err = CL_SUCCESS;
-
-	//Get devices.
-	uint32_t numDevices = 0;
-	err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &numDevices);
-	if(err != CL_SUCCESS){
-		printf("Could not get device count!\n");
-		exit(EXIT_FAILURE);
-	}
-
-	if(numDevices <= 0){
-		//Device count 0.
-		printf("No supported devices found!\n");
-		exit(EXIT_FAILURE);
+	if(!traceEnabled()){return;}
+
+	const uint32_t queues[10] = {0, 0, 0, 1, 1, 1, 0, 1, 0, 0};
+	cl_ulong info[10][4];
+	cl_ulong first = ~(cl_ulong)0;
+	for(uint32_t i=0;i<10;i++){
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &info[i][0], NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &info[i][1], NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &info[i][2], NULL);
+		clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &info[i][3], NULL);
+		if(info[i][0] < first){first = info[i][0];}
 	}
 
-	std::vector<cl_device_id> devices(numDevices);
-	err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, numDevices, devices.data(), nullptr);
-	if(err != CL_SUCCESS){
-		printf("Could not get supported devices!\n");
-		exit(EXIT_FAILURE);
+	for(uint32_t i=0;i<10;i++){
+		traceDeviceSpan(pipelineStageNames[i], queues[i], pipelineStart, first, info[i][0], info[i][1], info[i][2], info[i][3]);
 	}
-
-	//Just use the first available device.
-	return devices[0];
 }
 
 //Create a CL context.
@@ -389,6 +627,31 @@ cl_kernel CLDepthEstimator2::createKernel(
 	return kernel;
 }
 
+//Create the context, command queues and kernels for the chosen device.
+void CLDepthEstimator2::prepare(){
+	context = createContext(&device);
+	queue[0] = createQueue(context, device);
+	queue[1] = createQueue(context, device);
+
+	//Prepare kernels.
+	prepareKernels();
+
+	//Use the image path when the device supports images, unless disabled with DEPTH_CL_IMAGES=0.
+	cl_bool imageSupport = CL_FALSE;
+	clGetDeviceInfo(device, CL_DEVICE_IMAGE_SUPPORT, sizeof(imageSupport), &imageSupport, nullptr);
+	const char* images = getenv("DEPTH_CL_IMAGES");
+	useImages = imageSupport == CL_TRUE&&!(images != nullptr&&strcmp(images, "0") == 0);
+	if(useImages){
+		prepareImageKernels();
+	}
+
+	defaultTuning();
+	tunedKey[0] = '\0';
+
+	const char* tune = getenv("DEPTH_AUTOTUNE");
+	autotuneEnabled = tune != nullptr&&strcmp(tune, "0") != 0;
+}
+
 //Create all the needed kernel programs.
 void CLDepthEstimator2::prepareKernels(){
 	{
@@ -417,30 +680,6 @@ void CLDepthEstimator2::prepareKernels(){
 		k_greyscale = createKernel("greyscale", source);
 	}
 
-	{
-		//Create an 8bit rgba image based on a source 8bit greyscale image.
-		const char* source = R"(
-			__kernel void rgba(
-				__global const uchar* img,
-				const uint width,
-				const uint height,
-				__global uchar* out
-			){
-				int m = get_global_id(0);
-				
-				if(m<width*height){
-					unsigned int out_i = m*4;
-
-					out[out_i  ] = img[m];
-					out[out_i+1] = img[m];
-					out[out_i+2] = img[m];
-					out[out_i+3] = 255;
-				}
-			}
-		)";
-		k_rgba = createKernel("rgba", source);
-	}
-
 	{
 		//Downsample a greyscale image.
 		const char* source = R"(
@@ -466,12 +705,14 @@ void CLDepthEstimator2::prepareKernels(){
 					float4 vec = {0.0625f, 0.0625f, 0.0625f, 0.0625f};
 					float val = 0.0f;
 
+					int stride = get_local_size(0)*4;
+
 					for(int i=0;i<4;i++){
-						temp[(lm*4+i)+ln*8] = convert_float4(img[m+(N+i)*w]);
+						temp[(lm*4+i)+ln*stride] = convert_float4(img[m+(N+i)*w]);
 					}
 
 					for(int i=0;i<4;i++){
-						val += dot(temp[(lm*4+i)+ln*8], vec);
+						val += dot(temp[(lm*4+i)+ln*stride], vec);
 					}
 
 					out[m+n*w] = convert_uchar(val);
@@ -496,36 +737,37 @@ void CLDepthEstimator2::prepareKernels(){
 				int n = get_global_id(1);
 				int lm = get_local_id(0);
 				int ln = get_local_id(1);
-				int gm = get_group_id(0);
-				int gn = get_group_id(1);
+				int lw = get_local_size(0);
+				int lh = get_local_size(1);
+
+				//The tile covers the workgroup and a halo of radius pixels around it.
+				int r = radius;
+				int tw = lw+2*r;
+				int th = lh+2*r;
+				int x0 = (int)get_group_id(0)*lw-r;
+				int y0 = (int)get_group_id(1)*lh-r;
+
+				for(int i=lm+ln*lw;i<tw*th;i+=lw*lh){
+					int x = x0+i%tw;
+					int y = y0+i/tw;
+					if(0<=x&&x<width&&0<=y&&y<height){
+						temp[i] = convert_float(img[x+y*width]);
+					}else{
+						temp[i] = 0.0f;
+					}
+				}
+				barrier(CLK_LOCAL_MEM_FENCE);
 
 				if((m<width)&&(n<height)){
 					float val = 0.0f;
 
-					for(int i=0;i<=2;i++){
-						for(int j=0;j<=2;j++){
-							int x = lm*2+j-4+gm*8;
-							int y = ln*2+i-4+gn*8;
-							int lx = lm*2+j;
-							int ly = ln*2+i;
-							if(0<=x&&x<width&&0<=y&&y<height){
-								temp[lx+ly*16] = convert_float(img[x+y*width]);
-							}else{
-								temp[lx+ly*16] = 0.0f;
-							}
-						}
-					}
-					barrier(CLK_LOCAL_MEM_FENCE);
-
-					for(int i=-4;i<=4;i++){
-						for(int j=-4;j<=4;j++){
-							int lx = lm+4+j;
-							int ly = ln+4+i;
-							val += temp[lx+ly*16];
+					for(int i=0;i<=2*r;i++){
+						for(int j=0;j<=2*r;j++){
+							val += temp[(lm+j)+(ln+i)*tw];
 						}
 					}
 
-					float d = 4*2+1;
+					float d = r*2+1;
 					out[m+n*width] = convert_uchar(val / (d*d));
 				}
 			}
@@ -568,8 +810,8 @@ void CLDepthEstimator2::prepareKernels(){
 						denom_0 = 0.0f;
 						denom_1 = 0.0f;
 
-						for(int i=n-radius;i<=n+radius;i++){
-							for(int j=m-radius;j<=m+radius;j++){
+						for(int i=n-(int)radius;i<=n+(int)radius;i++){
+							for(int j=m-(int)radius;j<=m+(int)radius;j++){
 								if(0<=i&&i<height&&0<=(j+direction*d)&&(j+direction*d)<width&&0<=j&&j<width){
 									std_0 = img_0[j+i*width] - mean_0[m+n*width];
 									std_1 = img_1[j+i*width+direction*d] - mean_1[m+n*width+direction*d];
@@ -635,8 +877,8 @@ void CLDepthEstimator2::prepareKernels(){
 					}else{
 						float numer = 0.0f;
 						int denom = 0;
-						for(int i=n-radius;i<=n+radius;i++){
-							for(int j=m-radius;j<=m+radius;j++){
+						for(int i=n-(int)radius;i<=n+(int)radius;i++){
+							for(int j=m-(int)radius;j<=m+(int)radius;j++){
 								if(0<=i&&i<height&&0<=j&&j<width){
 									if(img[j+i*width] > 0){
 										numer += img[j+i*width];
@@ -654,134 +896,515 @@ void CLDepthEstimator2::prepareKernels(){
 	}
 }
 
-//Creates an OpenCL buffer and returns the handle.
-cl_mem CLDepthEstimator2::createBuffer(
-	cl_mem_flags flags,
-	uint32_t size,
-	void* copy
-){
-	//Error handle.
-	cl_int err = CL_SUCCESS;
+//Create the kernels that read their inputs through a sampler. Reads outside the image return 0,
+//so the window loops need no bounds checks where 0 is the wanted padding.
+void CLDepthEstimator2::prepareImageKernels(){
+	{
+		//Downsample a greyscale image into an image.
+		const char* source = R"(
+			__kernel void downsampleImage(
+				__global const uchar4* img,
+				const uint width,
+				const uint height,
+				const uint factor,
+				__write_only image2d_t out
+			){
+				int m = get_global_id(0);
+				int n = get_global_id(1);
 
-	cl_mem buf = clCreateBuffer(context, flags, size, copy, &err);
-	if(err != CL_SUCCESS){
-		printf("Could not create a buffer!\n");
-		exit(EXIT_FAILURE);
-	}
+				unsigned int w = width/4;
+				unsigned int h = height/4;
 
-	return buf;
-}
+				if((m<w)&&(n<h)){
+					int N = n * 4;
+					float4 vec = {0.0625f, 0.0625f, 0.0625f, 0.0625f};
+					float val = 0.0f;
 
-//Loads an image from a file and sends it to the GPU via a staging buffer in order to utilize faster local device memory.
-void CLDepthEstimator2::loadImage(
-	cl_command_queue queue,
-	const char* filename,
-	uint32_t* width,
-	uint32_t* height,
-	cl_mem* image
-){
-	//Error handle.
-	cl_int err = CL_SUCCESS;
+					for(int i=0;i<4;i++){
+						val += dot(convert_float4(img[m+(N+i)*w]), vec);
+					}
 
-	//Load image.
-	unsigned char* img;
-	uint32_t w, h;
+					write_imageui(out, (int2)(m, n), (uint4)(convert_uchar(val), 0, 0, 0));
+				}
+			}
+		)";
+		k_downsampleImage = createKernel("downsampleImage", source);
+	}
 
-	imgLoad(filename, &w, &h, &img);
-	uint32_t len = w * h * 4 * sizeof(unsigned char);
+	{
+		//A mean filter with an adjustable radius.
+		const char* source = R"(
+			__constant sampler_t smp = CLK_NORMALIZED_COORDS_FALSE|CLK_ADDRESS_CLAMP|CLK_FILTER_NEAREST;
 
-	*width = w;
-	*height = h;
+			__kernel void filterImage(
+				__read_only image2d_t img,
+				const uint width,
+				const uint height,
+				const uint radius,
+				__write_only image2d_t out
+			){
+				int m = get_global_id(0);
+				int n = get_global_id(1);
 
-	//Create a staging buffer.
-	cl_mem d_staging = createBuffer(CL_MEM_COPY_HOST_PTR, len, img);
-	free(img);
+				if((m<width)&&(n<height)){
+					int r = radius;
+					float val = 0.0f;
 
-	//Create a buffer for the image.
-	*image = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_ONLY, len, nullptr);
+					for(int i=n-r;i<=n+r;i++){
+						for(int j=m-r;j<=m+r;j++){
+							val += convert_float(read_imageui(img, smp, (int2)(j, i)).x);
+						}
+					}
 
-	//Copy image from the staging buffer.
-	err = clEnqueueCopyBuffer(queue, d_staging, *image, 0, 0, len, 0, nullptr, nullptr);
-	if(err != CL_SUCCESS){
-		printf("Could not copy contents from the staging buffer!\n");
+					float d = r*2+1;
+					write_imageui(out, (int2)(m, n), (uint4)(convert_uchar(val / (d*d)), 0, 0, 0));
+				}
+			}
+		)";
+		k_filterImage = createKernel("filterImage", source);
+	}
+
+	{
+		//Calculate disparity from two greyscale images.
+		const char* source = R"(
+			__constant sampler_t smp = CLK_NORMALIZED_COORDS_FALSE|CLK_ADDRESS_CLAMP|CLK_FILTER_NEAREST;
+
+			__kernel void disparityImage(
+				__read_only image2d_t img_0,
+				__read_only image2d_t img_1,
+				__read_only image2d_t mean_0,
+				__read_only image2d_t mean_1,
+				const uint width,
+				const uint height,
+				const uint radius,
+				const uint maxDisparity,
+				const int direction,
+				__global uchar* out
+			){
+				int m = get_global_id(0);
+				int n = get_global_id(1);
+
+				if((m<width)&&(n<height)){
+					int r = radius;
+					float top_zncc = -1.0f;
+					float temp_zncc = -1.0f;
+					unsigned char disparity = 0;
+
+					//Out of bound pixels are skipped, so the loops are clipped to the image instead.
+					int i0 = max(n-r, 0);
+					int i1 = min(n+r, (int)height-1);
+					float avg_0 = read_imageui(mean_0, smp, (int2)(m, n)).x;
+
+					for(int d=0;d<maxDisparity;d++){
+						int s = direction*d;
+						if((m+s)<0||width<=(m+s)){break;}
+						int j0 = max(max(m-r, 0), -s);
+						int j1 = min(min(m+r, (int)width-1), (int)width-1-s);
+						float avg_1 = read_imageui(mean_1, smp, (int2)(m+s, n)).x;
+
+						float numer = 0.0f;
+						float denom_0 = 0.0f;
+						float denom_1 = 0.0f;
+
+						for(int i=i0;i<=i1;i++){
+							for(int j=j0;j<=j1;j++){
+								float std_0 = (float)read_imageui(img_0, smp, (int2)(j, i)).x - avg_0;
+								float std_1 = (float)read_imageui(img_1, smp, (int2)(j+s, i)).x - avg_1;
+								numer += std_0 * std_1;
+								denom_0 += std_0 * std_0;
+								denom_1 += std_1 * std_1;
+							}
+						}
+
+						temp_zncc = numer / (sqrt(denom_0) * sqrt(denom_1));
+						if(temp_zncc > top_zncc){
+							top_zncc = temp_zncc;
+							disparity = d;
+						}
+					}
+
+					out[m+n*width] = disparity;
+				}
+			}
+		)";
+		k_disparityImage = createKernel("disparityImage", source);
+	}
+
+	{
+		//Combine two disparity maps together into an image.
+		const char* source = R"(
+			__kernel void crosscheckImage(
+				__global const uchar* left,
+				__global const uchar* right,
+				const uint width,
+				const uint height,
+				const uint maxDifference,
+				__write_only image2d_t out
+			){
+				int m = get_global_id(0);
+
+				if(m < width*height){
+					uint val = left[m];
+					if(abs(left[m] - right[m]) > maxDifference){
+						val = 0;
+					}
+					write_imageui(out, (int2)(m%width, m/width), (uint4)(val, 0, 0, 0));
+				}
+			}
+		)";
+		k_crossImage = createKernel("crosscheckImage", source);
+	}
+
+	{
+		//Fill blank spaces left by cross check.
+		const char* source = R"(
+			__constant sampler_t smp = CLK_NORMALIZED_COORDS_FALSE|CLK_ADDRESS_CLAMP|CLK_FILTER_NEAREST;
+
+			__kernel void occlusionImage(
+				__read_only image2d_t img,
+				const uint width,
+				const uint height,
+				const uint radius,
+				__global uchar* out
+			){
+				int m = get_global_id(0);
+				int n = get_global_id(1);
+
+				if((m<width)&&(n<height)){
+					int r = radius;
+					uint center = read_imageui(img, smp, (int2)(m, n)).x;
+					if(center > 0){
+						out[m+n*width] = center;
+					}else{
+						float numer = 0.0f;
+						int denom = 0;
+						for(int i=n-r;i<=n+r;i++){
+							for(int j=m-r;j<=m+r;j++){
+								uint val = read_imageui(img, smp, (int2)(j, i)).x;
+								if(val > 0){
+									numer += val;
+									denom++;
+								}
+							}
+						}
+						out[m+n*width] = numer / denom;
+					}
+				}
+			}
+		)";
+		k_occlusionImage = createKernel("occlusionImage", source);
+	}
+}
+
+//Creates an OpenCL buffer and returns the handle.
+cl_mem CLDepthEstimator2::createBuffer(
+	cl_mem_flags flags,
+	uint32_t size,
+	void* copy
+){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	cl_mem buf = clCreateBuffer(context, flags, size, copy, &err);
+	if(err != CL_SUCCESS){
+		printf("Could not create a buffer!\n");
 		exit(EXIT_FAILURE);
 	}
 
-	clReleaseMemObject(d_staging);
+	return buf;
 }
 
-//Copies the image into a staging buffer and back onto host memory for writing.
-void CLDepthEstimator2::writeImage(
+//Creates a single channel 8bit image for the sampler based kernels. The unnormalized CL_UNSIGNED_INT8 format
+//is kept over CL_UNORM_INT8: read_imageui returns the stored bytes as they are, so the image kernels do the same
+//integer arithmetic as the buffer kernels and give identical results, where a normalized read would have to be
+//scaled back by 255 and rounded on every window tap.
+cl_mem CLDepthEstimator2::createImage(
+	const uint32_t width,
+	const uint32_t height
+){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	cl_image_format format = {CL_R, CL_UNSIGNED_INT8};
+	cl_image_desc desc = {};
+	desc.image_type = CL_MEM_OBJECT_IMAGE2D;
+	desc.image_width = width;
+	desc.image_height = height;
+
+	cl_mem image = clCreateImage(context, CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, &format, &desc, nullptr, &err);
+	if(err != CL_SUCCESS){
+		printf("Could not create an image!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return image;
+}
+
+//Reads a whole image of width * height bytes back into a plane.
+void CLDepthEstimator2::readImagePlane(
 	cl_command_queue queue,
-	const char* filename,
-	uint32_t width,
-	uint32_t height,
+	cl_mem* image,
+	const uint32_t width,
+	const uint32_t height,
+	unsigned char* plane
+){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	//Copy the image into a buffer and read it like the other planes.
+	cl_mem d_plane = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, width*height, nullptr);
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {width, height, 1};
+	err = clEnqueueCopyImageToBuffer(queue, *image, d_plane, origin, region, 0, 0, nullptr, nullptr);
+	if(err != CL_SUCCESS){
+		printf("Could not copy an image into a buffer!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	readPlane(queue, &d_plane, width, height, plane);
+	clReleaseMemObject(d_plane);
+}
+
+//Sends an image to the GPU via a staging buffer in order to utilize faster local device memory.
+void CLDepthEstimator2::uploadImage(
+	cl_command_queue queue,
+	const unsigned char* img,
+	const uint32_t len,
 	cl_mem* image
 ){
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
 	//Error handle.
 	cl_int err = CL_SUCCESS;
 
-	uint32_t len = width * height * 4 * sizeof(unsigned char);
+	//Create a staging buffer.
+	cl_mem d_staging = createBuffer(CL_MEM_COPY_HOST_PTR, len, (void*)img);
+
+	//Create a buffer for the image.
+	*image = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_ONLY, len, nullptr);
+
+	//Copy image from the staging buffer.
+	err = clEnqueueCopyBuffer(queue, d_staging, *image, 0, 0, len, 0, nullptr, nullptr);
+	if(err != CL_SUCCESS){
+		printf("Could not copy contents from the staging buffer!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	clReleaseMemObject(d_staging);
+
+	gettimeofday(&end, NULL);
+	traceSpan("upload", "transfer", start, end);
+}
+
+//Copies a range of the image into a staging buffer and back onto host memory.
+void CLDepthEstimator2::readImage(
+	cl_command_queue queue,
+	cl_mem* image,
+	const uint32_t offset,
+	const uint32_t len,
+	unsigned char* out
+){
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	//Error handle.
+	cl_int err = CL_SUCCESS;
 
 	//Create a staging buffer.
 	cl_mem d_staging = createBuffer(CL_MEM_HOST_READ_ONLY, len, nullptr);
 
 	//Copy image to the staging buffer.
-	err = clEnqueueCopyBuffer(queue, *image, d_staging, 0, 0, len, 0, nullptr, nullptr);
+	err = clEnqueueCopyBuffer(queue, *image, d_staging, offset, 0, len, 0, nullptr, nullptr);
 	if(err != CL_SUCCESS){
 		printf("Could not copy contents to the staging buffer!\n");
 		exit(EXIT_FAILURE);
 	}
 
 	//Read contents from the staging buffer.
-	unsigned char* img = (unsigned char*)malloc(len);
-
-	err = clEnqueueReadBuffer(queue, d_staging, CL_TRUE, 0, len, img, 0, NULL, NULL);
+	err = clEnqueueReadBuffer(queue, d_staging, CL_TRUE, 0, len, out, 0, NULL, NULL);
 	if(err != CL_SUCCESS){
 		printf("Could not read results!\n");
 		exit(EXIT_FAILURE);
 	}
 
-	//Write image to a file.
-	imgWrite(filename, width, height, img);
-
 	clReleaseMemObject(d_staging);
-	free(img);
+
+	gettimeofday(&end, NULL);
+	traceSpan("download", "transfer", start, end);
 }
 
-//Executes a kernel program that creates a new 8bit greyscale image from a source 8bit/channel rgba image.
-void CLDepthEstimator2::makeImgGrey(
+//Sends a frame with padded rows to the GPU via a staging buffer. The rows are packed on the device.
+void CLDepthEstimator2::uploadFrame(
 	cl_command_queue queue,
-	cl_mem* img,
+	const unsigned char* img,
 	const uint32_t width,
 	const uint32_t height,
-	cl_mem* out,
-	cl_event* event
+	const uint32_t stride,
+	const uint32_t channels,
+	cl_mem* image
 ){
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
 	//Error handle.
 	cl_int err = CL_SUCCESS;
 
-	//Create the greyscale image.
-	err = clSetKernelArg(k_greyscale, 0, sizeof(cl_mem), img);
-	err |= clSetKernelArg(k_greyscale, 1, sizeof(uint32_t), &width);
-	err |= clSetKernelArg(k_greyscale, 2, sizeof(uint32_t), &height);
-	err |= clSetKernelArg(k_greyscale, 3, sizeof(cl_mem), out);
-	err |= clSetKernelArg(k_greyscale, 4, LOCAL_SIZE*4*sizeof(float), NULL);
+	uint32_t len = width * height * channels;
+
+	//Pack the rows into a staging buffer.
+	cl_mem d_staging = createBuffer(CL_MEM_HOST_WRITE_ONLY|CL_MEM_READ_ONLY, len, nullptr);
+
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {width * channels, height, 1};
+	err = clEnqueueWriteBufferRect(queue, d_staging, CL_TRUE, origin, origin, region,
+		width * channels, 0, stride, 0, img, 0, nullptr, nullptr);
 	if(err != CL_SUCCESS){
-		printf("Could not set greyscale kernel arguments!\n");
+		printf("Could not write the staging buffer!\n");
 		exit(EXIT_FAILURE);
 	}
-	const size_t local[1] = {LOCAL_SIZE};
-	const size_t global[1] = {(size_t)ceil((width*height)/local[0])*local[0]};
-	err = clEnqueueNDRangeKernel(queue, k_greyscale, 1, 0, global, local, 0, NULL, event);
+
+	//Copy image from the staging buffer.
+	err = clEnqueueCopyBuffer(queue, d_staging, *image, 0, 0, len, 0, nullptr, nullptr);
 	if(err != CL_SUCCESS){
-		printf("Could not submit greyscale work!\n");
+		printf("Could not copy contents from the staging buffer!\n");
 		exit(EXIT_FAILURE);
 	}
+
+	clReleaseMemObject(d_staging);
+
+	gettimeofday(&end, NULL);
+	traceSpan("upload", "transfer", start, end);
 }
 
-//Reverse of the greyscale operation. Creates an 8bit rgba image from a source 8bit greyscale image.
-void CLDepthEstimator2::makeImgRGBA(
+//Copies the rows [rowBegin, rowEnd) of a packed image into host rows that are outStride bytes apart.
+void CLDepthEstimator2::readRows(
+	cl_command_queue queue,
+	cl_mem* image,
+	const uint32_t width,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	uint32_t len = width * (rowEnd - rowBegin);
+
+	//Create a staging buffer.
+	cl_mem d_staging = createBuffer(CL_MEM_HOST_READ_ONLY, len, nullptr);
+
+	//Copy image to the staging buffer.
+	err = clEnqueueCopyBuffer(queue, *image, d_staging, width * rowBegin, 0, len, 0, nullptr, nullptr);
+	if(err != CL_SUCCESS){
+		printf("Could not copy contents to the staging buffer!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//Read the rows from the staging buffer.
+	const size_t origin[3] = {0, 0, 0};
+	const size_t region[3] = {width, rowEnd - rowBegin, 1};
+	err = clEnqueueReadBufferRect(queue, d_staging, CL_TRUE, origin, origin, region,
+		width, 0, outStride, 0, out, 0, nullptr, nullptr);
+	if(err != CL_SUCCESS){
+		printf("Could not read results!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	clReleaseMemObject(d_staging);
+
+	gettimeofday(&end, NULL);
+	traceSpan("download", "transfer", start, end);
+}
+
+//Reads a whole buffer of width * height bytes back into a plane.
+void CLDepthEstimator2::readPlane(
+	cl_command_queue queue,
+	cl_mem* buffer,
+	const uint32_t width,
+	const uint32_t height,
+	unsigned char* plane
+){
+	readRows(queue, buffer, width, 0, height, plane, width);
+}
+
+//Loads the left and right images and sends them to the GPU as grey images. The images are decoded on two
+//host threads and each thread uploads its image and converts it to grey on its own queue as soon as it is
+//decoded, so the upload and greyscale conversion of one image overlap the decode of the other. channels is
+//set to the channels of the left file and greyEvents to the conversion events, empty markers for grey files.
+//The conversion runs with the workgroup sizes in place, the frame size is only known once both files are decoded.
+void CLDepthEstimator2::loadImages(
+	const char* left_name,
+	const char* right_name,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	cl_mem* images,
+	cl_event* greyEvents
+){
+	const char* names[2] = {left_name, right_name};
+	uint32_t w[2], h[2], c[2] = {0, 0};
+	bool queued = false;
+
+	#pragma omp parallel for num_threads(2)
+	for(uint32_t i=0;i<2;i++){
+		unsigned char* img;
+		imgLoad(names[i], &w[i], &h[i], &c[i], &img);
+		uploadImage(queue[i], img, w[i] * h[i] * c[i] * sizeof(unsigned char), &images[i]);
+		free(img);
+
+		//The kernel arguments are shared, so one thread enqueues at a time.
+		#pragma omp critical
+		{
+			if(!queued){
+				gettimeofday(&loadStart, NULL);
+				queued = true;
+			}
+			if(c[i] == 4){
+				cl_mem rgba = images[i];
+				images[i] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, w[i] * h[i] * sizeof(unsigned char), nullptr);
+				makeImgGrey(queue[i], &rgba, w[i], h[i], &images[i], &greyEvents[i]);
+				clReleaseMemObject(rgba);
+			}else{
+				clEnqueueMarkerWithWaitList(queue[i], 0, nullptr, &greyEvents[i]);
+			}
+		}
+	}
+
+	checkPair(names, w, h);
+
+	*width = w[0];
+	*height = h[0];
+	*channels = c[0];
+}
+
+//Copies a grey or rgba image back onto host memory for writing.
+void CLDepthEstimator2::writeImage(
+	cl_command_queue queue,
+	const char* filename,
+	uint32_t width,
+	uint32_t height,
+	uint32_t channels,
+	cl_mem* image
+){
+	uint32_t len = width * height * channels * sizeof(unsigned char);
+
+	//Read contents from the device.
+	unsigned char* img = (unsigned char*)malloc(len);
+	readImage(queue, image, 0, len, img);
+
+	//Write image to a file.
+	imgWrite(filename, width, height, channels, img);
+
+	free(img);
+}
+
+//Executes a kernel program that creates a new 8bit greyscale image from a source 8bit/channel rgba image.
+void CLDepthEstimator2::makeImgGrey(
 	cl_command_queue queue,
 	cl_mem* img,
 	const uint32_t width,
@@ -793,19 +1416,20 @@ void CLDepthEstimator2::makeImgRGBA(
 	cl_int err = CL_SUCCESS;
 
 	//Create the greyscale image.
-	err = clSetKernelArg(k_rgba, 0, sizeof(cl_mem), img);
-	err |= clSetKernelArg(k_rgba, 1, sizeof(uint32_t), &width);
-	err |= clSetKernelArg(k_rgba, 2, sizeof(uint32_t), &height);
-	err |= clSetKernelArg(k_rgba, 3, sizeof(cl_mem), out);
+	err = clSetKernelArg(k_greyscale, 0, sizeof(cl_mem), img);
+	err |= clSetKernelArg(k_greyscale, 1, sizeof(uint32_t), &width);
+	err |= clSetKernelArg(k_greyscale, 2, sizeof(uint32_t), &height);
+	err |= clSetKernelArg(k_greyscale, 3, sizeof(cl_mem), out);
+	err |= clSetKernelArg(k_greyscale, 4, localBytes(KERNEL_GREYSCALE, localSize[KERNEL_GREYSCALE]), NULL);
 	if(err != CL_SUCCESS){
-		printf("Could not set rgba kernel arguments!\n");
+		printf("Could not set greyscale kernel arguments!\n");
 		exit(EXIT_FAILURE);
 	}
-	const size_t local[1] = {LOCAL_SIZE};
-	const size_t global[1] = {(size_t)ceil((width*height)/local[0])*local[0]};
-	err = clEnqueueNDRangeKernel(queue, k_rgba, 1, 0, global, local, 0, NULL, event);
+	const size_t local[1] = {localSize[KERNEL_GREYSCALE][0]};
+	const size_t global[1] = {(width*height+local[0]-1)/local[0]*local[0]};
+	err = clEnqueueNDRangeKernel(queue, k_greyscale, 1, 0, global, local, 0, NULL, event);
 	if(err != CL_SUCCESS){
-		printf("Could not submit rgba work!\n");
+		printf("Could not submit greyscale work!\n");
 		exit(EXIT_FAILURE);
 	}
 }
@@ -829,15 +1453,15 @@ void CLDepthEstimator2::downsampleImg(
 	err |= clSetKernelArg(k_downsample, 2, sizeof(uint32_t), &height);
 	err |= clSetKernelArg(k_downsample, 3, sizeof(uint32_t), &factor);
 	err |= clSetKernelArg(k_downsample, 4, sizeof(cl_mem), out);
-	err |= clSetKernelArg(k_downsample, 5, LOCAL_SIZE*4*4*sizeof(float), NULL);
+	err |= clSetKernelArg(k_downsample, 5, localBytes(KERNEL_DOWNSAMPLE, localSize[KERNEL_DOWNSAMPLE]), NULL);
 	if(err != CL_SUCCESS){
 		printf("Could not set downsample kernel arguments!\n");
 		exit(EXIT_FAILURE);
 	}
-	const size_t local[2] = {LOCAL_SIZE_X, LOCAL_SIZE_Y};
+	const size_t local[2] = {localSize[KERNEL_DOWNSAMPLE][0], localSize[KERNEL_DOWNSAMPLE][1]};
 	const size_t global[2] = {
-		(size_t)(ceil((width/factor)/local[0])*local[0]),
-		(size_t)(ceil((height/factor)/local[1])*local[1])
+		(width/factor+local[0]-1)/local[0]*local[0],
+		(height/factor+local[1]-1)/local[1]*local[1]
 	};
 	err = clEnqueueNDRangeKernel(queue, k_downsample, 2, 0, global, local, 0, NULL, event);
 	if(err != CL_SUCCESS){
@@ -865,15 +1489,15 @@ void CLDepthEstimator2::filterImg(
 	err |= clSetKernelArg(k_filter, 2, sizeof(uint32_t), &height);
 	err |= clSetKernelArg(k_filter, 3, sizeof(uint32_t), &radius);
 	err |= clSetKernelArg(k_filter, 4, sizeof(cl_mem), out);
-	err |= clSetKernelArg(k_filter, 5, 16*16*sizeof(float), NULL);
+	err |= clSetKernelArg(k_filter, 5, (localSize[KERNEL_FILTER][0]+2*radius)*(localSize[KERNEL_FILTER][1]+2*radius)*sizeof(float), NULL);
 	if(err != CL_SUCCESS){
 		printf("Could not set filter kernel arguments!\n");
 		exit(EXIT_FAILURE);
 	}
-	const size_t local[2] = {LOCAL_SIZE_X, LOCAL_SIZE_Y};
+	const size_t local[2] = {localSize[KERNEL_FILTER][0], localSize[KERNEL_FILTER][1]};
 	const size_t global[2] = {
-		(size_t)(ceil(width/local[0])*local[0]),
-		(size_t)(ceil(height/local[1])*local[1])
+		(width+local[0]-1)/local[0]*local[0],
+		(height+local[1]-1)/local[1]*local[1]
 	};
 	err = clEnqueueNDRangeKernel(queue, k_filter, 2, 0, global, local, 0, NULL, event);
 	if(err != CL_SUCCESS){
@@ -915,10 +1539,10 @@ void CLDepthEstimator2::calcDisparity(
 		printf("Could not set disparity kernel arguments!\n");
 		exit(EXIT_FAILURE);
 	}
-	const size_t local[2] = {LOCAL_SIZE_X, LOCAL_SIZE_Y};
+	const size_t local[2] = {localSize[KERNEL_DISPARITY][0], localSize[KERNEL_DISPARITY][1]};
 	const size_t global[2] = {
-		(size_t)(ceil(width/local[0])*local[0]),
-		(size_t)(ceil(height/local[1])*local[1])
+		(width+local[0]-1)/local[0]*local[0],
+		(height+local[1]-1)/local[1]*local[1]
 	};
 	err = clEnqueueNDRangeKernel(queue, k_disparity, 2, 0, global, local, 0, NULL, event);
 	if(err != CL_SUCCESS){
@@ -950,8 +1574,8 @@ void CLDepthEstimator2::crossCheck(
 		printf("Could not set cross kernel arguments!\n");
 		exit(EXIT_FAILURE);
 	}
-	const size_t local[1] = {LOCAL_SIZE};
-	const size_t global[1] = {(size_t)ceil((width*height)/local[0])*local[0]};
+	const size_t local[1] = {localSize[KERNEL_CROSS][0]};
+	const size_t global[1] = {(width*height+local[0]-1)/local[0]*local[0]};
 	err = clEnqueueNDRangeKernel(queue, k_cross, 1, 0, global, local, 0, NULL, event);
 	if(err != CL_SUCCESS){
 		printf("Could not submit cross work!\n");
@@ -982,10 +1606,10 @@ void CLDepthEstimator2::occlusionFill(
 		printf("Could not set occlusion kernel arguments!\n");
 		exit(EXIT_FAILURE);
 	}
-	const size_t local[2] = {LOCAL_SIZE_X, LOCAL_SIZE_Y};
+	const size_t local[2] = {localSize[KERNEL_OCCLUSION][0], localSize[KERNEL_OCCLUSION][1]};
 	const size_t global[2] = {
-		(size_t)(ceil(width/local[0])*local[0]),
-		(size_t)(ceil(height/local[1])*local[1])
+		(width+local[0]-1)/local[0]*local[0],
+		(height+local[1]-1)/local[1]*local[1]
 	};
 	err = clEnqueueNDRangeKernel(queue, k_occlusion, 2, 0, global, local, 0, NULL, event);
 	if(err != CL_SUCCESS){
@@ -993,3 +1617,429 @@ void CLDepthEstimator2::occlusionFill(
 		exit(EXIT_FAILURE);
 	}
 }
+
+//Same as downsampleImg, but writes the result into an image.
+void CLDepthEstimator2::downsampleImage(
+	cl_command_queue queue,
+	cl_mem* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t factor,
+	cl_mem* out,
+	cl_event* event
+){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(k_downsampleImage, 0, sizeof(cl_mem), img);
+	err |= clSetKernelArg(k_downsampleImage, 1, sizeof(uint32_t), &width);
+	err |= clSetKernelArg(k_downsampleImage, 2, sizeof(uint32_t), &height);
+	err |= clSetKernelArg(k_downsampleImage, 3, sizeof(uint32_t), &factor);
+	err |= clSetKernelArg(k_downsampleImage, 4, sizeof(cl_mem), out);
+	if(err != CL_SUCCESS){
+		printf("Could not set downsample image kernel arguments!\n");
+		exit(EXIT_FAILURE);
+	}
+	const size_t local[2] = {localSize[KERNEL_DOWNSAMPLE][0], localSize[KERNEL_DOWNSAMPLE][1]};
+	const size_t global[2] = {
+		(width/factor+local[0]-1)/local[0]*local[0],
+		(height/factor+local[1]-1)/local[1]*local[1]
+	};
+	err = clEnqueueNDRangeKernel(queue, k_downsampleImage, 2, 0, global, local, 0, NULL, event);
+	if(err != CL_SUCCESS){
+		printf("Could not submit downsample image work!\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Same as filterImg, but reads the source through a sampler and writes the result into an image.
+void CLDepthEstimator2::filterImage(
+	cl_command_queue queue,
+	cl_mem* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t radius,
+	cl_mem* out,
+	cl_event* event
+){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(k_filterImage, 0, sizeof(cl_mem), img);
+	err |= clSetKernelArg(k_filterImage, 1, sizeof(uint32_t), &width);
+	err |= clSetKernelArg(k_filterImage, 2, sizeof(uint32_t), &height);
+	err |= clSetKernelArg(k_filterImage, 3, sizeof(uint32_t), &radius);
+	err |= clSetKernelArg(k_filterImage, 4, sizeof(cl_mem), out);
+	if(err != CL_SUCCESS){
+		printf("Could not set filter image kernel arguments!\n");
+		exit(EXIT_FAILURE);
+	}
+	const size_t local[2] = {localSize[KERNEL_FILTER][0], localSize[KERNEL_FILTER][1]};
+	const size_t global[2] = {
+		(width+local[0]-1)/local[0]*local[0],
+		(height+local[1]-1)/local[1]*local[1]
+	};
+	err = clEnqueueNDRangeKernel(queue, k_filterImage, 2, 0, global, local, 0, NULL, event);
+	if(err != CL_SUCCESS){
+		printf("Could not submit filter image work!\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Same as crossCheck, but writes the combined map into an image instead of over the left one.
+void CLDepthEstimator2::crossCheckImage(
+	cl_command_queue queue,
+	cl_mem* left,
+	cl_mem* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t maxDifference,
+	cl_mem* out,
+	cl_event* event
+){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(k_crossImage, 0, sizeof(cl_mem), left);
+	err |= clSetKernelArg(k_crossImage, 1, sizeof(cl_mem), right);
+	err |= clSetKernelArg(k_crossImage, 2, sizeof(uint32_t), &width);
+	err |= clSetKernelArg(k_crossImage, 3, sizeof(uint32_t), &height);
+	err |= clSetKernelArg(k_crossImage, 4, sizeof(uint32_t), &maxDifference);
+	err |= clSetKernelArg(k_crossImage, 5, sizeof(cl_mem), out);
+	if(err != CL_SUCCESS){
+		printf("Could not set cross image kernel arguments!\n");
+		exit(EXIT_FAILURE);
+	}
+	const size_t local[1] = {localSize[KERNEL_CROSS][0]};
+	const size_t global[1] = {(width*height+local[0]-1)/local[0]*local[0]};
+	err = clEnqueueNDRangeKernel(queue, k_crossImage, 1, 0, global, local, 0, NULL, event);
+	if(err != CL_SUCCESS){
+		printf("Could not submit cross image work!\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Same as calcDisparity, but reads the sources and their means through a sampler.
+void CLDepthEstimator2::calcDisparityImage(
+	cl_command_queue queue,
+	cl_mem* img_0,
+	cl_mem* img_1,
+	cl_mem* mean_0,
+	cl_mem* mean_1,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t radius,
+	const uint32_t maxDisparity,
+	const int32_t direction,
+	cl_mem* out,
+	cl_event* event
+){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(k_disparityImage, 0, sizeof(cl_mem), img_0);
+	err |= clSetKernelArg(k_disparityImage, 1, sizeof(cl_mem), img_1);
+	err |= clSetKernelArg(k_disparityImage, 2, sizeof(cl_mem), mean_0);
+	err |= clSetKernelArg(k_disparityImage, 3, sizeof(cl_mem), mean_1);
+	err |= clSetKernelArg(k_disparityImage, 4, sizeof(uint32_t), &width);
+	err |= clSetKernelArg(k_disparityImage, 5, sizeof(uint32_t), &height);
+	err |= clSetKernelArg(k_disparityImage, 6, sizeof(uint32_t), &radius);
+	err |= clSetKernelArg(k_disparityImage, 7, sizeof(uint32_t), &maxDisparity);
+	err |= clSetKernelArg(k_disparityImage, 8, sizeof(int32_t), &direction);
+	err |= clSetKernelArg(k_disparityImage, 9, sizeof(cl_mem), out);
+	if(err != CL_SUCCESS){
+		printf("Could not set disparity image kernel arguments!\n");
+		exit(EXIT_FAILURE);
+	}
+	const size_t local[2] = {localSize[KERNEL_DISPARITY][0], localSize[KERNEL_DISPARITY][1]};
+	const size_t global[2] = {
+		(width+local[0]-1)/local[0]*local[0],
+		(height+local[1]-1)/local[1]*local[1]
+	};
+	err = clEnqueueNDRangeKernel(queue, k_disparityImage, 2, 0, global, local, 0, NULL, event);
+	if(err != CL_SUCCESS){
+		printf("Could not submit disparity image work!\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Same as occlusionFill, but reads the cross checked map through a sampler.
+void CLDepthEstimator2::occlusionFillImage(
+	cl_command_queue queue,
+	cl_mem* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t radius,
+	cl_mem* out,
+	cl_event* event
+){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(k_occlusionImage, 0, sizeof(cl_mem), img);
+	err |= clSetKernelArg(k_occlusionImage, 1, sizeof(uint32_t), &width);
+	err |= clSetKernelArg(k_occlusionImage, 2, sizeof(uint32_t), &height);
+	err |= clSetKernelArg(k_occlusionImage, 3, sizeof(uint32_t), &radius);
+	err |= clSetKernelArg(k_occlusionImage, 4, sizeof(cl_mem), out);
+	if(err != CL_SUCCESS){
+		printf("Could not set occlusion image kernel arguments!\n");
+		exit(EXIT_FAILURE);
+	}
+	const size_t local[2] = {localSize[KERNEL_OCCLUSION][0], localSize[KERNEL_OCCLUSION][1]};
+	const size_t global[2] = {
+		(width+local[0]-1)/local[0]*local[0],
+		(height+local[1]-1)/local[1]*local[1]
+	};
+	err = clEnqueueNDRangeKernel(queue, k_occlusionImage, 2, 0, global, local, 0, NULL, event);
+	if(err != CL_SUCCESS){
+		printf("Could not submit occlusion image work!\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Local memory needed by a kernel for a given workgroup size.
+size_t CLDepthEstimator2::localBytes(
+	const uint32_t kernel,
+	const size_t* local
+){
+	switch(kernel){
+		case KERNEL_GREYSCALE: return local[0]*4*sizeof(float);
+		case KERNEL_DOWNSAMPLE: return useImages ? 0 : local[0]*local[1]*4*4*sizeof(float);
+		case KERNEL_FILTER: return useImages ? 0 : (local[0]+2*windowRadius)*(local[1]+2*windowRadius)*sizeof(float);
+		default: return 0;
+	}
+}
+
+//Identifies the tuned configuration by device, frame size and estimator parameters.
+void CLDepthEstimator2::tuningKey(
+	const uint32_t width,
+	const uint32_t height,
+	char* key,
+	const uint32_t len
+){
+	char name[128] = {};
+	clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+	for(uint32_t i=0;name[i];i++){
+		if(name[i] == ' '){name[i] = '_';}
+	}
+
+	snprintf(key, len, "%s/%ux%u/%u,%u,%u,%u,%u%s", name, width, height,
+		downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius, useImages ? "/images" : "");
+}
+
+//Default workgroup sizes.
+void CLDepthEstimator2::defaultTuning(){
+	for(uint32_t i=0;i<KERNEL_COUNT;i++){
+		localSize[i][0] = LOCAL_SIZE_X;
+		localSize[i][1] = LOCAL_SIZE_Y;
+	}
+	localSize[KERNEL_GREYSCALE][0] = LOCAL_SIZE;
+	localSize[KERNEL_CROSS][0] = LOCAL_SIZE;
+	localSize[KERNEL_GREYSCALE][1] = 1;
+	localSize[KERNEL_CROSS][1] = 1;
+}
+
+//Use cached workgroup sizes for the frame size, tune them if enabled, or else use the defaults.
+//Nothing is reread while the frame size stays the same.
+void CLDepthEstimator2::applyTuning(
+	const uint32_t width,
+	const uint32_t height
+){
+	char key[256];
+	tuningKey(width, height, key, sizeof(key));
+	if(strcmp(key, tunedKey) == 0){return;}
+	snprintf(tunedKey, sizeof(tunedKey), "%s", key);
+
+	defaultTuning();
+	if(loadTuning(key)){return;}
+
+	if(autotuneEnabled){
+		autotune(width, height);
+		saveTuning(key);
+	}
+}
+
+//Reads workgroup sizes from the cache file. Later lines override earlier ones.
+bool CLDepthEstimator2::loadTuning(
+	const char* key
+){
+	const char* path = getenv("DEPTH_AUTOTUNE_CACHE");
+	FILE* file = fopen(path ? path : AUTOTUNE_CACHE, "r");
+	if(!file){return false;}
+
+	bool found = false;
+	char line[512];
+	char lineKey[256];
+	size_t sizes[KERNEL_COUNT*2];
+	while(fgets(line, sizeof(line), file)){
+		//Lines with another kernel count, written by older versions, are skipped.
+		int end = 0;
+		if(sscanf(line, "%255s %zu %zu %zu %zu %zu %zu %zu %zu %zu %zu %zu %zu%n", lineKey,
+			&sizes[0], &sizes[1], &sizes[2], &sizes[3], &sizes[4], &sizes[5],
+			&sizes[6], &sizes[7], &sizes[8], &sizes[9], &sizes[10], &sizes[11], &end) != 1+KERNEL_COUNT*2||
+			line[end + strspn(line + end, " \r\n")] != '\0'){
+			continue;
+		}
+		if(strcmp(lineKey, key) != 0){continue;}
+
+		for(uint32_t i=0;i<KERNEL_COUNT;i++){
+			localSize[i][0] = sizes[i*2];
+			localSize[i][1] = sizes[i*2+1];
+		}
+		found = true;
+	}
+
+	fclose(file);
+	return found;
+}
+
+//Appends the current workgroup sizes to the cache file.
+void CLDepthEstimator2::saveTuning(
+	const char* key
+){
+	const char* path = getenv("DEPTH_AUTOTUNE_CACHE");
+	FILE* file = fopen(path ? path : AUTOTUNE_CACHE, "a");
+	if(!file){
+		printf("Could not write the autotune cache!\n");
+		return;
+	}
+
+	fprintf(file, "%s", key);
+	for(uint32_t i=0;i<KERNEL_COUNT;i++){
+		fprintf(file, " %zu %zu", localSize[i][0], localSize[i][1]);
+	}
+	fprintf(file, "\n");
+
+	fclose(file);
+}
+
+//Sweeps the legal workgroup shapes of every kernel on a random frame of the given size and keeps the fastest.
+void CLDepthEstimator2::autotune(
+	const uint32_t width,
+	const uint32_t height
+){
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
+	//Random input frame.
+	std::vector<unsigned char> frame(width*height*4);
+	srand(0);
+	for(uint32_t i=0;i<frame.size();i++){
+		frame[i] = rand()%256;
+	}
+
+	//Buffers: rgba input, grey, down, mean, disparity and output,
+	//followed by down, mean and cross checked images for the image path.
+	cl_mem buffers[9];
+	uploadImage(queue[0], frame.data(), width*height*4, &buffers[0]);
+	buffers[1] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, width*height, nullptr);
+	buffers[2] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H, nullptr);
+	buffers[3] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H, nullptr);
+	buffers[4] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H, nullptr);
+	buffers[5] = createBuffer(CL_MEM_HOST_NO_ACCESS|CL_MEM_READ_WRITE, W*H, nullptr);
+	if(useImages){
+		for(uint32_t i=6;i<9;i++){
+			buffers[i] = createImage(W, H);
+		}
+	}
+
+	//Fill the intermediate buffers once with the current configuration.
+	for(uint32_t k=0;k<KERNEL_COUNT;k++){
+		timeKernel(k, width, height, buffers);
+	}
+
+	//Device limits.
+	cl_kernel kernels[KERNEL_COUNT] = {k_greyscale, k_downsample, k_filter, k_disparity, k_cross, k_occlusion};
+	if(useImages){
+		kernels[KERNEL_DOWNSAMPLE] = k_downsampleImage;
+		kernels[KERNEL_FILTER] = k_filterImage;
+		kernels[KERNEL_DISPARITY] = k_disparityImage;
+		kernels[KERNEL_CROSS] = k_crossImage;
+		kernels[KERNEL_OCCLUSION] = k_occlusionImage;
+	}
+	const char* names[KERNEL_COUNT] = {"greyscale", "downsample", "filter", "disparity", "crosscheck", "occlusion"};
+	size_t maxItems[3] = {1, 1, 1};
+	cl_ulong localMem = 0;
+	clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, nullptr);
+	clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMem), &localMem, nullptr);
+
+	printf("---OpenCL Depth Estimator 2 autotune %ux%u---\n", width, height);
+	for(uint32_t k=0;k<KERNEL_COUNT;k++){
+		size_t maxGroup = 1;
+		clGetKernelWorkGroupInfo(kernels[k], device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(maxGroup), &maxGroup, nullptr);
+
+		bool is2D = k == KERNEL_DOWNSAMPLE||k == KERNEL_FILTER||k == KERNEL_DISPARITY||k == KERNEL_OCCLUSION;
+		size_t best[2] = {localSize[k][0], localSize[k][1]};
+		double bestTime = -1.0;
+
+		for(size_t x=is2D ? 4 : 16;x<=maxGroup&&x<=maxItems[0];x*=2){
+			for(size_t y=1;y<=(is2D ? 64 : 1)&&x*y<=maxGroup&&y<=maxItems[1];y*=2){
+				size_t shape[2] = {x, y};
+				if(x*y < 16){continue;}
+				if(localBytes(k, shape) > localMem){continue;}
+
+				localSize[k][0] = x;
+				localSize[k][1] = y;
+				double time = timeKernel(k, width, height, buffers);
+				for(uint32_t i=1;i<AUTOTUNE_RUNS;i++){
+					time = std::min(time, timeKernel(k, width, height, buffers));
+				}
+
+				if(bestTime < 0.0||time < bestTime){
+					best[0] = x;
+					best[1] = y;
+					bestTime = time;
+				}
+			}
+		}
+
+		localSize[k][0] = best[0];
+		localSize[k][1] = best[1];
+		printf("%-20s: %zux%zu %f S.\n", names[k], best[0], best[1], bestTime);
+	}
+	printf("\n");
+
+	for(uint32_t i=0;i<(useImages ? 9u : 6u);i++){
+		clReleaseMemObject(buffers[i]);
+	}
+}
+
+//Runs a single kernel with the current workgroup size and returns its execution time.
+double CLDepthEstimator2::timeKernel(
+	const uint32_t kernel,
+	const uint32_t width,
+	const uint32_t height,
+	cl_mem* buffers
+){
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
+	cl_event event;
+	if(kernel == KERNEL_GREYSCALE){
+		makeImgGrey(queue[0], &buffers[0], width, height, &buffers[1], &event);
+	}else if(useImages){
+		switch(kernel){
+			case KERNEL_DOWNSAMPLE: downsampleImage(queue[0], &buffers[1], width, height, downsampleFactor, &buffers[6], &event); break;
+			case KERNEL_FILTER: filterImage(queue[0], &buffers[6], W, H, windowRadius, &buffers[7], &event); break;
+			case KERNEL_DISPARITY: calcDisparityImage(queue[0], &buffers[6], &buffers[6], &buffers[7], &buffers[7], W, H, windowRadius, maxDisparity, -1, &buffers[4], &event); break;
+			case KERNEL_CROSS: crossCheckImage(queue[0], &buffers[4], &buffers[3], W, H, maxCrossDifference, &buffers[8], &event); break;
+			case KERNEL_OCCLUSION: occlusionFillImage(queue[0], &buffers[8], W, H, occlusionRadius, &buffers[5], &event); break;
+		}
+	}else{
+		switch(kernel){
+			case KERNEL_DOWNSAMPLE: downsampleImg(queue[0], &buffers[1], width, height, downsampleFactor, &buffers[2], &event); break;
+			case KERNEL_FILTER: filterImg(queue[0], &buffers[2], W, H, windowRadius, &buffers[3], &event); break;
+			case KERNEL_DISPARITY: calcDisparity(queue[0], &buffers[2], &buffers[2], &buffers[3], &buffers[3], W, H, windowRadius, maxDisparity, -1, &buffers[4], &event); break;
+			case KERNEL_CROSS: crossCheck(queue[0], &buffers[4], &buffers[3], W, H, maxCrossDifference, &event); break;
+			case KERNEL_OCCLUSION: occlusionFill(queue[0], &buffers[4], W, H, occlusionRadius, &buffers[5], &event); break;
+		}
+	}
+	clWaitForEvents(1, &event);
+
+	cl_ulong event_start, event_end;
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(event_start), &event_start, NULL);
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(event_end), &event_end, NULL);
+	clReleaseEvent(event);
+
+	return (double)(event_end - event_start)/1000000000;
+}
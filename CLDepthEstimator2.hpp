@@ -3,9 +3,13 @@
 #define CL_TARGET_OPENCL_VERSION 220
 
 #include <cinttypes>
+#include <sys/time.h>
 #include <CL/cl.h>
 
-struct CLDepthEstimator2{
+#include "DepthEstimator.hpp"
+#include "roofline.hpp"
+
+struct CLDepthEstimator2 : DepthEstimator{
 	CLDepthEstimator2(
 		const uint32_t downsampleFactor,
 		const uint32_t windowRadius,
@@ -13,39 +17,149 @@ struct CLDepthEstimator2{
 		const unsigned char maxCrossDifference,
 		const uint32_t occlusionRadius
 	);
+	CLDepthEstimator2(
+		const uint32_t downsampleFactor,
+		const uint32_t windowRadius,
+		const unsigned char maxDisparity,
+		const unsigned char maxCrossDifference,
+		const uint32_t occlusionRadius,
+		cl_platform_id platform,
+		cl_device_id device
+	);
 	~CLDepthEstimator2();
 
 	void createDepthMap(
 		const char* left_name,
 		const char* right_name,
 		const char* out_name
+	) override;
+
+	void createDepthMap(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		const uint32_t outStride
+	) override;
+
+	using DepthEstimator::createDepthMap;
+
+	void prepareFrame(
+		const uint32_t width,
+		const uint32_t height
+	) override;
+
+	void createDepthBand(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		const uint32_t outBegin,
+		const uint32_t outEnd,
+		unsigned char* out,
+		const uint32_t outStride
+	) override;
+
+	bool timeStages(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		double* times
+	) override;
+
+	bool capturePlanes(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		DepthPlanes* planes
+	) override;
+
+	void printInfo() override;
+
+	void autotune(
+		const uint32_t width,
+		const uint32_t height
 	);
 
-	void printInfo();
+	//Kernels with a tunable workgroup size.
+	enum{
+		KERNEL_GREYSCALE,
+		KERNEL_DOWNSAMPLE,
+		KERNEL_FILTER,
+		KERNEL_DISPARITY,
+		KERNEL_CROSS,
+		KERNEL_OCCLUSION,
+		KERNEL_COUNT
+	};
+
+	//Workgroup size of every kernel. 1D kernels only use the first value.
+	size_t localSize[KERNEL_COUNT][2];
+
+	//Sweep workgroup sizes when no configuration is cached for a frame size.
+	bool autotuneEnabled;
+
+	//Cache key of the workgroup sizes in use.
+	char tunedKey[256];
 
-	uint32_t downsampleFactor;
-	uint32_t windowRadius;
-	unsigned char maxDisparity;
-	unsigned char maxCrossDifference;
-	uint32_t occlusionRadius;
+	//Run the windowed kernels on image2d objects through a sampler instead of on buffers.
+	bool useImages;
 
 	private:
+	friend struct HybridDepthEstimator;
+
 	cl_platform_id platform;
 	cl_device_id device;
 	cl_context context;
 	cl_command_queue queue[2];
 
+	double eventSeconds(
+		cl_event event
+	);
+
+	void runBand(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		const uint32_t outBegin,
+		const uint32_t outEnd,
+		unsigned char* out,
+		const uint32_t outStride,
+		cl_event* events,
+		DepthPlanes* planes
+	);
+
 	void profileEvent(
 		const char* eventName,
-		cl_event event
+		cl_event event,
+		const StageWork& work
 	);
 
-	cl_platform_id findPlatform();
-	
-	cl_device_id findDevice(
-		cl_platform_id platform
+	//Adds the stage events of the last pipeline run to the trace.
+	void traceEvents(
+		cl_event* events
 	);
 
+	//Host time the last pipeline run was started, for lining up device timestamps.
+	struct timeval pipelineStart;
+
+	//Host time loadImages enqueued its first greyscale conversion.
+	struct timeval loadStart;
+
 	cl_context createContext(
 		cl_device_id* device
 	);
@@ -66,22 +180,155 @@ struct CLDepthEstimator2{
 	cl_kernel k_disparity;
 	cl_kernel k_cross;
 	cl_kernel k_occlusion;
-	cl_kernel k_rgba;
+	cl_kernel k_downsampleImage;
+	cl_kernel k_filterImage;
+	cl_kernel k_disparityImage;
+	cl_kernel k_crossImage;
+	cl_kernel k_occlusionImage;
+
+	//Device memory used by one run of the pipeline. The images are only allocated when useImages is set,
+	//the downsample, filter and cross check kernels then write them in place of down, mean and grey[0].
+	struct Buffers{
+		cl_mem grey[2];
+		cl_mem down[2];
+		cl_mem mean[2];
+		cl_mem downTex[2];
+		cl_mem meanTex[2];
+		cl_mem crossTex;
+	};
 
 	void prepareKernels();
 
+	void prepareImageKernels();
+
+	void allocateBuffers(
+		const uint32_t width,
+		const uint32_t height,
+		Buffers* buf
+	);
+
+	void releaseBuffers(
+		Buffers* buf
+	);
+
+	void runPipeline(
+		cl_mem* img,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t channels,
+		Buffers* buf,
+		cl_event* events,
+		DepthPlanes* planes
+	);
+
+	//Reads a whole buffer of width * height bytes back into a plane.
+	void readPlane(
+		cl_command_queue queue,
+		cl_mem* buffer,
+		const uint32_t width,
+		const uint32_t height,
+		unsigned char* plane
+	);
+
+	void prepare();
+
+	void defaultTuning();
+
+	void applyTuning(
+		const uint32_t width,
+		const uint32_t height
+	);
+
+	void tuningKey(
+		const uint32_t width,
+		const uint32_t height,
+		char* key,
+		const uint32_t len
+	);
+
+	bool loadTuning(
+		const char* key
+	);
+
+	void saveTuning(
+		const char* key
+	);
+
+	size_t localBytes(
+		const uint32_t kernel,
+		const size_t* local
+	);
+
+	double timeKernel(
+		const uint32_t kernel,
+		const uint32_t width,
+		const uint32_t height,
+		cl_mem* buffers
+	);
+
 	cl_mem createBuffer(
 		cl_mem_flags flags,
 		uint32_t size,
 		void* copy
 	);
 
-	void loadImage(
+	cl_mem createImage(
+		const uint32_t width,
+		const uint32_t height
+	);
+
+	//Reads a whole image of width * height bytes back into a plane.
+	void readImagePlane(
 		cl_command_queue queue,
-		const char* filename,
+		cl_mem* image,
+		const uint32_t width,
+		const uint32_t height,
+		unsigned char* plane
+	);
+
+	void uploadImage(
+		cl_command_queue queue,
+		const unsigned char* img,
+		const uint32_t len,
+		cl_mem* image
+	);
+
+	void readImage(
+		cl_command_queue queue,
+		cl_mem* image,
+		const uint32_t offset,
+		const uint32_t len,
+		unsigned char* out
+	);
+
+	void uploadFrame(
+		cl_command_queue queue,
+		const unsigned char* img,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		cl_mem* image
+	);
+
+	void readRows(
+		cl_command_queue queue,
+		cl_mem* image,
+		const uint32_t width,
+		const uint32_t rowBegin,
+		const uint32_t rowEnd,
+		unsigned char* out,
+		const uint32_t outStride
+	);
+
+	void loadImages(
+		const char* left_name,
+		const char* right_name,
 		uint32_t* width,
 		uint32_t* height,
-		cl_mem* image
+		uint32_t* channels,
+		cl_mem* images,
+		cl_event* greyEvents
 	);
 
 	void writeImage(
@@ -89,6 +336,7 @@ struct CLDepthEstimator2{
 		const char* filename,
 		uint32_t width,
 		uint32_t height,
+		uint32_t channels,
 		cl_mem* image
 	);
 
@@ -101,16 +349,62 @@ struct CLDepthEstimator2{
 		cl_event* event
 	);
 
-	void makeImgRGBA(
+	void downsampleImg(
 		cl_command_queue queue,
 		cl_mem* img,
 		const uint32_t width,
 		const uint32_t height,
+		const uint32_t factor,
 		cl_mem* out,
 		cl_event* event
 	);
 
-	void downsampleImg(
+	void filterImg(
+		cl_command_queue queue,
+		cl_mem* img,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t radius,
+		cl_mem* out,
+		cl_event* event
+	);
+
+	void calcDisparity(
+		cl_command_queue queue,
+		cl_mem* img_0,
+		cl_mem* img_1,
+		cl_mem* mean_0,
+		cl_mem* mean_1,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t radius,
+		const uint32_t maxDisparity,
+		const int32_t direction,
+		cl_mem* out,
+		cl_event* event
+	);
+
+	void crossCheck(
+		cl_command_queue queue,
+		cl_mem* left,
+		cl_mem* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t maxDifference,
+		cl_event* event
+	);
+
+	void occlusionFill(
+		cl_command_queue queue,
+		cl_mem* img,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t radius,
+		cl_mem* out,
+		cl_event* event
+	);
+
+	void downsampleImage(
 		cl_command_queue queue,
 		cl_mem* img,
 		const uint32_t width,
@@ -120,7 +414,7 @@ struct CLDepthEstimator2{
 		cl_event* event
 	);
 
-	void filterImg(
+	void filterImage(
 		cl_command_queue queue,
 		cl_mem* img,
 		const uint32_t width,
@@ -130,7 +424,7 @@ struct CLDepthEstimator2{
 		cl_event* event
 	);
 
-	void calcDisparity(
+	void calcDisparityImage(
 		cl_command_queue queue,
 		cl_mem* img_0,
 		cl_mem* img_1,
@@ -145,17 +439,18 @@ struct CLDepthEstimator2{
 		cl_event* event
 	);
 
-	void crossCheck(
+	void crossCheckImage(
 		cl_command_queue queue,
 		cl_mem* left,
 		cl_mem* right,
 		const uint32_t width,
 		const uint32_t height,
 		const uint32_t maxDifference,
+		cl_mem* out,
 		cl_event* event
 	);
 
-	void occlusionFill(
+	void occlusionFillImage(
 		cl_command_queue queue,
 		cl_mem* img,
 		const uint32_t width,
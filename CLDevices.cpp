@@ -0,0 +1,327 @@
+#include "CLDevices.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <string>
+#include <algorithm>
+
+#define CALIBRATION_SIDE 512
+
+//Device selection given on the command line.
+static const char* commandLineSelection = nullptr;
+
+//Relative speed estimate used to rank devices.
+static uint64_t deviceScore(
+	const CLDevice& device
+){
+	return (uint64_t)device.computeUnits * device.clockFrequency;
+}
+
+//Device indices ordered from the best ranked to the worst.
+static std::vector<uint32_t> rankDevices(
+	const std::vector<CLDevice>& devices
+){
+	std::vector<uint32_t> order(devices.size());
+	for(uint32_t i=0;i<order.size();i++){
+		order[i] = i;
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+		if(deviceScore(devices[a]) != deviceScore(devices[b])){
+			return deviceScore(devices[a]) > deviceScore(devices[b]);
+		}
+		return devices[a].localMemSize > devices[b].localMemSize;
+	});
+
+	return order;
+}
+
+//Human readable device type.
+static const char* deviceTypeName(
+	cl_device_type type
+){
+	if(type & CL_DEVICE_TYPE_GPU){return "gpu";}
+	if(type & CL_DEVICE_TYPE_CPU){return "cpu";}
+	if(type & CL_DEVICE_TYPE_ACCELERATOR){return "accelerator";}
+	return "other";
+}
+
+//Case insensitive substring search.
+static bool containsText(
+	const char* text,
+	const char* pattern
+){
+	std::string a(text);
+	std::string b(pattern);
+	std::transform(a.begin(), a.end(), a.begin(), ::tolower);
+	std::transform(b.begin(), b.end(), b.begin(), ::tolower);
+	return a.find(b) != std::string::npos;
+}
+
+//Find every device on every available platform. Exits when there is none.
+std::vector<CLDevice> findAllDevices(){
+	std::vector<CLDevice> result = findAvailableDevices();
+	if(result.empty()){
+		//Device count 0.
+		printf("No supported OpenCL platforms or devices found!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return result;
+}
+
+//Same as findAllDevices, but returns an empty list when there is no platform or device.
+std::vector<CLDevice> findAvailableDevices(){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	//Get platforms. The ICD loader reports an error when no platform is installed.
+	uint32_t numPlatforms = 0;
+	err = clGetPlatformIDs(0, nullptr, &numPlatforms);
+	if(err != CL_SUCCESS||numPlatforms <= 0){
+		return {};
+	}
+
+	std::vector<cl_platform_id> platforms(numPlatforms);
+	err = clGetPlatformIDs(numPlatforms, platforms.data(), nullptr);
+	if(err != CL_SUCCESS){
+		printf("Could not get supported platforms!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	std::vector<CLDevice> result;
+	for(uint32_t i=0;i<numPlatforms;i++){
+		//Platforms without devices are skipped.
+		uint32_t numDevices = 0;
+		err = clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, 0, nullptr, &numDevices);
+		if(err != CL_SUCCESS||numDevices <= 0){continue;}
+
+		std::vector<cl_device_id> devices(numDevices);
+		err = clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_ALL, numDevices, devices.data(), nullptr);
+		if(err != CL_SUCCESS){
+			printf("Could not get supported devices!\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for(uint32_t j=0;j<numDevices;j++){
+			CLDevice dev = {};
+			cl_uint size = 0;
+			cl_ulong memSize = 0;
+
+			dev.platform = platforms[i];
+			dev.device = devices[j];
+
+			err = clGetDeviceInfo(dev.device, CL_DEVICE_TYPE, sizeof(dev.type), &dev.type, nullptr);
+			err |= clGetDeviceInfo(dev.device, CL_DEVICE_NAME, sizeof(dev.name) - 1, dev.name, nullptr);
+			err |= clGetDeviceInfo(dev.device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(size), &size, nullptr);
+			dev.computeUnits = size;
+			err |= clGetDeviceInfo(dev.device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(size), &size, nullptr);
+			dev.clockFrequency = size;
+			err |= clGetDeviceInfo(dev.device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(memSize), &memSize, nullptr);
+			dev.localMemSize = memSize;
+			if(err != CL_SUCCESS){
+				printf("Could not get OpenCL device info!\n");
+				exit(EXIT_FAILURE);
+			}
+
+			result.push_back(dev);
+		}
+	}
+
+	return result;
+}
+
+//Print every device with its index, type and ranking values.
+void printDevices(){
+	std::vector<CLDevice> devices = findAllDevices();
+
+	printf("\n---OpenCL Devices---\n");
+	for(uint32_t i=0;i<devices.size();i++){
+		printf("%u: %s (%s), %u compute units, %u MHz, %lu bytes local memory\n",
+			i, devices[i].name, deviceTypeName(devices[i].type),
+			devices[i].computeUnits, devices[i].clockFrequency, (unsigned long)devices[i].localMemSize
+		);
+	}
+	printf("\n");
+}
+
+//Set the device selection used when none is given explicitly.
+void setDeviceSelection(
+	const char* selection
+){
+	commandLineSelection = selection;
+}
+
+//Choose a device according to a selection string.
+CLDevice selectDevice(
+	const char* selection
+){
+	if(selection == nullptr){selection = commandLineSelection;}
+	if(selection == nullptr){selection = getenv("DEPTH_CL_DEVICE");}
+	if(selection == nullptr||selection[0] == '\0'){selection = "rank";}
+
+	std::vector<CLDevice> devices = findAllDevices();
+	std::vector<uint32_t> order = rankDevices(devices);
+
+	if(strcmp(selection, "rank") == 0){
+		return devices[order[0]];
+	}
+
+	//Devices are calibrated once per process, later estimators reuse the winner.
+	if(strcmp(selection, "fastest") == 0){
+		static cl_device_id fastest = nullptr;
+		for(uint32_t i=0;i<devices.size()&&fastest;i++){
+			if(devices[i].device == fastest){return devices[i];}
+		}
+
+		uint32_t best = 0;
+		double bestTime = 0.0;
+		for(uint32_t i=0;i<devices.size();i++){
+			double time = calibrateDevice(devices[i]);
+			if(i == 0||time < bestTime){
+				best = i;
+				bestTime = time;
+			}
+		}
+		fastest = devices[best].device;
+		return devices[best];
+	}
+
+	if(strncmp(selection, "index:", 6) == 0){
+		uint32_t index = atoi(selection + 6);
+		if(index < devices.size()){
+			return devices[index];
+		}
+	}
+
+	if(strncmp(selection, "name:", 5) == 0){
+		for(uint32_t i=0;i<order.size();i++){
+			if(containsText(devices[order[i]].name, selection + 5)){
+				return devices[order[i]];
+			}
+		}
+	}
+
+	if(strncmp(selection, "type:", 5) == 0){
+		for(uint32_t i=0;i<order.size();i++){
+			if(strcmp(deviceTypeName(devices[order[i]].type), selection + 5) == 0){
+				return devices[order[i]];
+			}
+		}
+	}
+
+	printf("No OpenCL device matches the selection: %s!\n", selection);
+	exit(EXIT_FAILURE);
+}
+
+//Time a small windowed kernel on the device. Returns the kernel execution time in seconds.
+double calibrateDevice(
+	const CLDevice& device
+){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	cl_context context = clCreateContext(0, 1, &device.device, nullptr, nullptr, &err);
+	if(err != CL_SUCCESS){
+		printf("Could not create a calibration context!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	const cl_queue_properties properties[] = {
+		CL_QUEUE_PROPERTIES,
+		CL_QUEUE_PROFILING_ENABLE,
+		0
+	};
+	cl_command_queue queue = clCreateCommandQueueWithProperties(context, device.device, properties, &err);
+	if(err != CL_SUCCESS){
+		printf("Could not create a calibration queue!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//A 9x9 window correlation, similar in shape to the disparity kernel.
+	const char* source = R"(
+		__kernel void calibrate(
+			__global const uchar* img,
+			const uint side,
+			__global float* out
+		){
+			int m = get_global_id(0);
+			int n = get_global_id(1);
+
+			if((m<side)&&(n<side)){
+				float val = 0.0f;
+				for(int i=-4;i<=4;i++){
+					for(int j=-4;j<=4;j++){
+						int x = clamp(m+j, 0, (int)side-1);
+						int y = clamp(n+i, 0, (int)side-1);
+						float a = img[x+y*side];
+						float b = img[m+n*side];
+						val += a * b / (sqrt(a) + 1.0f);
+					}
+				}
+				out[m+n*side] = val;
+			}
+		}
+	)";
+
+	cl_program program = clCreateProgramWithSource(context, 1, &source, NULL, &err);
+	if(err != CL_SUCCESS){
+		printf("Could not build the calibration kernel!\n");
+		exit(EXIT_FAILURE);
+	}
+	err = clBuildProgram(program, 1, &device.device, NULL, NULL, NULL);
+	cl_kernel kernel = err == CL_SUCCESS ? clCreateKernel(program, "calibrate", &err) : nullptr;
+	if(err != CL_SUCCESS){
+		printf("Could not build the calibration kernel!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	uint32_t side = CALIBRATION_SIDE;
+	std::vector<unsigned char> img(side*side);
+	for(uint32_t i=0;i<img.size();i++){
+		img[i] = (i * 2654435761u) >> 24;
+	}
+
+	cl_int imgErr, outErr;
+	cl_mem d_img = clCreateBuffer(context, CL_MEM_READ_ONLY|CL_MEM_COPY_HOST_PTR, img.size(), img.data(), &imgErr);
+	cl_mem d_out = clCreateBuffer(context, CL_MEM_WRITE_ONLY, side*side*sizeof(float), nullptr, &outErr);
+	if(imgErr != CL_SUCCESS||outErr != CL_SUCCESS||!d_img||!d_out){
+		printf("Could not allocate the calibration buffers!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	err = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_img);
+	err |= clSetKernelArg(kernel, 1, sizeof(uint32_t), &side);
+	err |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_out);
+	if(err != CL_SUCCESS){
+		printf("Could not prepare the calibration kernel!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//Warmup run, then a measured run.
+	const size_t global[2] = {side, side};
+	cl_event event;
+	err = clEnqueueNDRangeKernel(queue, kernel, 2, 0, global, NULL, 0, NULL, nullptr);
+	err |= clEnqueueNDRangeKernel(queue, kernel, 2, 0, global, NULL, 0, NULL, &event);
+	if(err != CL_SUCCESS){
+		printf("Could not submit calibration work!\n");
+		exit(EXIT_FAILURE);
+	}
+	clFinish(queue);
+
+	cl_ulong event_start, event_end;
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(event_start), &event_start, NULL);
+	clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(event_end), &event_end, NULL);
+
+	clReleaseEvent(event);
+	clReleaseMemObject(d_out);
+	clReleaseMemObject(d_img);
+	clReleaseKernel(kernel);
+	clReleaseProgram(program);
+	clReleaseCommandQueue(queue);
+	clReleaseContext(context);
+
+	return (double)(event_end - event_start)/1000000000;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#define CL_TARGET_OPENCL_VERSION 220
+
+#include <cinttypes>
+#include <vector>
+#include <CL/cl.h>
+
+/*--------------------------------------------------
+Device selection strings:
+	rank          : Best device by compute units * clock, then local memory size (default).
+	fastest       : Fastest device on a calibration kernel, calibrated once per process.
+	name:<text>   : Best ranked device whose name contains the text (case insensitive).
+	type:<type>   : Best ranked device of type cpu, gpu or accelerator.
+	index:<n>     : The n:th device in the order listed by printDevices().
+
+The selection is taken from the selectDevice() argument, then from
+setDeviceSelection() (command line), then from the DEPTH_CL_DEVICE
+environment variable.
+--------------------------------------------------*/
+
+//An OpenCL device along with the properties used to compare devices.
+struct CLDevice{
+	cl_platform_id platform;
+	cl_device_id device;
+	cl_device_type type;
+	char name[128];
+	uint32_t computeUnits;
+	uint32_t clockFrequency;
+	uint64_t localMemSize;
+};
+
+std::vector<CLDevice> findAllDevices();
+
+std::vector<CLDevice> findAvailableDevices();
+
+void printDevices();
+
+void setDeviceSelection(
+	const char* selection
+);
+
+CLDevice selectDevice(
+	const char* selection
+);
+
+double calibrateDevice(
+	const CLDevice& device
+);
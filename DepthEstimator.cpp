@@ -0,0 +1,427 @@
+#include "DepthEstimator.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <sys/time.h>
+
+#include "CLDevices.hpp"
+#include "simpleDepthEstimator.hpp"
+#include "OMPDepthEstimator.hpp"
+#include "CLDepthEstimator.hpp"
+#include "CLDepthEstimator2.hpp"
+#include "MultiCLDepthEstimator.hpp"
+#include "HybridDepthEstimator.hpp"
+
+const char* const depthStageNames[DEPTH_STAGES] = {
+	"greyscale", "downsample", "filter", "left disparity", "right disparity", "cross check", "occlusion fill"
+};
+
+const char* const pipelineStageNames[10] = {
+	"left greyscale", "left downsample", "left filter", "right greyscale", "right downsample", "right filter",
+	"left disparity", "right disparity", "cross check", "occlusion fill"
+};
+
+//Saves the parameters shared by every backend.
+DepthEstimator::DepthEstimator(
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius
+){
+	this->downsampleFactor = downsampleFactor;
+	this->windowRadius = windowRadius;
+	this->maxDisparity = maxDisparity;
+	this->maxCrossDifference = maxCrossDifference;
+	this->occlusionRadius = occlusionRadius;
+}
+
+//Create a depth map from left and right 8bit rgba images in memory.
+void DepthEstimator::createDepthMap(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	unsigned char* out
+){
+	createDepthMap(left, right, width, height, width*4, 4, out, width / downsampleFactor);
+}
+
+//Create a depth map strip by strip from bands of the source images with halo rows.
+void DepthEstimator::createDepthMapTiled(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	const uint32_t outStride,
+	const uint32_t stripRows
+){
+	checkLayout(width, stride, channels, outStride);
+	prepareFrame(width, height);
+
+	uint32_t H = height / downsampleFactor;
+	uint32_t halo = windowRadius + occlusionRadius;
+	uint32_t rows = stripRows == 0 ? H : stripRows;
+
+	for(uint32_t begin=0;begin<H;begin+=rows){
+		uint32_t end = std::min(H, begin + rows);
+
+		//Band rows including the halo.
+		uint32_t first = begin < halo ? 0 : begin - halo;
+		uint32_t last = std::min(H, end + halo);
+		size_t offset = (size_t)first * downsampleFactor * stride;
+
+		createDepthBand(
+			left + offset, right + offset, width, (last - first) * downsampleFactor, stride, channels,
+			begin - first, end - first, out + (size_t)begin * outStride, outStride
+		);
+	}
+}
+
+//Source crop of a region in depth map pixels, clamped to the image.
+static DepthRegion regionCrop(
+	const DepthRegion& region,
+	const uint32_t W,
+	const uint32_t H,
+	const uint32_t rowHalo,
+	const uint32_t columnHalo
+){
+	DepthRegion crop;
+	crop.x = region.x < columnHalo ? 0 : region.x - columnHalo;
+	crop.y = region.y < rowHalo ? 0 : region.y - rowHalo;
+	crop.width = std::min(W, region.x + region.width + columnHalo) - crop.x;
+	crop.height = std::min(H, region.y + region.height + rowHalo) - crop.y;
+	return crop;
+}
+
+//Whether two rectangles share a pixel.
+static bool regionsOverlap(
+	const DepthRegion& a,
+	const DepthRegion& b
+){
+	return a.x < b.x + b.width&&b.x < a.x + a.width&&a.y < b.y + b.height&&b.y < a.y + a.height;
+}
+
+//Create a depth map inside the given regions from crops of the source images.
+void DepthEstimator::createDepthMapRegions(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	const std::vector<DepthRegion>& regions,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	checkLayout(width, stride, channels, outStride);
+	prepareFrame(width, height);
+
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+	//The occlusion fill reads occlusionRadius pixels of the cross check, which compares both disparity maps at
+	//the same pixel. Their windows reach windowRadius pixels around it, and windowRadius + maxDisparity - 1
+	//columns to one side in the other view.
+	uint32_t rowHalo = windowRadius + occlusionRadius;
+	uint32_t columnHalo = (maxDisparity > 0 ? maxDisparity - 1 : 0) + windowRadius + occlusionRadius;
+
+	//A crop and the regions it serves.
+	struct Crop{
+		DepthRegion area;
+		std::vector<DepthRegion> regions;
+	};
+
+	//Give every region a crop, merging crops that overlap until none do.
+	std::vector<Crop> crops;
+	for(const DepthRegion& region : regions){
+		DepthRegion clipped = region;
+		clipped.width = region.x < W ? std::min(region.width, W - region.x) : 0;
+		clipped.height = region.y < H ? std::min(region.height, H - region.y) : 0;
+		if(clipped.width == 0||clipped.height == 0){continue;}
+
+		Crop crop = {regionCrop(clipped, W, H, rowHalo, columnHalo), {clipped}};
+		for(uint32_t i=0;i<crops.size();){
+			if(regionsOverlap(crop.area, crops[i].area)){
+				const DepthRegion& a = crop.area;
+				const DepthRegion& b = crops[i].area;
+				uint32_t x1 = std::max(a.x + a.width, b.x + b.width);
+				uint32_t y1 = std::max(a.y + a.height, b.y + b.height);
+				crop.area.x = std::min(a.x, b.x);
+				crop.area.y = std::min(a.y, b.y);
+				crop.area.width = x1 - crop.area.x;
+				crop.area.height = y1 - crop.area.y;
+				crop.regions.insert(crop.regions.end(), crops[i].regions.begin(), crops[i].regions.end());
+				crops.erase(crops.begin() + i);
+				i = 0;
+			}else{
+				i++;
+			}
+		}
+		crops.push_back(crop);
+	}
+
+	for(const Crop& crop : crops){
+		const DepthRegion& area = crop.area;
+
+		//Only the rows covered by the regions are read back from the band.
+		uint32_t rowBegin = H, rowEnd = 0;
+		for(const DepthRegion& region : crop.regions){
+			rowBegin = std::min(rowBegin, region.y);
+			rowEnd = std::max(rowEnd, region.y + region.height);
+		}
+
+		unsigned char* rows = (unsigned char*)malloc(area.width*(rowEnd - rowBegin)*sizeof(unsigned char));
+		size_t offset = (size_t)area.y * downsampleFactor * stride + (size_t)area.x * downsampleFactor * channels;
+
+		createDepthBand(
+			left + offset, right + offset, area.width * downsampleFactor, area.height * downsampleFactor, stride, channels,
+			rowBegin - area.y, rowEnd - area.y, rows, area.width
+		);
+
+		for(const DepthRegion& region : crop.regions){
+			for(uint32_t j=region.y;j<region.y+region.height;j++){
+				memcpy(out + (size_t)j * outStride + region.x, rows + (j - rowBegin) * area.width + (region.x - area.x), region.width);
+			}
+		}
+
+		free(rows);
+	}
+}
+
+//Computes the whole band with createDepthMap and keeps the requested rows.
+void DepthEstimator::createDepthBand(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	const uint32_t outBegin,
+	const uint32_t outEnd,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+	unsigned char* band = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	createDepthMap(left, right, width, height, stride, channels, band, W);
+	for(uint32_t j=outBegin;j<outEnd;j++){
+		memcpy(out + (size_t)(j - outBegin) * outStride, band + (size_t)j*W, W);
+	}
+
+	free(band);
+}
+
+//Folds the ten pipeline times of the backends (left greyscale, downsample and filter, the same for the right
+//view, both disparities, cross check, occlusion fill) into the DEPTH_STAGES stage times.
+void foldStageTimes(
+	const double* pipelineTimes,
+	double* times
+){
+	for(uint32_t i=0;i<3;i++){
+		times[i] = pipelineTimes[i] + pipelineTimes[i+3];
+	}
+	for(uint32_t i=3;i<DEPTH_STAGES;i++){
+		times[i] = pipelineTimes[i+3];
+	}
+}
+
+//Folds the counters of the ten pipeline stages into the DEPTH_STAGES stages like foldStageTimes.
+void foldStageCounters(
+	const uint64_t (*pipelineCounters)[PERF_COUNTERS],
+	uint64_t* counters
+){
+	for(uint32_t j=0;j<PERF_COUNTERS;j++){
+		for(uint32_t i=0;i<3;i++){
+			uint64_t a = pipelineCounters[i][j], b = pipelineCounters[i+3][j];
+			counters[i*PERF_COUNTERS + j] = a == PERF_MISSING||b == PERF_MISSING ? PERF_MISSING : a + b;
+		}
+		for(uint32_t i=3;i<DEPTH_STAGES;i++){
+			counters[i*PERF_COUNTERS + j] = pipelineCounters[i+3][j];
+		}
+	}
+}
+
+//Exits unless the in-memory image layout is supported.
+void DepthEstimator::checkLayout(
+	const uint32_t width,
+	const uint32_t stride,
+	const uint32_t channels,
+	const uint32_t outStride
+){
+	if(channels != 1&&channels != 4){
+		printf("Only grey and rgba images are supported!\n");
+		exit(EXIT_FAILURE);
+	}
+	if(stride < width*channels||outStride < width / downsampleFactor){
+		printf("Image stride is smaller than a row!\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+//A backend name and the function that builds it.
+struct RegistryEntry{
+	const char* name;
+	DepthEstimatorFactory factory;
+};
+
+//Builds a backend with the shared constructor arguments.
+template<typename T>
+static DepthEstimator* createBackend(
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius
+){
+	return new T(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius);
+}
+
+//Same as createBackend, for OpenCL backends. Returns nullptr when no OpenCL device is available.
+template<typename T>
+static DepthEstimator* createCLBackend(
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius
+){
+	if(findAvailableDevices().empty()){return nullptr;}
+	return new T(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius);
+}
+
+//Same as createCLBackend, for backends whose downsample kernel only supports a factor of 4.
+template<typename T>
+static DepthEstimator* createCLFactor4Backend(
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius
+){
+	if(downsampleFactor != 4){return nullptr;}
+	return createCLBackend<T>(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius);
+}
+
+//Every registered backend, starting with the built in ones.
+static std::vector<RegistryEntry>& registry(){
+	static std::vector<RegistryEntry> entries = {
+		{"simple", createBackend<SimpleDepthEstimator>},
+		{"openmp", createBackend<OMPDepthEstimator>},
+		{"opencl", createCLBackend<CLDepthEstimator>},
+		{"opencl2", createCLFactor4Backend<CLDepthEstimator2>},
+		{"multicl", createCLFactor4Backend<MultiCLDepthEstimator>},
+		{"hybrid", createCLBackend<HybridDepthEstimator>}
+	};
+	return entries;
+}
+
+//Adds a backend to the registry, replacing any backend with the same name.
+void registerDepthEstimator(
+	const char* name,
+	DepthEstimatorFactory factory
+){
+	std::vector<RegistryEntry>& entries = registry();
+	for(uint32_t i=0;i<entries.size();i++){
+		if(strcmp(entries[i].name, name) == 0){
+			entries[i].factory = factory;
+			return;
+		}
+	}
+	entries.push_back({name, factory});
+}
+
+//Names of every registered backend in registration order.
+std::vector<const char*> depthEstimatorNames(){
+	std::vector<const char*> names;
+	for(const RegistryEntry& entry : registry()){
+		names.push_back(entry.name);
+	}
+	return names;
+}
+
+//Builds a backend by name. Returns nullptr for unknown names and unsupported parameters.
+DepthEstimator* createDepthEstimator(
+	const char* name,
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius
+){
+	for(const RegistryEntry& entry : registry()){
+		if(strcmp(entry.name, name) == 0){
+			return entry.factory(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius);
+		}
+	}
+	return nullptr;
+}
+
+//Builds every backend, times each on a random frame of the given size and keeps the fastest.
+DepthEstimator* createFastestDepthEstimator(
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius,
+	const char** name
+){
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
+	//Create a random texture and a shifted copy of it.
+	unsigned char* img[2];
+	img[0] = (unsigned char*)malloc(width*height*4*sizeof(unsigned char));
+	img[1] = (unsigned char*)malloc(width*height*4*sizeof(unsigned char));
+	unsigned char* out = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	srand(0);
+	for(uint32_t i=0;i<width*height*4;i++){
+		img[0][i] = rand()%256;
+	}
+	for(uint32_t i=0;i<width*height*4;i++){
+		img[1][i] = img[0][(i + maxDisparity/2*downsampleFactor*4) % (width*height*4)];
+	}
+
+	DepthEstimator* best = nullptr;
+	double bestTime = 0.0;
+	for(const RegistryEntry& entry : registry()){
+		DepthEstimator* estimator = entry.factory(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius);
+		if(!estimator){continue;}
+
+		//Warmup run so that lazy initialization is not measured.
+		estimator->createDepthMap(img[0], img[1], width, height, out);
+
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+
+		estimator->createDepthMap(img[0], img[1], width, height, out);
+
+		gettimeofday(&end, NULL);
+		double elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
+			(double)(end.tv_sec - start.tv_sec);
+
+		if(!best||elapsed < bestTime){
+			delete best;
+			best = estimator;
+			bestTime = elapsed;
+			if(name){*name = entry.name;}
+		}else{
+			delete estimator;
+		}
+	}
+
+	free(img[0]);
+	free(img[1]);
+	free(out);
+
+	return best;
+}
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <cinttypes>
+#include <vector>
+
+#include "perfCounters.hpp"
+
+/*--------------------------------------------------
+Common interface of the depth estimator backends.
+
+Backends are created by name from a registry:
+	simple   : SimpleDepthEstimator, single threaded.
+	openmp   : OMPDepthEstimator, OpenMP multithreading.
+	opencl   : CLDepthEstimator.
+	opencl2  : CLDepthEstimator2, downsample factor 4 only.
+	multicl  : MultiCLDepthEstimator, every OpenCL device, factor 4 only.
+	hybrid   : HybridDepthEstimator, OpenMP and OpenCL together.
+The OpenCL backends are not created when no OpenCL device is
+available. createFastestDepthEstimator times every backend that can
+be created and keeps the fastest, the executable runs it as
+--backend=fastest.
+
+Backends that time their stages separately report them through
+timeStages as these DEPTH_STAGES stages, left and right views summed:
+	greyscale, downsample, filter, left disparity, right disparity,
+	cross check, occlusion fill.
+
+Backends that expose their intermediate planes return them through
+capturePlanes, one plane per stage in the same order. CPU backends
+count hardware events of their stages through countStages.
+--------------------------------------------------*/
+
+#define DEPTH_STAGES 7
+
+extern const char* const depthStageNames[DEPTH_STAGES];
+
+//Names of the ten stage times of a pipeline run, with the left and right views apart.
+extern const char* const pipelineStageNames[10];
+
+//A rectangle of depth map pixels.
+struct DepthRegion{
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+};
+
+//Caller allocated planes of one pipeline run, the output of every stage.
+//grey planes are width * height bytes, the others (width / downsampleFactor) * (height / downsampleFactor).
+struct DepthPlanes{
+	unsigned char* grey[2];
+	unsigned char* down[2];
+	unsigned char* mean[2];
+	unsigned char* disparity[2];
+	unsigned char* cross;
+	unsigned char* out;
+};
+
+struct DepthEstimator{
+	DepthEstimator(
+		const uint32_t downsampleFactor,
+		const uint32_t windowRadius,
+		const unsigned char maxDisparity,
+		const unsigned char maxCrossDifference,
+		const uint32_t occlusionRadius
+	);
+	virtual ~DepthEstimator(){};
+
+	//Create a depth map from left and right source image files and print the execution times.
+	virtual void createDepthMap(
+		const char* left_name,
+		const char* right_name,
+		const char* out_name
+	) = 0;
+
+	//Create a depth map from left and right 8bit rgba images in memory.
+	//Writes (width / downsampleFactor) * (height / downsampleFactor) bytes into out.
+	void createDepthMap(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		unsigned char* out
+	);
+
+	//Create a depth map from caller owned 8bit grey (channels 1) or rgba (channels 4) images.
+	//Rows of the source images are stride bytes apart and rows of the depth map outStride bytes apart.
+	virtual void createDepthMap(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		const uint32_t outStride
+	) = 0;
+
+	//Create a depth map strip by strip. Strips of stripRows depth map rows are computed one at a time
+	//from bands of the source images with windowRadius + occlusionRadius halo rows on each side, so the
+	//backend only holds one band at a time. The result equals createDepthMap.
+	void createDepthMapTiled(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		const uint32_t outStride,
+		const uint32_t stripRows
+	);
+
+	//Create the depth map only inside the given regions of depth map pixels; the rest of out is left as it is.
+	//Every region is computed from a crop of the source images reaching windowRadius + occlusionRadius rows and
+	//maxDisparity - 1 + windowRadius + occlusionRadius columns beyond it, and regions whose crops overlap share one.
+	//The result inside the regions equals createDepthMap.
+	void createDepthMapRegions(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		const std::vector<DepthRegion>& regions,
+		unsigned char* out,
+		const uint32_t outStride
+	);
+
+	//Prepare for a frame of width * height source pixels that is computed band by band with createDepthBand,
+	//eg. pick the tuned workgroup sizes of the frame size. Bands of any size then run with the frame settings.
+	virtual void prepareFrame(
+		const uint32_t width,
+		const uint32_t height
+	){};
+
+	//Create the depth map rows [outBegin, outEnd) of a horizontal band of the source images into out.
+	//The band must carry enough halo rows around the output rows for the window and occlusion radii.
+	virtual void createDepthBand(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		const uint32_t outBegin,
+		const uint32_t outEnd,
+		unsigned char* out,
+		const uint32_t outStride
+	);
+
+	//Run the pipeline once on images in memory, writing the (width / downsampleFactor) * (height / downsampleFactor)
+	//depth map into out, and store the time of each of the DEPTH_STAGES stages in seconds into times.
+	//Returns false if the backend does not time its stages.
+	virtual bool timeStages(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		double* times
+	){return false;};
+
+	//Run the pipeline once on images in memory and store the hardware counters of each of the DEPTH_STAGES
+	//stages into counters, PERF_COUNTERS values per stage. The views run one after the other so the stages
+	//of the left and right view are not counted together. Returns false if the backend does not count its stages.
+	virtual bool countStages(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		PerfCounters* perf,
+		uint64_t* counters
+	){return false;};
+
+	//Run the pipeline once on images in memory and copy the output of every stage into planes.
+	//Returns false if the backend does not expose its intermediate planes.
+	virtual bool capturePlanes(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		DepthPlanes* planes
+	){return false;};
+
+	virtual void printInfo(){};
+
+	void checkLayout(
+		const uint32_t width,
+		const uint32_t stride,
+		const uint32_t channels,
+		const uint32_t outStride
+	);
+
+	uint32_t downsampleFactor;
+	uint32_t windowRadius;
+	unsigned char maxDisparity;
+	unsigned char maxCrossDifference;
+	uint32_t occlusionRadius;
+};
+
+void foldStageTimes(
+	const double* pipelineTimes,
+	double* times
+);
+
+void foldStageCounters(
+	const uint64_t (*pipelineCounters)[PERF_COUNTERS],
+	uint64_t* counters
+);
+
+//Builds a backend, or returns nullptr if the backend does not support the parameters or has no device to run on.
+typedef DepthEstimator* (*DepthEstimatorFactory)(
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius
+);
+
+void registerDepthEstimator(
+	const char* name,
+	DepthEstimatorFactory factory
+);
+
+std::vector<const char*> depthEstimatorNames();
+
+DepthEstimator* createDepthEstimator(
+	const char* name,
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius
+);
+
+DepthEstimator* createFastestDepthEstimator(
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius,
+	const char** name
+);
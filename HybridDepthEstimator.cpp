@@ -0,0 +1,396 @@
+#include "HybridDepthEstimator.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <sys/time.h>
+
+#include "util.hpp"
+#include "roofline.hpp"
+
+#define MIN_DEVICE_FRACTION 0.05f
+#define MAX_DEVICE_FRACTION 0.95f
+
+/*-------------------------------------------
+This is the heterogeneous implementation of
+the depth estimator. Images are prepared on
+the host with OpenMP, after which the
+OpenCL device computes the top rows of both
+disparity maps while the host computes the
+rest. The maps are merged before the cross
+check.
+
+The device kernel evaluates the ZNCC in
+double precision exactly like the host code
+does, so the result is byte-identical to an
+OMPDepthEstimator run. Devices without fp64
+support leave all the rows to the host.
+-------------------------------------------*/
+
+//Stereo image depth estimator sharing the disparity stage between OpenMP and OpenCL.
+HybridDepthEstimator::HybridDepthEstimator(
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius
+):
+	DepthEstimator(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius),
+	host(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius),
+	device(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius)
+{
+	deviceFraction = 0.5f;
+	k_disparity = nullptr;
+
+	//Double precision is needed to match the host results.
+	cl_device_fp_config fp64 = 0;
+	clGetDeviceInfo(device.device, CL_DEVICE_DOUBLE_FP_CONFIG, sizeof(fp64), &fp64, nullptr);
+	if(fp64 == 0){
+		printf("OpenCL device has no fp64 support, disparity runs on the host only!\n");
+		deviceFraction = 0.0f;
+		return;
+	}
+
+	//Same as the CLDepthEstimator2 disparity kernel, but with host rounding.
+	const char* source = R"(
+		#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+		#pragma OPENCL FP_CONTRACT OFF
+
+		__kernel void disparity(
+			__global const uchar* img_0,
+			__global const uchar* img_1,
+			__global const uchar* mean_0,
+			__global const uchar* mean_1,
+			const uint width,
+			const uint height,
+			const uint radius,
+			const uint maxDisparity,
+			const int direction,
+			__global uchar* out
+		){
+			int m = get_global_id(0);
+			int n = get_global_id(1);
+
+			if((m<width)&&(n<height)){
+				float top_zncc = -1.0f;
+				float temp_zncc = -1.0f;
+				unsigned char disparity = 0;
+
+				float std_0 = 0.0f;
+				float std_1 = 0.0f;
+				float numer = 0.0f;
+				float denom_0 = 0.0f;
+				float denom_1 = 0.0f;
+
+				for(int d=0;d<maxDisparity;d++){
+					if((m+direction*d)<0||width<=(m+direction*d)){break;}
+					numer = 0.0f;
+					denom_0 = 0.0f;
+					denom_1 = 0.0f;
+
+					for(int i=n-(int)radius;i<=n+(int)radius;i++){
+						for(int j=m-(int)radius;j<=m+(int)radius;j++){
+							if(0<=i&&i<height&&0<=(j+direction*d)&&(j+direction*d)<width&&0<=j&&j<width){
+								std_0 = img_0[j+i*width] - mean_0[m+n*width];
+								std_1 = img_1[j+i*width+direction*d] - mean_1[m+n*width+direction*d];
+								numer += std_0 * std_1;
+								denom_0 += std_0 * std_0;
+								denom_1 += std_1 * std_1;
+							}
+						}
+					}
+
+					temp_zncc = (float)(numer / (sqrt((double)denom_0) * sqrt((double)denom_1)));
+					if(temp_zncc > top_zncc){
+						top_zncc = temp_zncc;
+						disparity = d;
+					}
+				}
+
+				out[m+n*width] = disparity;
+			}
+		}
+	)";
+	k_disparity = device.createKernel("disparity", source);
+}
+
+//Cleanup.
+HybridDepthEstimator::~HybridDepthEstimator(){
+	if(k_disparity){
+		clReleaseKernel(k_disparity);
+	}
+}
+
+//Create a depth map from left and right source images.
+void HybridDepthEstimator::createDepthMap(
+	const char* left_name,
+	const char* right_name,
+	const char* out_name
+){
+	//Load images as grey. Both are decoded at once, color pngs are converted to grey while they are decoded.
+	unsigned char* img[2];
+	uint32_t w, h, c = 1;
+
+	imgLoadPair(left_name, right_name, &w, &h, &c, img);
+
+	uint32_t W = w / downsampleFactor;
+	uint32_t H = h / downsampleFactor;
+
+	unsigned char* out = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	double times[10];
+	uint32_t S = 0;
+	float usedFraction = deviceFraction;
+
+	//Start measuring execution time.
+	struct timeval time_start, time_end;
+	gettimeofday(&time_start, NULL);
+
+	runPipeline(img[0], img[1], w, h, w*c, c, out, times, &S);
+
+	//Finish measuring execution time.
+	gettimeofday(&time_end, NULL);
+
+	//Write the final image into a file as grey.
+	imgWrite(out_name, W, H, 1, out);
+
+	free(img[0]);
+	free(img[1]);
+	free(out);
+
+	//Print total execution time.
+	double elapsed = (double)(time_end.tv_usec - time_start.tv_usec) / 1000000 +
+		(double)(time_end.tv_sec - time_start.tv_sec);
+	printf("---Hybrid Depth Estimator---\nTotal execution time: %f S.\n", elapsed);
+
+	//Stage rates against the peaks of the machine. The disparity work of both views is split by rows.
+	StageWork work[10];
+	pipelineWork(w, h, c, downsampleFactor, windowRadius, maxDisparity, work);
+	StageWork disparity = {work[6].bytes + work[7].bytes, work[6].flops + work[7].flops};
+	StageWork deviceWork = {disparity.bytes * S / H, disparity.flops * S / H};
+	StageWork hostWork = {disparity.bytes - deviceWork.bytes, disparity.flops - deviceWork.flops};
+	const MachinePeaks* peaks = machinePeaks(0);
+	printMachinePeaks(peaks);
+
+	printStageTime("Left greyscale      ", times[0], work[0], peaks);
+	printStageTime("Left downsample     ", times[1], work[1], peaks);
+	printStageTime("Left filter         ", times[2], work[2], peaks);
+	printStageTime("Right greyscale     ", times[3], work[3], peaks);
+	printStageTime("Right downsample    ", times[4], work[4], peaks);
+	printStageTime("Right filter        ", times[5], work[5], peaks);
+	printf("Device disparity    : rows 0-%u, fraction %.3f\n", S, usedFraction);
+	printStageTime("Device disparity    ", times[6], deviceWork, nullptr);
+	printf("Host disparity      : rows %u-%u\n", S, H);
+	printStageTime("Host disparity      ", times[7], hostWork, peaks);
+	printStageTime("Cross check         ", times[8], work[8], peaks);
+	printStageTime("Occlusion fill      ", times[9], work[9], peaks);
+	printf("\n");
+}
+
+//Create a depth map from caller owned grey or rgba images in memory.
+void HybridDepthEstimator::createDepthMap(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	checkLayout(width, stride, channels, outStride);
+
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+	double times[10];
+	uint32_t S;
+
+	if(outStride == W){
+		runPipeline(left, right, width, height, stride, channels, out, times, &S);
+		return;
+	}
+
+	//Padded output rows.
+	unsigned char* temp = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+	runPipeline(left, right, width, height, stride, channels, temp, times, &S);
+	for(uint32_t i=0;i<H;i++){
+		memcpy(out + (size_t)i*outStride, temp + (size_t)i*W, W);
+	}
+	free(temp);
+}
+
+//Runs every stage from the greyscale conversion to the occlusion fill and adapts the device split.
+//Stage times are written into times[0..9], where times[6] is the device and times[7] the host disparity time.
+void HybridDepthEstimator::runPipeline(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	double* times,
+	uint32_t* deviceRows
+){
+	const unsigned char* img[2] = {left, right};
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
+	//Allocate memory for images.
+	unsigned char* grey[2];
+	unsigned char* down[2];
+	unsigned char* mean[2];
+
+	grey[0] = (unsigned char*)malloc(width*height*sizeof(unsigned char));
+	grey[1] = (unsigned char*)malloc(width*height*sizeof(unsigned char));
+	down[0] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+	down[1] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+	mean[0] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+	mean[1] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	//Device rows [0, S) and the input rows they depend on.
+	uint32_t S = (uint32_t)round(H * deviceFraction);
+	uint32_t R = std::min(H, S + windowRadius);
+
+	cl_command_queue queue = device.queue[0];
+	cl_mem d_down[2];
+	cl_mem d_mean[2];
+	cl_mem d_out[2];
+	cl_event events[8];
+
+	if(S > 0){
+		for(uint32_t i=0;i<2;i++){
+			d_down[i] = device.createBuffer(CL_MEM_READ_ONLY|CL_MEM_HOST_WRITE_ONLY, W*H*sizeof(unsigned char), nullptr);
+			d_mean[i] = device.createBuffer(CL_MEM_READ_ONLY|CL_MEM_HOST_WRITE_ONLY, W*H*sizeof(unsigned char), nullptr);
+			d_out[i] = device.createBuffer(CL_MEM_WRITE_ONLY|CL_MEM_HOST_READ_ONLY, W*S*sizeof(unsigned char), nullptr);
+		}
+	}
+
+	//Prepare left and right images on the host.
+	#pragma omp parallel for
+	for(uint32_t i=0;i<2;i++){
+		host.makeImgGrey(img[i], width, height, stride, channels, grey[i], &times[0+i*3]);
+		host.downsampleImg(grey[i], width, height, downsampleFactor, down[i], &times[1+i*3]);
+		host.filterImg(down[i], W, H, windowRadius, mean[i], &times[2+i*3]);
+	}
+
+	//Send the top rows to the device and compute their disparity asynchronously.
+	if(S > 0){
+		cl_int err = CL_SUCCESS;
+		for(uint32_t i=0;i<2;i++){
+			err |= clEnqueueWriteBuffer(queue, d_down[i], CL_FALSE, 0, W*R, down[i], 0, nullptr, &events[0+i*2]);
+			err |= clEnqueueWriteBuffer(queue, d_mean[i], CL_FALSE, 0, W*R, mean[i], 0, nullptr, &events[1+i*2]);
+		}
+		if(err != CL_SUCCESS){
+			printf("Could not write hybrid buffers!\n");
+			exit(EXIT_FAILURE);
+		}
+
+		for(uint32_t i=0;i<2;i++){
+			calcDisparity(queue, &d_down[i], &d_down[1-i], &d_mean[i], &d_mean[1-i], W, H, S, windowRadius, maxDisparity, -1+i*2, &d_out[i], &events[4+i]);
+		}
+
+		for(uint32_t i=0;i<2;i++){
+			err |= clEnqueueReadBuffer(queue, d_out[i], CL_FALSE, 0, W*S, grey[i], 0, nullptr, &events[6+i]);
+		}
+		if(err != CL_SUCCESS){
+			printf("Could not read hybrid results!\n");
+			exit(EXIT_FAILURE);
+		}
+		clFlush(queue);
+	}
+
+	//Create the remaining rows of the disparity maps on the host.
+	for(uint32_t i=0;i<2;i++){
+		host.calcDisparity(down[i], down[1-i], mean[i], mean[1-i], W, H, S, H, windowRadius, maxDisparity, -1+i*2, grey[i], &times[6+i]);
+	}
+
+	//Wait for the device rows.
+	double deviceTime = 0.0;
+	if(S > 0){
+		clFinish(queue);
+
+		cl_ulong event_start, event_end;
+		clGetEventProfilingInfo(events[0], CL_PROFILING_COMMAND_START, sizeof(event_start), &event_start, NULL);
+		clGetEventProfilingInfo(events[7], CL_PROFILING_COMMAND_END, sizeof(event_end), &event_end, NULL);
+		deviceTime = (double)(event_end - event_start)/1000000000;
+	}
+
+	//Combine images and apply post processing.
+	host.crossCheck(grey[0], grey[1], W, H, maxCrossDifference, &times[8]);
+	host.occlusionFill(grey[0], W, H, occlusionRadius, out, &times[9]);
+
+	//Move the split towards equal finishing times of the device and the host.
+	double hostTime = times[6] + times[7];
+	if(0 < S&&S < H&&deviceTime > 0.0&&hostTime > 0.0){
+		double deviceRate = S / deviceTime;
+		double hostRate = (H - S) / hostTime;
+		float target = deviceRate / (deviceRate + hostRate);
+		deviceFraction = std::clamp(0.5f * deviceFraction + 0.5f * target, MIN_DEVICE_FRACTION, MAX_DEVICE_FRACTION);
+	}
+
+	times[6] = deviceTime;
+	times[7] = hostTime;
+	*deviceRows = S;
+
+	if(S > 0){
+		for(uint32_t i=0;i<8;i++){
+			clReleaseEvent(events[i]);
+		}
+		for(uint32_t i=0;i<2;i++){
+			clReleaseMemObject(d_down[i]);
+			clReleaseMemObject(d_mean[i]);
+			clReleaseMemObject(d_out[i]);
+		}
+	}
+
+	free(grey[0]);
+	free(grey[1]);
+	free(down[0]);
+	free(down[1]);
+	free(mean[0]);
+	free(mean[1]);
+}
+
+//Creates the rows [0, rowEnd) of a disparity map on the device.
+void HybridDepthEstimator::calcDisparity(
+	cl_command_queue queue,
+	cl_mem* img_0,
+	cl_mem* img_1,
+	cl_mem* mean_0,
+	cl_mem* mean_1,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t rowEnd,
+	const uint32_t radius,
+	const uint32_t maxDisparity,
+	const int32_t direction,
+	cl_mem* out,
+	cl_event* event
+){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
+
+	err = clSetKernelArg(k_disparity, 0, sizeof(cl_mem), img_0);
+	err |= clSetKernelArg(k_disparity, 1, sizeof(cl_mem), img_1);
+	err |= clSetKernelArg(k_disparity, 2, sizeof(cl_mem), mean_0);
+	err |= clSetKernelArg(k_disparity, 3, sizeof(cl_mem), mean_1);
+	err |= clSetKernelArg(k_disparity, 4, sizeof(uint32_t), &width);
+	err |= clSetKernelArg(k_disparity, 5, sizeof(uint32_t), &height);
+	err |= clSetKernelArg(k_disparity, 6, sizeof(uint32_t), &radius);
+	err |= clSetKernelArg(k_disparity, 7, sizeof(uint32_t), &maxDisparity);
+	err |= clSetKernelArg(k_disparity, 8, sizeof(int32_t), &direction);
+	err |= clSetKernelArg(k_disparity, 9, sizeof(cl_mem), out);
+	if(err != CL_SUCCESS){
+		printf("Could not set hybrid disparity kernel arguments!\n");
+		exit(EXIT_FAILURE);
+	}
+	const size_t global[2] = {width, rowEnd};
+	err = clEnqueueNDRangeKernel(queue, k_disparity, 2, 0, global, NULL, 0, NULL, event);
+	if(err != CL_SUCCESS){
+		printf("Could not submit hybrid disparity work!\n");
+		exit(EXIT_FAILURE);
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cinttypes>
+
+#include "OMPDepthEstimator.hpp"
+#include "CLDepthEstimator2.hpp"
+#include "DepthEstimator.hpp"
+
+struct HybridDepthEstimator : DepthEstimator{
+	HybridDepthEstimator(
+		const uint32_t downsampleFactor,
+		const uint32_t windowRadius,
+		const unsigned char maxDisparity,
+		const unsigned char maxCrossDifference,
+		const uint32_t occlusionRadius
+	);
+	~HybridDepthEstimator();
+
+	void createDepthMap(
+		const char* left_name,
+		const char* right_name,
+		const char* out_name
+	) override;
+
+	void createDepthMap(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		const uint32_t outStride
+	) override;
+
+	using DepthEstimator::createDepthMap;
+
+	//Fraction of the disparity rows given to the OpenCL device. Adapted after every frame.
+	float deviceFraction;
+
+	private:
+	OMPDepthEstimator host;
+	CLDepthEstimator2 device;
+
+	cl_kernel k_disparity;
+
+	void runPipeline(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		double* times,
+		uint32_t* deviceRows
+	);
+
+	void calcDisparity(
+		cl_command_queue queue,
+		cl_mem* img_0,
+		cl_mem* img_1,
+		cl_mem* mean_0,
+		cl_mem* mean_1,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t rowEnd,
+		const uint32_t radius,
+		const uint32_t maxDisparity,
+		const int32_t direction,
+		cl_mem* out,
+		cl_event* event
+	);
+};
@@ -0,0 +1,293 @@
+#include "MultiCLDepthEstimator.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <sys/time.h>
+
+#include "util.hpp"
+
+#define CALIBRATION_WIDTH 640
+#define CALIBRATION_HEIGHT 320
+
+/*-------------------------------------------
+This is the multi device implementation of
+the depth estimator. Every OpenCL device on
+every platform gets a horizontal band of the
+image and the bands are processed
+concurrently.
+
+Band heights are weighted by the throughput
+measured with a calibration frame, and every
+band carries windowRadius + occlusionRadius
+halo rows so that the stitched result equals
+a single device run.
+-------------------------------------------*/
+
+//Stereo image depth estimator using every available OpenCL device.
+MultiCLDepthEstimator::MultiCLDepthEstimator(
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const unsigned char maxDisparity,
+	const unsigned char maxCrossDifference,
+	const uint32_t occlusionRadius
+):
+	DepthEstimator(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius)
+{
+	//Create a worker for every device.
+	devices = findAllDevices();
+	for(uint32_t i=0;i<devices.size();i++){
+		workers.push_back(new CLDepthEstimator2(
+			downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius,
+			devices[i].platform, devices[i].device
+		));
+	}
+	throughput.resize(workers.size(), 1.0);
+
+	//Measure the relative speed of the devices.
+	calibrate();
+}
+
+//Cleanup.
+MultiCLDepthEstimator::~MultiCLDepthEstimator(){
+	for(uint32_t i=0;i<workers.size();i++){
+		delete workers[i];
+	}
+}
+
+//Create a depth map from left and right source images.
+void MultiCLDepthEstimator::createDepthMap(
+	const char* left_name,
+	const char* right_name,
+	const char* out_name
+){
+	//Load images. Both are decoded at once, the right one converted to the channels of the left one.
+	unsigned char* img[2];
+	uint32_t w, h, c = 0;
+
+	imgLoadPair(left_name, right_name, &w, &h, &c, img);
+
+	uint32_t W = w / downsampleFactor;
+	uint32_t H = h / downsampleFactor;
+
+	unsigned char* out = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	uint32_t N = workers.size();
+	std::vector<uint32_t> bounds(N+1);
+	std::vector<double> times(N, 0.0);
+
+	//Use the tuned workgroup sizes for this frame size on every device.
+	prepareFrame(w, h);
+
+	//Start measuring execution time.
+	struct timeval time_start, time_end;
+	gettimeofday(&time_start, NULL);
+
+	runBands(img[0], img[1], w, h, w*c, c, out, W, bounds.data(), times.data());
+
+	//Finish measuring execution time.
+	gettimeofday(&time_end, NULL);
+
+	//Write the final image into a file as grey.
+	imgWrite(out_name, W, H, 1, out);
+
+	free(img[0]);
+	free(img[1]);
+	free(out);
+
+	//Print execution times.
+	double elapsed = (double)(time_end.tv_usec - time_start.tv_usec) / 1000000 +
+		(double)(time_end.tv_sec - time_start.tv_sec);
+	printf("---OpenCL Multi-device Depth Estimator---\nTotal execution time: %f S.\n", elapsed);
+
+	for(uint32_t i=0;i<N;i++){
+		printf("Device %u rows %5u-%5u: %f S. (%s)\n", i, bounds[i], bounds[i+1], times[i], devices[i].name);
+	}
+	printf("\n");
+}
+
+//Create a depth map from caller owned grey or rgba images in memory.
+void MultiCLDepthEstimator::createDepthMap(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	checkLayout(width, stride, channels, outStride);
+	prepareFrame(width, height);
+
+	std::vector<uint32_t> bounds(workers.size()+1);
+	std::vector<double> times(workers.size(), 0.0);
+	runBands(left, right, width, height, stride, channels, out, outStride, bounds.data(), times.data());
+}
+
+//Use the tuned workgroup sizes of the frame size on every device. The device bands change height from frame
+//to frame with the measured throughput, so they are not tuned on their own.
+void MultiCLDepthEstimator::prepareFrame(
+	const uint32_t width,
+	const uint32_t height
+){
+	for(CLDepthEstimator2* worker : workers){
+		worker->prepareFrame(width, height);
+	}
+}
+
+//Computes a whole strip or crop of the frame prepared by prepareFrame over the devices and keeps the requested rows.
+void MultiCLDepthEstimator::createDepthBand(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	const uint32_t outBegin,
+	const uint32_t outEnd,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+	unsigned char* band = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	std::vector<uint32_t> bounds(workers.size()+1);
+	std::vector<double> times(workers.size(), 0.0);
+	runBands(left, right, width, height, stride, channels, band, W, bounds.data(), times.data());
+	for(uint32_t j=outBegin;j<outEnd;j++){
+		memcpy(out + (size_t)(j - outBegin) * outStride, band + (size_t)j*W, W);
+	}
+
+	free(band);
+}
+
+//Processes the bands concurrently, one host thread per device, and refines the device weights.
+//The band bounds and the time spent on each band are written into bounds and times.
+void MultiCLDepthEstimator::runBands(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	const uint32_t outStride,
+	uint32_t* bounds,
+	double* times
+){
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
+	//Split the image into bands.
+	uint32_t N = workers.size();
+	uint32_t halo = windowRadius + occlusionRadius;
+	splitBands(H, bounds);
+
+	#pragma omp parallel for num_threads(N) schedule(static, 1)
+	for(uint32_t i=0;i<N;i++){
+		times[i] = 0.0;
+		if(bounds[i] == bounds[i+1]){continue;}
+
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+
+		//Band rows including the halo.
+		uint32_t first = bounds[i] < halo ? 0 : bounds[i] - halo;
+		uint32_t last = std::min(H, bounds[i+1] + halo);
+		size_t offset = (size_t)first * downsampleFactor * stride;
+
+		workers[i]->createDepthBand(
+			left + offset, right + offset, width, (last - first) * downsampleFactor, stride, channels,
+			bounds[i] - first, bounds[i+1] - first, out + (size_t)bounds[i] * outStride, outStride
+		);
+
+		gettimeofday(&end, NULL);
+		times[i] = (double)(end.tv_usec - start.tv_usec) / 1000000 +
+			(double)(end.tv_sec - start.tv_sec);
+	}
+
+	//Refine the device weights with the measured band throughput.
+	for(uint32_t i=0;i<N;i++){
+		if(times[i] > 0.0){
+			throughput[i] = (bounds[i+1] - bounds[i]) * W / times[i];
+		}
+	}
+}
+
+//Measure the throughput of every device with a random calibration frame.
+void MultiCLDepthEstimator::calibrate(){
+	uint32_t w = CALIBRATION_WIDTH;
+	uint32_t h = CALIBRATION_HEIGHT;
+	uint32_t W = w / downsampleFactor;
+	uint32_t H = h / downsampleFactor;
+
+	//Create a random texture and a shifted copy of it.
+	unsigned char* img[2];
+	img[0] = (unsigned char*)malloc(w*h*4*sizeof(unsigned char));
+	img[1] = (unsigned char*)malloc(w*h*4*sizeof(unsigned char));
+	unsigned char* out = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	srand(0);
+	for(uint32_t i=0;i<w*h*4;i++){
+		img[0][i] = rand()%256;
+	}
+	for(uint32_t i=0;i<w*h*4;i++){
+		img[1][i] = img[0][(i + maxDisparity/2*downsampleFactor*4) % (w*h*4)];
+	}
+
+	for(uint32_t i=0;i<workers.size();i++){
+		//Workgroup sizes of the calibration frame, and a warmup run so that lazy initialization is not measured.
+		workers[i]->prepareFrame(w, h);
+		workers[i]->createDepthBand(img[0], img[1], w, h, w*4, 4, 0, H, out, W);
+
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+
+		workers[i]->createDepthBand(img[0], img[1], w, h, w*4, 4, 0, H, out, W);
+
+		gettimeofday(&end, NULL);
+		double elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
+			(double)(end.tv_sec - start.tv_sec);
+		throughput[i] = W * H / elapsed;
+	}
+
+	free(img[0]);
+	free(img[1]);
+	free(out);
+}
+
+//Print the devices in use and their measured throughput.
+void MultiCLDepthEstimator::printInfo(){
+	printf("\n---OpenCL Devices---\n");
+	for(uint32_t i=0;i<devices.size();i++){
+		printf("%u: %s, %u compute units, %u MHz, %f Mpx/S.\n",
+			i, devices[i].name, devices[i].computeUnits, devices[i].clockFrequency, throughput[i] / 1000000
+		);
+	}
+	printf("\n");
+}
+
+//Split the rows of the downsampled image into bands proportional to the device throughput.
+void MultiCLDepthEstimator::splitBands(
+	const uint32_t height,
+	uint32_t* bounds
+){
+	uint32_t N = workers.size();
+
+	double total = 0.0;
+	for(uint32_t i=0;i<N;i++){
+		total += throughput[i];
+	}
+
+	double sum = 0.0;
+	bounds[0] = 0;
+	for(uint32_t i=0;i<N;i++){
+		sum += throughput[i];
+		bounds[i+1] = (uint32_t)round(height * sum / total);
+	}
+	bounds[N] = height;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cinttypes>
+#include <vector>
+
+#include "CLDevices.hpp"
+#include "CLDepthEstimator2.hpp"
+#include "DepthEstimator.hpp"
+
+struct MultiCLDepthEstimator : DepthEstimator{
+	MultiCLDepthEstimator(
+		const uint32_t downsampleFactor,
+		const uint32_t windowRadius,
+		const unsigned char maxDisparity,
+		const unsigned char maxCrossDifference,
+		const uint32_t occlusionRadius
+	);
+	~MultiCLDepthEstimator();
+
+	void createDepthMap(
+		const char* left_name,
+		const char* right_name,
+		const char* out_name
+	) override;
+
+	void createDepthMap(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		const uint32_t outStride
+	) override;
+
+	using DepthEstimator::createDepthMap;
+
+	void prepareFrame(
+		const uint32_t width,
+		const uint32_t height
+	) override;
+
+	void createDepthBand(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		const uint32_t outBegin,
+		const uint32_t outEnd,
+		unsigned char* out,
+		const uint32_t outStride
+	) override;
+
+	void calibrate();
+
+	void printInfo() override;
+
+	private:
+	std::vector<CLDevice> devices;
+	std::vector<CLDepthEstimator2*> workers;
+	std::vector<double> throughput;
+
+	void runBands(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		const uint32_t outStride,
+		uint32_t* bounds,
+		double* times
+	);
+
+	void splitBands(
+		const uint32_t height,
+		uint32_t* bounds
+	);
+};
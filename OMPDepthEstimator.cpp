@@ -2,10 +2,20 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
+#include <string>
+#include <atomic>
+#include <algorithm>
+#include <omp.h>
+#include <sched.h>
 #include <sys/time.h>
 
 #include "util.hpp"
+#include "roofline.hpp"
+#include "trace.hpp"
+#include "numaNodes.hpp"
+#include "rowWindow.hpp"
 
 /*-------------------------------------------
 This is the multithreaded implementation 
@@ -13,25 +23,373 @@ of the depth estimator for phase 4.
 OpenMP is used for this implementation.
 
 This implementation parallelizes the image 
-calculations as well as allows for 
-concurrent resource preparation (eg. 
-left and right images can be prepared 
-concurrently).
+calculations in one parallel region per 
+run. The rows of every stage are split 
+into tiles, run as one graph of tasks 
+that start when the tiles they read are 
+done, or stage by stage by worker tasks 
+following the schedule of the stage, see 
+OMPDepthEstimator.hpp.
 -------------------------------------------*/
 
+static const char* commandLineSchedule = nullptr;
+
+static const char* const stageKeys[OMP_STAGES] = {
+	"greyscale", "downsample", "filter", "disparity", "cross", "fill"
+};
+
+static const char* const scheduleNames[] = {"static", "dynamic", "guided"};
+static const char* const bindNames[] = {"default", "primary", "close", "spread"};
+static const char* const placementNames[] = {"off", "touch", "interleave"};
+static const char* const pipelineNames[] = {"graph", "phases", "auto"};
+
+//Sets the schedules of OpenMP backends created from now on. Overrides DEPTH_OMP_SCHEDULE.
+void setOMPSchedule(
+	const char* spec
+){
+	commandLineSchedule = spec;
+}
+
 //Stereo image depth estimator implemented using OpenMP multithreading.
+//The cheap stages get even blocks, disparity and occlusion fill, whose cost varies between rows, small dynamic tiles.
 OMPDepthEstimator::OMPDepthEstimator(
 	const uint32_t downsampleFactor,
 	const uint32_t windowRadius,
 	const unsigned char maxDisparity,
 	const unsigned char maxCrossDifference,
 	const uint32_t occlusionRadius
+):
+	DepthEstimator(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius)
+{
+	for(uint32_t i=0;i<OMP_STAGES;i++){
+		schedules[i] = {OMP_STATIC, 0, 0};
+	}
+	schedules[OMP_DISPARITY] = {OMP_GUIDED, 1, 0};
+	schedules[OMP_FILL] = {OMP_DYNAMIC, 8, 0};
+	procBind = OMP_BIND_DEFAULT;
+	placement = OMP_PLACE_OFF;
+	nodes = 0;
+	pipeline = OMP_PIPELINE_AUTO;
+	tileRows = 0;
+	scheduled = false;
+
+	const char* spec = commandLineSchedule;
+	if(spec == nullptr){spec = getenv("DEPTH_OMP_SCHEDULE");}
+	if(spec != nullptr){applySchedule(spec);}
+	placeThreads();
+}
+
+//Applies a schedule list on top of the current schedules.
+void OMPDepthEstimator::applySchedule(
+	const char* spec
+){
+	std::string list = spec;
+	for(size_t begin=0;begin<list.size();){
+		size_t end = list.find(',', begin);
+		if(end == std::string::npos){end = list.size();}
+		std::string item = list.substr(begin, end - begin);
+		begin = end + 1;
+		if(item.empty()){continue;}
+
+		size_t equals = item.find('=');
+		std::string key = item.substr(0, equals);
+		std::string value = equals == std::string::npos ? "" : item.substr(equals + 1);
+
+		if(key == "bind"){
+			bool known = false;
+			for(uint32_t i=0;i<4;i++){
+				if(value == bindNames[i]){
+					procBind = (OMPProcBind)i;
+					known = true;
+				}
+			}
+			if(!known){
+				printf("Unknown OpenMP binding: %s!\n", item.c_str());
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+
+		if(key == "numa"){
+			bool known = false;
+			for(uint32_t i=0;i<3;i++){
+				if(value == placementNames[i]){
+					placement = (OMPPlacement)i;
+					known = true;
+				}
+			}
+			if(!known){
+				printf("Unknown NUMA placement: %s!\n", item.c_str());
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+
+		if(key == "nodes"){
+			char* end;
+			nodes = strtoul(value.c_str(), &end, 10);
+			if(value.empty()||*end != '\0'){
+				printf("Could not parse the NUMA nodes: %s!\n", item.c_str());
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+
+		if(key == "pipeline"){
+			bool known = false;
+			for(uint32_t i=0;i<3;i++){
+				if(value == pipelineNames[i]){
+					pipeline = (OMPPipeline)i;
+					known = true;
+				}
+			}
+			if(!known){
+				printf("Unknown OpenMP pipeline: %s!\n", item.c_str());
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+
+		if(key == "tile"){
+			char* end;
+			tileRows = strtoul(value.c_str(), &end, 10);
+			if(value.empty()||*end != '\0'){
+				printf("Could not parse the tile rows: %s!\n", item.c_str());
+				exit(EXIT_FAILURE);
+			}
+			continue;
+		}
+
+		//Schedule, chunk and threads.
+		std::string name = value.substr(0, value.find(':'));
+		OMPStageSchedule schedule = {OMP_STATIC, 0, 0};
+		bool known = false;
+		for(uint32_t i=0;i<3;i++){
+			if(name == scheduleNames[i]){
+				schedule.schedule = (OMPSchedule)i;
+				known = true;
+			}
+		}
+		int len = 0;
+		const char* numbers = value.c_str() + name.size();
+		if(*numbers != '\0'&&!(sscanf(numbers, ":%u%n:%u%n", &schedule.chunk, &len, &schedule.threads, &len) >= 1&&
+			numbers[len] == '\0')){
+			known = false;
+		}
+
+		bool matched = false;
+		for(uint32_t i=0;i<OMP_STAGES&&known;i++){
+			if(key == "all"||key == stageKeys[i]){
+				schedules[i] = schedule;
+				matched = true;
+				scheduled = true;
+			}
+		}
+		if(!matched){
+			printf("Unknown OpenMP schedule: %s!\n", item.c_str());
+			exit(EXIT_FAILURE);
+		}
+	}
+	placeThreads();
+}
+
+//Chooses the CPUs of the first nodes nodes in node order, one row band per node.
+void OMPDepthEstimator::placeThreads(){
+	cpus.clear();
+	cpuBands.clear();
+	bandNodes.clear();
+	if(placement == OMP_PLACE_OFF){return;}
+
+	const std::vector<NumaNode>& all = numaNodes();
+	uint32_t count = nodes ? std::min(nodes, (uint32_t)all.size()) : all.size();
+	for(uint32_t i=0;i<count;i++){
+		bandNodes.push_back(all[i].id);
+		for(uint32_t cpu : all[i].cpus){
+			cpus.push_back(cpu);
+			cpuBands.push_back(i);
+		}
+	}
+}
+
+//Threads of stages that do not set their own, at most one per placed CPU.
+uint32_t OMPDepthEstimator::defaultThreads(){
+	uint32_t threads = omp_get_max_threads();
+	return cpus.empty() ? threads : std::min(threads, (uint32_t)cpus.size());
+}
+
+//Row band of the calling thread of the team, following the pinning of parallelRegion.
+uint32_t OMPDepthEstimator::threadBand(){
+	if(cpus.empty()){return 0;}
+	return cpuBands[(uint64_t)omp_get_thread_num() * cpus.size() / omp_get_num_threads()];
+}
+
+//Allocates a plane of rows rows of rowBytes bytes. With interleaving the pages of every band are bound to its node.
+unsigned char* OMPDepthEstimator::allocatePlane(
+	const size_t rowBytes,
+	const uint32_t rows
+){
+	if(placement == OMP_PLACE_OFF){
+		return (unsigned char*)malloc(rowBytes*rows*sizeof(unsigned char));
+	}
+
+	unsigned char* plane = (unsigned char*)allocatePages(rowBytes*rows*sizeof(unsigned char));
+	uint32_t bands = bandNodes.size();
+	for(uint32_t b=0;b<bands&&placement == OMP_PLACE_INTERLEAVE;b++){
+		bindRows(plane, rowBytes, (uint64_t)rows * b / bands, (uint64_t)rows * (b + 1) / bands, bandNodes[b]);
+	}
+	return plane;
+}
+
+//Frees a plane of allocatePlane.
+void OMPDepthEstimator::freePlane(
+	unsigned char* plane,
+	const size_t rowBytes,
+	const uint32_t rows
+){
+	if(placement == OMP_PLACE_OFF){
+		free(plane);
+	}else{
+		freePages(plane, rowBytes*rows*sizeof(unsigned char));
+	}
+}
+
+//Writes every row of a plane once from the threads of the band that holds it, so its pages are placed there.
+void OMPDepthEstimator::touchPlane(
+	unsigned char* plane,
+	const size_t rowBytes,
+	const uint32_t rows
+){
+	forTiles(OMP_GREYSCALE, rows, [=](uint32_t rowBegin, uint32_t rowEnd){
+		memset(plane + rowBegin*rowBytes, 0, (rowEnd - rowBegin)*rowBytes);
+	});
+}
+
+//Threads of the pipeline region, the most of any stage.
+uint32_t OMPDepthEstimator::teamSize(){
+	uint32_t threads = 1;
+	for(uint32_t i=0;i<OMP_STAGES;i++){
+		threads = std::max(threads, schedules[i].threads ? schedules[i].threads : defaultThreads());
+	}
+	return threads;
+}
+
+//Runs body on one thread of a new parallel region of the given size and binding. The other threads run its tasks.
+//Unless cpus is empty every thread is pinned to its share of cpus in order for the region and gets its own affinity
+//back afterwards.
+template<typename Body>
+static void parallelRegion(
+	const uint32_t threads,
+	const OMPProcBind bind,
+	const std::vector<uint32_t>& cpus,
+	const Body& body
 ){
-	this->downsampleFactor = downsampleFactor;
-	this->windowRadius = windowRadius;
-	this->maxDisparity = maxDisparity;
-	this->maxCrossDifference = maxCrossDifference;
-	this->occlusionRadius = occlusionRadius;
+	auto team = [&]{
+		cpu_set_t previous;
+		bool pinned = !cpus.empty()&&sched_getaffinity(0, sizeof(previous), &previous) == 0&&
+			pinThread(cpus[(uint64_t)omp_get_thread_num() * cpus.size() / omp_get_num_threads()]);
+
+		#pragma omp single
+		body();
+
+		if(pinned){sched_setaffinity(0, sizeof(previous), &previous);}
+	};
+
+	switch(bind){
+		case OMP_BIND_PRIMARY:
+			#pragma omp parallel num_threads(threads) proc_bind(master)
+			team();
+			break;
+		case OMP_BIND_CLOSE:
+			#pragma omp parallel num_threads(threads) proc_bind(close)
+			team();
+			break;
+		case OMP_BIND_SPREAD:
+			#pragma omp parallel num_threads(threads) proc_bind(spread)
+			team();
+			break;
+		default:
+			#pragma omp parallel num_threads(threads)
+			team();
+	}
+}
+
+//Runs body(rowBegin, rowEnd) over the rows [0, rows) of a stage in tiles on the worker tasks of its schedule
+//and waits for them. Stages called outside of a parallel region (eg. by the hybrid backend) open their own.
+template<typename Body>
+void OMPDepthEstimator::forTiles(
+	const OMPStage stage,
+	const uint32_t rows,
+	const Body& body
+){
+	if(rows == 0){return;}
+
+	const OMPStageSchedule& schedule = schedules[stage];
+	if(omp_get_level() == 0){
+		uint32_t threads = schedule.threads ? schedule.threads : defaultThreads();
+		parallelRegion(threads, procBind, cpus, [&]{forTiles(stage, rows, body);});
+		return;
+	}
+
+	uint32_t team = omp_get_num_threads();
+	uint32_t workers = std::min(std::min(schedule.threads ? schedule.threads : team, team), rows);
+	uint32_t chunk = std::max(schedule.chunk, 1u);
+	const Body* run = &body;
+
+	//With placement every band has a cursor and workers start on the band of their node.
+	uint32_t bands = std::max((uint32_t)bandNodes.size(), 1u);
+	std::vector<std::atomic<uint32_t>> next(bands);
+	for(uint32_t b=0;b<bands;b++){
+		next[b].store((uint64_t)rows * b / bands);
+	}
+	std::atomic<uint32_t>* cursor = next.data();
+
+	for(uint32_t k=0;k<workers;k++){
+		#pragma omp task firstprivate(k, cursor, run, chunk, workers, bands)
+		{
+			//A copy of its own, so the stores of the body cannot alias the captured values.
+			Body tile = *run;
+			if(bands > 1){
+				uint32_t home = threadBand();
+				uint32_t bandWorkers = std::max(workers / bands, 1u);
+				for(uint32_t n=0;n<bands;n++){
+					uint32_t b = (home + n) % bands;
+					uint32_t bandBegin = (uint64_t)rows * b / bands;
+					uint32_t bandEnd = (uint64_t)rows * (b + 1) / bands;
+					uint32_t begin = cursor[b].load();
+					while(begin < bandEnd){
+						uint32_t size = schedule.chunk ? chunk : (bandEnd - bandBegin + bandWorkers - 1) / bandWorkers;
+						if(schedule.schedule == OMP_GUIDED){
+							size = std::max(chunk, (bandEnd - begin) / (2 * bandWorkers));
+						}
+						if(cursor[b].compare_exchange_weak(begin, begin + size)){
+							tile(begin, std::min(begin + size, bandEnd));
+							begin = cursor[b].load();
+						}
+					}
+				}
+			}else if(schedule.schedule == OMP_STATIC&&schedule.chunk == 0){
+				tile((uint64_t)rows * k / workers, (uint64_t)rows * (k + 1) / workers);
+			}else if(schedule.schedule == OMP_STATIC){
+				for(uint32_t begin=k*chunk;begin<rows;begin+=workers*chunk){
+					tile(begin, std::min(begin + chunk, rows));
+				}
+			}else if(schedule.schedule == OMP_DYNAMIC){
+				for(uint32_t begin=cursor->fetch_add(chunk);begin<rows;begin=cursor->fetch_add(chunk)){
+					tile(begin, std::min(begin + chunk, rows));
+				}
+			}else{
+				uint32_t begin = cursor->load();
+				while(begin < rows){
+					uint32_t size = std::max(chunk, (rows - begin) / (2 * workers));
+					if(cursor->compare_exchange_weak(begin, begin + size)){
+						tile(begin, std::min(begin + size, rows));
+						begin = cursor->load();
+					}
+				}
+			}
+		}
+	}
+	#pragma omp taskwait
 }
 
 //Create a depth map from left and right source images.
@@ -40,136 +398,473 @@ void OMPDepthEstimator::createDepthMap(
 	const char* right_name,
 	const char* out_name
 ){
-	//Load images.
+	//Load images as grey. Both are decoded at once, color pngs are converted to grey while they are decoded.
 	unsigned char* img[2];
-	uint32_t w, h;
+	uint32_t w, h, c = 1;
 
-	imgLoad(left_name, &w, &h, &img[0]);
-	imgLoad(right_name, &w, &h, &img[1]);
+	imgLoadPair(left_name, right_name, &w, &h, &c, img);
 
 	uint32_t W = w / downsampleFactor;
 	uint32_t H = h / downsampleFactor;
 
-	//Allocate memory for images.
-	unsigned char* grey[2];
-	unsigned char* down[2];
-	unsigned char* mean[2];
-
-	grey[0] = (unsigned char*)malloc(w*h*sizeof(unsigned char));
-	grey[1] = (unsigned char*)malloc(w*h*sizeof(unsigned char));
-	down[0] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
-	down[1] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
-	mean[0] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
-	mean[1] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+	unsigned char* out = (unsigned char*)malloc(W*H*sizeof(unsigned char));
 
-	double times[11];
+	double times[10];
 
 	//Start measuring execution time.
 	struct timeval time_start, time_end;
 	gettimeofday(&time_start, NULL);
 
-	//Prepare left and right images.
-	#pragma omp parallel for
-	for(uint32_t i=0;i<2;i++){
-		makeImgGrey(img[i], w, h, grey[i], &times[0+i*3]);
-		downsampleImg(grey[i], w, h, downsampleFactor, down[i], &times[1+i*3]);
-		filterImg(down[i], W, H, windowRadius, mean[i], &times[2+i*3]);
-	}
-
-	//Create left and right disparity maps.
-	#pragma omp parallel for
-	for(uint32_t i=0;i<2;i++){
-		calcDisparity(down[i], down[1-i], mean[i], mean[1-i], W, H, windowRadius, maxDisparity, -1+i*2, grey[i], &times[6+i]);
-	}
-
-	//Combine images and apply post processing.
-	crossCheck(grey[0], grey[1], W, H, maxCrossDifference, &times[8]);
-	occlusionFill(grey[0], W, H, occlusionRadius, mean[0], &times[9]);
+	runPipeline(img[0], img[1], w, h, w*c, c, out, times, nullptr, nullptr);
 
 	//Finish measuring execution time.
 	gettimeofday(&time_end, NULL);
 
-	//Write the final image into a file.
-	makeImgRGBA(mean[0], W, H, grey[1], &times[10]);
-	imgWrite(out_name, W, H, grey[1]);
+	//Write the final image into a file as grey.
+	imgWrite(out_name, W, H, 1, out);
 
 	free(img[0]);
 	free(img[1]);
-	free(grey[0]);
-	free(grey[1]);
-	free(down[0]);
-	free(down[1]);
-	free(mean[0]);
-	free(mean[1]);
+	free(out);
 
 	//Print total execution time.
 	double elapsed = (double)(time_end.tv_usec - time_start.tv_usec) / 1000000 +
 		(double)(time_end.tv_sec - time_start.tv_sec);
 	printf("---OpenMP Depth Estimator---\nTotal execution time: %f S.\n", elapsed);
 
-	printf("Left greyscale      : %f S.\n", times[0]);
-	printf("Left downsample     : %f S.\n", times[1]);
-	printf("Left filter         : %f S.\n", times[2]);
-	printf("Right greyscale     : %f S.\n", times[3]);
-	printf("Right downsample    : %f S.\n", times[4]);
-	printf("Right filter        : %f S.\n", times[5]);
-	printf("Left disparity      : %f S.\n", times[6]);
-	printf("Right disparity     : %f S.\n", times[7]);
-	printf("Cross check         : %f S.\n", times[8]);
-	printf("Occlusion fill      : %f S.\n", times[9]);
-	printf("Convert rgba        : %f S.\n\n", times[10]);
+	//Stage rates against the peaks of the machine.
+	StageWork work[10];
+	pipelineWork(w, h, c, downsampleFactor, windowRadius, maxDisparity, work);
+	const MachinePeaks* peaks = machinePeaks(0);
+	printMachinePeaks(peaks);
+
+	printStageTime("Left greyscale      ", times[0], work[0], peaks);
+	printStageTime("Left downsample     ", times[1], work[1], peaks);
+	printStageTime("Left filter         ", times[2], work[2], peaks);
+	printStageTime("Right greyscale     ", times[3], work[3], peaks);
+	printStageTime("Right downsample    ", times[4], work[4], peaks);
+	printStageTime("Right filter        ", times[5], work[5], peaks);
+	printStageTime("Left disparity      ", times[6], work[6], peaks);
+	printStageTime("Right disparity     ", times[7], work[7], peaks);
+	printStageTime("Cross check         ", times[8], work[8], peaks);
+	printStageTime("Occlusion fill      ", times[9], work[9], peaks);
+	printf("\n");
 }
 
-//Create a greyscale image based on source 8bit rgba image.
-void OMPDepthEstimator::makeImgGrey(
-	const unsigned char* img,
+//Create a depth map from caller owned grey or rgba images in memory.
+void OMPDepthEstimator::createDepthMap(
+	const unsigned char* left,
+	const unsigned char* right,
 	const uint32_t width,
 	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
 	unsigned char* out,
-	double* elapsed
+	const uint32_t outStride
+){
+	checkLayout(width, stride, channels, outStride);
+
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+	double times[10];
+
+	if(outStride == W){
+		runPipeline(left, right, width, height, stride, channels, out, times, nullptr, nullptr);
+		return;
+	}
+
+	//Padded output rows.
+	unsigned char* temp = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+	runPipeline(left, right, width, height, stride, channels, temp, times, nullptr, nullptr);
+	for(uint32_t i=0;i<H;i++){
+		memcpy(out + (size_t)i*outStride, temp + (size_t)i*W, W);
+	}
+	free(temp);
+}
+
+//Run the pipeline once and report the stage times.
+bool OMPDepthEstimator::timeStages(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	double* times
+){
+	checkLayout(width, stride, channels, width / downsampleFactor);
+
+	double pipelineTimes[10];
+	runPipeline(left, right, width, height, stride, channels, out, pipelineTimes, nullptr, nullptr);
+	foldStageTimes(pipelineTimes, times);
+	return true;
+}
+
+//Run the pipeline once and count the hardware events of every stage.
+bool OMPDepthEstimator::countStages(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	PerfCounters* perf,
+	uint64_t* counters
+){
+	checkLayout(width, stride, channels, width / downsampleFactor);
+	if(!perf->available()){return false;}
+
+	double times[10];
+	perf->reset();
+	runPipeline(left, right, width, height, stride, channels, out, times, nullptr, perf);
+	foldStageCounters(perf->stages, counters);
+	return true;
+}
+
+//Run the pipeline once and copy the output of every stage into planes.
+bool OMPDepthEstimator::capturePlanes(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	DepthPlanes* planes
+){
+	checkLayout(width, stride, channels, width / downsampleFactor);
+
+	double times[10];
+	runPipeline(left, right, width, height, stride, channels, planes->out, times, planes, nullptr);
+	return true;
+}
+
+//Runs every stage from the greyscale conversion to the occlusion fill. Stage times are written into times[0..9].
+//The output of every stage is copied into planes and the hardware events of every stage counted into perf
+//unless they are nullptr.
+void OMPDepthEstimator::runPipeline(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	double* times,
+	DepthPlanes* planes,
+	PerfCounters* perf
+){
+	const unsigned char* img[2] = {left, right};
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
+	//Phases when hardware events are counted, their counters are read at the stage boundaries. The automatic
+	//pipeline runs phases too when the planes are placed or a stage schedule was set, the graph uses neither.
+	uint32_t batch = perf == nullptr ? rowWindowBatch() : 0;
+	bool graph = (pipeline == OMP_PIPELINE_GRAPH||(pipeline == OMP_PIPELINE_AUTO&&placement == OMP_PLACE_OFF&&!scheduled))&&
+		perf == nullptr&&batch == 0;
+
+	//Allocate memory for images. The row window mode only needs the disparity maps. The disparity maps reuse
+	//the grey planes unless the planes are placed, their rows would all be in the first band of the grey planes,
+	//or the stages run as a graph, which writes disparity rows while other tiles still read the grey rows in the
+	//same place.
+	unsigned char* grey[2] = {nullptr, nullptr};
+	unsigned char* down[2] = {nullptr, nullptr};
+	unsigned char* mean[2] = {nullptr, nullptr};
+	unsigned char* disparity[2];
+
+	for(uint32_t i=0;i<2;i++){
+		if(batch == 0){
+			grey[i] = allocatePlane(width, height);
+			down[i] = allocatePlane(W, H);
+			mean[i] = allocatePlane(W, H);
+		}
+		disparity[i] = placement == OMP_PLACE_OFF&&!graph&&batch == 0 ? grey[i] : allocatePlane(W, H);
+	}
+
+	//Run every stage in one region, the stages spread their rows over the team.
+	parallelRegion(teamSize(), procBind, cpus, [&]{
+		if(placement == OMP_PLACE_TOUCH){
+			for(uint32_t i=0;i<2;i++){
+				if(batch == 0){
+					touchPlane(grey[i], width, height);
+					touchPlane(down[i], W, H);
+					touchPlane(mean[i], W, H);
+				}
+				if(disparity[i] != grey[i]){touchPlane(disparity[i], W, H);}
+			}
+		}
+
+		if(graph){
+			runGraph(img, width, height, stride, channels, grey, down, mean, disparity, out, times, planes);
+			return;
+		}
+
+		if(batch){
+			runWindow(img, width, height, stride, channels, batch, disparity, times, planes);
+		}else{
+			//Prepare left and right images.
+			for(uint32_t i=0;i<2;i++){
+				if(perf){perf->start();}
+				makeImgGrey(img[i], width, height, stride, channels, grey[i], &times[0+i*3]);
+				if(perf){perf->stop(0+i*3);}
+				if(perf){perf->start();}
+				downsampleImg(grey[i], width, height, downsampleFactor, down[i], &times[1+i*3]);
+				if(perf){perf->stop(1+i*3);}
+				if(perf){perf->start();}
+				filterImg(down[i], W, H, windowRadius, mean[i], &times[2+i*3]);
+				if(perf){perf->stop(2+i*3);}
+			}
+
+			if(planes){
+				for(uint32_t i=0;i<2;i++){
+					memcpy(planes->grey[i], grey[i], width*height);
+					memcpy(planes->down[i], down[i], W*H);
+					memcpy(planes->mean[i], mean[i], W*H);
+				}
+			}
+
+			//Create left and right disparity maps.
+			for(uint32_t i=0;i<2;i++){
+				if(perf){perf->start();}
+				calcDisparity(down[i], down[1-i], mean[i], mean[1-i], W, H, 0, H, windowRadius, maxDisparity, -1+i*2, disparity[i], &times[6+i]);
+				if(perf){perf->stop(6+i);}
+			}
+
+			if(planes){
+				memcpy(planes->disparity[0], disparity[0], W*H);
+				memcpy(planes->disparity[1], disparity[1], W*H);
+			}
+		}
+
+		//Combine images and apply post processing.
+		if(perf){perf->start();}
+		crossCheck(disparity[0], disparity[1], W, H, maxCrossDifference, &times[8]);
+		if(perf){perf->stop(8);}
+		if(planes){
+			memcpy(planes->cross, disparity[0], W*H);
+		}
+		if(perf){perf->start();}
+		occlusionFill(disparity[0], W, H, occlusionRadius, out, &times[9]);
+		if(perf){perf->stop(9);}
+	});
+
+	for(uint32_t i=0;i<2;i++){
+		if(disparity[i] != grey[i]){freePlane(disparity[i], W, H);}
+		freePlane(grey[i], width, height);
+		freePlane(down[i], W, H);
+		freePlane(mean[i], W, H);
+	}
+}
+
+//Creates the disparity maps of both views in row window mode, one band of rows per thread of the team.
+//Every band slides a window of its own and recomputes the downsampled rows of the halo above it.
+//The bands run side by side, so every stage time is the one of the slowest band. Called on one thread of the region.
+void OMPDepthEstimator::runWindow(
+	const unsigned char* const* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	const uint32_t batch,
+	unsigned char* const* disparity,
+	double* times,
+	DepthPlanes* planes
+){
+	uint32_t H = height / downsampleFactor;
+	uint32_t bands = std::max(std::min((uint32_t)omp_get_num_threads(), H), 1u);
+	for(uint32_t i=0;i<8;i++){
+		times[i] = 0.0;
+	}
+
+	for(uint32_t b=0;b<bands;b++){
+		#pragma omp task firstprivate(b)
+		{
+			double bandTimes[8] = {};
+			windowDisparity(img[0], img[1], width, height, stride, channels, downsampleFactor, windowRadius, maxDisparity,
+				batch, (uint64_t)H * b / bands, (uint64_t)H * (b + 1) / bands, disparity[0], disparity[1], bandTimes, planes);
+
+			#pragma omp critical
+			for(uint32_t i=0;i<8;i++){
+				times[i] = std::max(times[i], bandTimes[i]);
+			}
+		}
+	}
+	#pragma omp taskwait
+}
+
+//Adds the time of a tile run by body to the busy time of its stage in microseconds.
+//Every tile gets its own span in the trace.
+template<typename Body>
+static void timeTile(
+	std::atomic<int64_t>* busy,
+	const char* name,
+	const Body& body
 ){
 	struct timeval start, end;
 	gettimeofday(&start, NULL);
 
-	uint32_t N = width * height;
-	#pragma omp parallel for
-	for(uint32_t i=0;i<N;i++){
-		out[i] = (unsigned int)(
-			img[i*4  ] * 0.2126f +
-			img[i*4+1] * 0.7152f +
-			img[i*4+2] * 0.0722f
-		);
-	}
+	body();
 
 	gettimeofday(&end, NULL);
-	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
-		(double)(end.tv_sec - start.tv_sec);
+	*busy += (int64_t)(end.tv_sec - start.tv_sec) * 1000000 + (end.tv_usec - start.tv_usec);
+	traceSpan(name, "stage", start, end);
+}
+
+//Runs the stages after the placement as one graph of row tile tasks. Every task names the tiles it
+//writes and reads by the addresses of their entries in done, so the runtime starts it once the tasks
+//writing those tiles have finished. Tasks are created wavefront by wavefront from the top rows down.
+//The stage times are the busy times of their tiles divided by the threads of the team, so they add up to the
+//time the team was busy. The first start and last end of a stage overlap with the others and are only in the trace.
+void OMPDepthEstimator::runGraph(
+	const unsigned char* const* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* const* grey,
+	unsigned char* const* down,
+	unsigned char* const* mean,
+	unsigned char* const* disparity,
+	unsigned char* out,
+	double* times,
+	DepthPlanes* planes
+){
+	uint32_t factor = downsampleFactor;
+	uint32_t W = width / factor;
+	uint32_t H = height / factor;
+
+	//Downsampled rows of a tile and the tiles above and below one holding the rows of the window
+	//and occlusion fill halos.
+	uint32_t rows = tileRows ? tileRows : H / (4 * omp_get_num_threads());
+	rows = std::max(std::min(rows, H), 1u);
+	int32_t tiles = std::max((H + rows - 1) / rows, 1u);
+	int32_t halo = (windowRadius + rows - 1) / rows;
+	int32_t fillHalo = (occlusionRadius + rows - 1) / rows;
+
+	//One entry per tile of every stage and view, only their addresses are used. GCC does not count
+	//the uses in depend clauses.
+	std::vector<char> done(9 * tiles);
+	[[maybe_unused]] char* greyDone[2] = {&done[0*tiles], &done[1*tiles]};
+	[[maybe_unused]] char* downDone[2] = {&done[2*tiles], &done[3*tiles]};
+	[[maybe_unused]] char* meanDone[2] = {&done[4*tiles], &done[5*tiles]};
+	[[maybe_unused]] char* disparityDone[2] = {&done[6*tiles], &done[7*tiles]};
+	[[maybe_unused]] char* crossDone = &done[8*tiles];
+
+	//Busy time of every stage, the tasks get pointers to it as they copy the arrays of the function.
+	std::atomic<int64_t> busy[10];
+	std::atomic<int64_t>* stageBusy[10];
+	for(uint32_t i=0;i<10;i++){
+		busy[i].store(0);
+		stageBusy[i] = &busy[i];
+	}
+
+	uint32_t radius = windowRadius;
+	uint32_t maxDisparity = this->maxDisparity;
+	unsigned char maxDifference = maxCrossDifference;
+	uint32_t fillRadius = occlusionRadius;
+
+	for(int32_t step=0;step<tiles+halo+fillHalo;step++){
+		//Greyscale and downsample the next tile of both views. The last grey tile takes the rows
+		//the downsampling leaves out.
+		int32_t k = step;
+		for(uint32_t v=0;v<2&&k<tiles;v++){
+			uint32_t rowBegin = std::min(k * rows, H);
+			uint32_t rowEnd = std::min((k + 1) * rows, H);
+			uint32_t greyBegin = std::min(rowBegin * factor, height);
+			uint32_t greyEnd = k == tiles - 1 ? height : rowEnd * factor;
+
+			#pragma omp task firstprivate(v, k, greyBegin, greyEnd) depend(out: greyDone[v][k])
+			timeTile(stageBusy[0+v*3], "greyscale", [&]{
+				greyRows(img[v], width, stride, channels, greyBegin, greyEnd, grey[v]);
+				if(planes){memcpy(planes->grey[v] + greyBegin*width, grey[v] + greyBegin*width, (greyEnd - greyBegin)*width);}
+			});
+
+			#pragma omp task firstprivate(v, k, rowBegin, rowEnd) depend(in: greyDone[v][k]) depend(out: downDone[v][k])
+			timeTile(stageBusy[1+v*3], "downsample", [&]{
+				downsampleRows(grey[v], width, factor, rowBegin, rowEnd, down[v]);
+				if(planes){memcpy(planes->down[v] + rowBegin*W, down[v] + rowBegin*W, (rowEnd - rowBegin)*W);}
+			});
+		}
+
+		//Filter, disparity and cross check the tile whose halo rows were just downsampled.
+		k = step - halo;
+		if(0 <= k&&k < tiles){
+			uint32_t rowBegin = std::min(k * rows, H);
+			uint32_t rowEnd = std::min((k + 1) * rows, H);
+			int32_t first = std::max(k - halo, 0);
+			int32_t last = std::min(k + halo + 1, tiles);
+
+			for(uint32_t v=0;v<2;v++){
+				#pragma omp task firstprivate(v, k, rowBegin, rowEnd) depend(iterator(t=first:last), in: downDone[v][t]) \
+					depend(out: meanDone[v][k])
+				timeTile(stageBusy[2+v*3], "filter", [&]{
+					filterRows(down[v], W, H, radius, rowBegin, rowEnd, mean[v]);
+					if(planes){memcpy(planes->mean[v] + rowBegin*W, mean[v] + rowBegin*W, (rowEnd - rowBegin)*W);}
+				});
+			}
+
+			for(uint32_t v=0;v<2;v++){
+				#pragma omp task firstprivate(v, k, rowBegin, rowEnd) \
+					depend(iterator(t=first:last), in: downDone[0][t], downDone[1][t]) \
+					depend(in: meanDone[0][k], meanDone[1][k]) depend(out: disparityDone[v][k])
+				timeTile(stageBusy[6+v], "disparity", [&]{
+					disparityRows(down[v], down[1-v], mean[v], mean[1-v], W, H, rowBegin, rowEnd, radius, maxDisparity, -1+v*2, disparity[v]);
+					if(planes){memcpy(planes->disparity[v] + rowBegin*W, disparity[v] + rowBegin*W, (rowEnd - rowBegin)*W);}
+				});
+			}
+
+			#pragma omp task firstprivate(k, rowBegin, rowEnd) depend(in: disparityDone[0][k], disparityDone[1][k]) \
+				depend(out: crossDone[k])
+			timeTile(stageBusy[8], "cross check", [&]{
+				crossRows(disparity[0], disparity[1], W, rowBegin, rowEnd, maxDifference);
+				if(planes){memcpy(planes->cross + rowBegin*W, disparity[0] + rowBegin*W, (rowEnd - rowBegin)*W);}
+			});
+		}
+
+		//Occlusion fill the tile whose halo rows were just cross checked.
+		k = step - halo - fillHalo;
+		if(0 <= k&&k < tiles){
+			uint32_t rowBegin = std::min(k * rows, H);
+			uint32_t rowEnd = std::min((k + 1) * rows, H);
+			int32_t first = std::max(k - fillHalo, 0);
+			int32_t last = std::min(k + fillHalo + 1, tiles);
+
+			#pragma omp task firstprivate(k, rowBegin, rowEnd) depend(iterator(t=first:last), in: crossDone[t])
+			timeTile(stageBusy[9], "occlusion fill", [&]{
+				fillRows(disparity[0], W, H, fillRadius, rowBegin, rowEnd, out);
+			});
+		}
+	}
+	#pragma omp taskwait
+
+	for(uint32_t i=0;i<10;i++){
+		times[i] = (double)busy[i].load() / 1000000 / omp_get_num_threads();
+	}
 }
 
-//Make an rgba image based on source greyscale image.
-void OMPDepthEstimator::makeImgRGBA(
+//Create a greyscale image based on source 8bit rgba image. Grey sources are copied as they are.
+void OMPDepthEstimator::makeImgGrey(
 	const unsigned char* img,
 	const uint32_t width,
 	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
 	unsigned char* out,
 	double* elapsed
 ){
 	struct timeval start, end;
 	gettimeofday(&start, NULL);
 
-	uint32_t N = width * height;
-	#pragma omp parallel for
-	for(uint32_t i=0;i<N;i++){
-		uint32_t I = i * 4;
-		out[I  ] = img[i];
-		out[I+1] = img[i];
-		out[I+2] = img[i];
-		out[I+3] = 255;
-	}
+	forTiles(OMP_GREYSCALE, height, [=](uint32_t rowBegin, uint32_t rowEnd){
+		greyRows(img, width, stride, channels, rowBegin, rowEnd, out);
+	});
 
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("greyscale", "stage", start, end);
 }
 
 //Downsample the image by averaging pixel intensities.
@@ -184,26 +879,14 @@ void OMPDepthEstimator::downsampleImg(
 	struct timeval start, end;
 	gettimeofday(&start, NULL);
 
-	uint32_t w = width / factor;
-	uint32_t h = height / factor;
-	#pragma omp parallel for collapse(2)
-	for(uint32_t i=0;i<h;i++){
-		for(uint32_t j=0;j<w;j++){
-			uint32_t val = 0;
-			uint32_t I = i * factor;
-			uint32_t J = j * factor;
-			for(uint32_t m=I;m<I+factor;m++){
-				for(uint32_t n=J;n<J+factor;n++){
-					val += img[n+m*width];
-				}
-			}
-			out[j+i*w] = val / (factor * factor);
-		}
-	}
+	forTiles(OMP_DOWNSAMPLE, height / factor, [=](uint32_t rowBegin, uint32_t rowEnd){
+		downsampleRows(img, width, factor, rowBegin, rowEnd, out);
+	});
 
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("downsample", "stage", start, end);
 }
 
 //Apply a mean filter to the image.
@@ -218,28 +901,17 @@ void OMPDepthEstimator::filterImg(
 	struct timeval start, end;
 	gettimeofday(&start, NULL);
 
-	#pragma omp parallel for collapse(2)
-	for(int32_t i=0;i<(int32_t)height;i++){
-		for(int32_t j=0;j<(int32_t)width;j++){
-			uint32_t val = 0;
-			for(int32_t m=i-(int32_t)radius;m<=i+(int32_t)radius;m++){
-				for(int32_t n=j-(int32_t)radius;n<=j+(int32_t)radius;n++){
-					if(0<=m&&m<(int32_t)height&&0<=n&&n<(int32_t)width){
-						val += img[n+m*width];
-					}
-				}
-			}
-			uint32_t d = radius*2+1;
-			out[j+i*width] = val / (d*d);
-		}
-	}
+	forTiles(OMP_FILTER, height, [=](uint32_t rowBegin, uint32_t rowEnd){
+		filterRows(img, width, height, radius, rowBegin, rowEnd, out);
+	});
 
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("filter", "stage", start, end);
 }
 
-//Create a disparity map from source images.
+//Create the rows [rowBegin, rowEnd) of a disparity map from source images.
 void OMPDepthEstimator::calcDisparity(
 	const unsigned char* img_0,
 	const unsigned char* img_1,
@@ -247,6 +919,8 @@ void OMPDepthEstimator::calcDisparity(
 	const unsigned char* mean_1,
 	const uint32_t width,
 	const uint32_t height,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
 	const uint32_t radius,
 	const uint32_t maxDisparity,
 	const int32_t direction,
@@ -256,51 +930,14 @@ void OMPDepthEstimator::calcDisparity(
 	struct timeval start, end;
 	gettimeofday(&start, NULL);
 
-	#pragma omp parallel for collapse(2)
-	for(int32_t i=0;i<(int32_t)height;i++){
-		for(int32_t j=0;j<(int32_t)width;j++){
-
-			float top_zncc = -1.0f;
-			float temp_zncc = -1.0f;
-			unsigned char disparity = 0;
-
-			float std_0 = 0.0f;
-			float std_1 = 0.0f;
-			float numer = 0.0f;
-			float denom_0 = 0.0f;
-			float denom_1 = 0.0f;
-
-			for(int32_t d=0;d<(int32_t)maxDisparity;d++){
-				if((j+direction*d)<0||(int32_t)width<=(j+direction*d)){break;}
-				numer = 0.0f;
-				denom_0 = 0.0f;
-				denom_1 = 0.0f;
-
-				for(int32_t m=i-(int32_t)radius;m<=i+(int32_t)radius;m++){
-					for(int32_t n=j-(int32_t)radius;n<=j+(int32_t)radius;n++){
-						if(0<=m&&m<(int32_t)height&&0<=(n+direction*d)&&(n+direction*d)<(int32_t)width&&0<=n&&n<(int32_t)width){
-							std_0 = img_0[n+m*width] - mean_0[j+i*width];
-							std_1 = img_1[n+m*width+direction*d] - mean_1[j+i*width+direction*d];
-							numer += std_0 * std_1;
-							denom_0 += std_0 * std_0;
-							denom_1 += std_1 * std_1;
-						}
-					}
-				}
-
-				temp_zncc = numer / (sqrt(denom_0) * sqrt(denom_1));
-				if(temp_zncc > top_zncc){
-					top_zncc = temp_zncc;
-					disparity = d;
-				}
-			}
-			out[j+i*width] = disparity;
-		}
-	}
+	forTiles(OMP_DISPARITY, rowEnd - rowBegin, [=](uint32_t tileBegin, uint32_t tileEnd){
+		disparityRows(img_0, img_1, mean_0, mean_1, width, height, rowBegin + tileBegin, rowBegin + tileEnd, radius, maxDisparity, direction, out);
+	});
 
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("disparity", "stage", start, end);
 }
 
 //Compare and combine left and right images. Resulting image will be saved to "left".
@@ -315,15 +952,14 @@ void OMPDepthEstimator::crossCheck(
 	struct timeval start, end;
 	gettimeofday(&start, NULL);
 
-	uint32_t N = width * height;
-	#pragma omp parallel for
-	for(uint32_t i=0;i<N;i++){
-		if(abs(left[i] - right[i]) > maxDifference){left[i] = 0;}
-	}
+	forTiles(OMP_CROSS, height, [=](uint32_t rowBegin, uint32_t rowEnd){
+		crossRows(left, right, width, rowBegin, rowEnd, maxDifference);
+	});
 
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("cross check", "stage", start, end);
 }
 
 //Fill blank spaces left by cross check.
@@ -338,30 +974,12 @@ void OMPDepthEstimator::occlusionFill(
 	struct timeval start, end;
 	gettimeofday(&start, NULL);
 
-	#pragma omp parallel for collapse(2)
-	for(int32_t i=0;i<(int32_t)height;i++){
-		for(int32_t j=0;j<(int32_t)width;j++){
-			if(img[j+i*width] > 0){
-				out[j+i*width] = img[j+i*width];
-			}else{
-				float numer = 0.0f;
-				uint32_t denom = 0;
-				for(int32_t m=i-(int32_t)radius;m<=i+(int32_t)radius;m++){
-					for(int32_t n=j-(int32_t)radius;n<=j+(int32_t)radius;n++){
-						if(0<=m&&m<(int32_t)height&&0<=n&&n<(int32_t)width){
-							if(img[n+m*width] > 0){
-								numer += img[n+m*width];
-								denom++;
-							}
-						}
-					}
-				}
-				out[j+i*width] = (unsigned char)(numer/denom);
-			}
-		}
-	}
+	forTiles(OMP_FILL, height, [=](uint32_t rowBegin, uint32_t rowEnd){
+		fillRows(img, width, height, radius, rowBegin, rowEnd, out);
+	});
 
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("occlusion fill", "stage", start, end);
 }
@@ -1,8 +1,118 @@
 #pragma once
 
 #include <cinttypes>
+#include <cstddef>
+#include <vector>
 
-struct OMPDepthEstimator{
+#include "DepthEstimator.hpp"
+
+/*--------------------------------------------------
+Scheduling of the OpenMP backend.
+
+A pipeline run is one parallel region. Every stage splits its rows
+into tiles and hands them to up to threads worker tasks of the team:
+	static  : Tiles of chunk rows dealt round robin, or one even
+	          block of rows per worker with chunk 0.
+	dynamic : Workers take the next chunk rows when they finish.
+	guided  : Workers take a share of the remaining rows that
+	          shrinks down to chunk rows.
+
+Schedules are set with setOMPSchedule or the DEPTH_OMP_SCHEDULE
+environment variable as a comma separated list of
+<stage>=<schedule>[:<chunk>[:<threads>]] entries, where stage is one
+of greyscale, downsample, filter, disparity, cross, fill or all, and
+bind=<default|primary|close|spread> for the thread affinity of the
+region, default leaving it to OMP_PROC_BIND. Threads 0 means the
+OpenMP default and the team gets the most threads of any stage.
+For example:
+	all=dynamic:8,disparity=guided:1,bind=spread
+
+NUMA placement is set in the same list with numa=<off|touch|interleave>
+and nodes=<n>, the number of nodes to run on (0 for all of them).
+With placement the threads are pinned node by node and every plane is
+split into one band of rows per node. A thread takes tiles from the
+band of its node first and then from the other bands, so the rows it
+computes are the rows stored on its node:
+	off        : No pinning, planes are placed where they are touched.
+	touch      : The planes are first touched band by band in parallel.
+	interleave : The pages of every band are bound to its node.
+
+By default (pipeline=auto) a run is one graph of row tile tasks
+instead of a phase per stage. The tiles of every stage are tile=<rows> downsampled rows
+high (0 picks about four tiles per thread) and a tile task starts as
+soon as the tiles it reads are done: a filter tile when the
+downsampled rows of its radius halo are, a disparity tile when the
+downsampled rows of its halo and its filtered rows are in both views,
+a cross check tile when both of its disparity tiles are and an
+occlusion fill tile when the cross checked rows of its halo are. The
+tasks are run by the task scheduler of the OpenMP runtime, which hands
+ready tiles to idle threads, so the rows of the next stage fill up the
+tail of the previous one. The graph does not follow the schedules,
+chunks and threads of the stages or the row bands of the placement,
+so the automatic pipeline runs the stages one after another in phases
+as soon as a stage schedule or a placement is set. pipeline=phases
+always runs phases and pipeline=graph always the graph. Runs counting
+hardware events always use phases, their counters are read at the
+stage boundaries.
+
+The stage times of a graph run are the busy times of the tiles of
+every stage divided by the threads of the team. They add up to the
+time the team spent on tiles, the first to last tile spans of the
+stages overlap and are only written to the trace.
+
+The row window mode of rowWindow.hpp replaces both from the greyscale
+conversion to the disparity maps, with one band of rows per thread.
+--------------------------------------------------*/
+
+#define OMP_STAGES 6
+
+enum OMPStage{
+	OMP_GREYSCALE,
+	OMP_DOWNSAMPLE,
+	OMP_FILTER,
+	OMP_DISPARITY,
+	OMP_CROSS,
+	OMP_FILL
+};
+
+enum OMPSchedule{
+	OMP_STATIC,
+	OMP_DYNAMIC,
+	OMP_GUIDED
+};
+
+enum OMPProcBind{
+	OMP_BIND_DEFAULT,
+	OMP_BIND_PRIMARY,
+	OMP_BIND_CLOSE,
+	OMP_BIND_SPREAD
+};
+
+enum OMPPlacement{
+	OMP_PLACE_OFF,
+	OMP_PLACE_TOUCH,
+	OMP_PLACE_INTERLEAVE
+};
+
+enum OMPPipeline{
+	OMP_PIPELINE_GRAPH,
+	OMP_PIPELINE_PHASES,
+	OMP_PIPELINE_AUTO
+};
+
+//How the row tiles of one stage are spread.
+struct OMPStageSchedule{
+	OMPSchedule schedule;
+	uint32_t chunk;
+	uint32_t threads;
+};
+
+//Sets the schedules of OpenMP backends created from now on. Overrides DEPTH_OMP_SCHEDULE.
+void setOMPSchedule(
+	const char* spec
+);
+
+struct OMPDepthEstimator : DepthEstimator{
 	OMPDepthEstimator(
 		const uint32_t downsampleFactor,
 		const uint32_t windowRadius,
@@ -16,28 +126,163 @@ struct OMPDepthEstimator{
 		const char* left_name,
 		const char* right_name,
 		const char* out_name
+	) override;
+
+	void createDepthMap(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		const uint32_t outStride
+	) override;
+
+	using DepthEstimator::createDepthMap;
+
+	bool timeStages(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		double* times
+	) override;
+
+	bool countStages(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		PerfCounters* perf,
+		uint64_t* counters
+	) override;
+
+	bool capturePlanes(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		DepthPlanes* planes
+	) override;
+
+	//Applies a schedule list on top of the current schedules, see above.
+	void applySchedule(
+		const char* spec
 	);
 
-	uint32_t downsampleFactor;
-	uint32_t windowRadius;
-	unsigned char maxDisparity;
-	unsigned char maxCrossDifference;
-	uint32_t occlusionRadius;
+	OMPStageSchedule schedules[OMP_STAGES];
+	OMPProcBind procBind;
+	OMPPlacement placement;
+	uint32_t nodes;
+	OMPPipeline pipeline;
+	uint32_t tileRows;
+
+	//Whether a stage schedule was set, the automatic pipeline then runs phases.
+	bool scheduled;
 
 	private:
+	friend struct HybridDepthEstimator;
 
-	void makeImgGrey(
-		const unsigned char* img,
+	//Threads of the pipeline region.
+	uint32_t teamSize();
+
+	//Chooses the CPUs and row bands of the placement.
+	void placeThreads();
+
+	uint32_t defaultThreads();
+
+	//Row band of the calling thread of the team.
+	uint32_t threadBand();
+
+	//Allocates a plane of rows rows of rowBytes bytes placed band by band.
+	unsigned char* allocatePlane(
+		const size_t rowBytes,
+		const uint32_t rows
+	);
+
+	//Frees a plane of allocatePlane.
+	void freePlane(
+		unsigned char* plane,
+		const size_t rowBytes,
+		const uint32_t rows
+	);
+
+	void touchPlane(
+		unsigned char* plane,
+		const size_t rowBytes,
+		const uint32_t rows
+	);
+
+	//CPUs the team is pinned to in node order, and the band of each. Empty without placement.
+	std::vector<uint32_t> cpus;
+	std::vector<uint32_t> cpuBands;
+	std::vector<uint32_t> bandNodes;
+
+	//Runs body over the rows [0, rows) of a stage in tiles, opening a region if none is active.
+	template<typename Body>
+	void forTiles(
+		const OMPStage stage,
+		const uint32_t rows,
+		const Body& body
+	);
+
+	void runPipeline(
+		const unsigned char* left,
+		const unsigned char* right,
 		const uint32_t width,
 		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
 		unsigned char* out,
-		double* elapsed
+		double* times,
+		DepthPlanes* planes,
+		PerfCounters* perf
+	);
+
+	//Runs the stages after the placement as one graph of row tile tasks, see above. Called on one thread of the region.
+	void runGraph(
+		const unsigned char* const* img,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* const* grey,
+		unsigned char* const* down,
+		unsigned char* const* mean,
+		unsigned char* const* disparity,
+		unsigned char* out,
+		double* times,
+		DepthPlanes* planes
+	);
+
+	//Creates the disparity maps in row window mode, see rowWindow.hpp. Called on one thread of the region.
+	void runWindow(
+		const unsigned char* const* img,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		const uint32_t batch,
+		unsigned char* const* disparity,
+		double* times,
+		DepthPlanes* planes
 	);
 
-	void makeImgRGBA(
+	void makeImgGrey(
 		const unsigned char* img,
 		const uint32_t width,
 		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
 		unsigned char* out,
 		double* elapsed
 	);
@@ -67,6 +312,8 @@ struct OMPDepthEstimator{
 		const unsigned char* mean_1,
 		const uint32_t width,
 		const uint32_t height,
+		const uint32_t rowBegin,
+		const uint32_t rowEnd,
 		const uint32_t radius,
 		const uint32_t maxDisparity,
 		const int32_t direction,
@@ -0,0 +1,871 @@
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <omp.h>
+#include <sys/time.h>
+
+#include "util.hpp"
+#include "CLDevices.hpp"
+#include "DepthEstimator.hpp"
+#include "stereoGenerator.hpp"
+#include "trace.hpp"
+#include "OMPDepthEstimator.hpp"
+#include "rowWindow.hpp"
+
+/*--------------------------------------------------
+Benchmark harness, built with "make benchmark".
+
+Every backend runs on a synthetic stereo pair (see stereoGenerator.hpp)
+for every combination of the swept parameters. After the warmup runs each
+repetition times the whole in-memory createDepthMap and, for backends
+that support it, each of the DEPTH_STAGES stages (device time from
+profiling events for the OpenCL backends). The stages are not run in
+isolation: their times come from one timeStages pipeline run, where the
+two views share the machine or the device, so a stage time includes the
+contention with the stages that run next to it. Backends without
+timeStages (multicl, hybrid) only report the total. Every stage and
+the total get their median, 95th percentile, minimum, mean and
+coefficient of variation. Every row also carries the error of the
+depth map against the ground truth of the pair: mean absolute error,
+root mean square error and the fractions of pixels off by more than 1
+and 2, over the pixels seen by both views.
+
+With --perf the backends that support it run the repetitions again
+with hardware counters and every row gets the median of each counter,
+the instructions per cycle and the last level cache miss traffic in
+bytes per pixel the stage processes (source pixels of both views for
+greyscale and downsample, depth map pixels for the rest). Counters the
+machine does not provide are left empty.
+
+Every row records the OpenMP thread count it ran with and its speedup
+over the same backend, parameters and stage at the smallest swept
+thread count, so sweeping --threads gives the scaling curve of the
+openmp and hybrid backends. Stages that set their own thread count
+in the schedule keep it. Sweeping --numa and --nodes the same way
+gives the frames per second of every socket configuration, in the
+numa, nodes and fps columns (fps is the inverse of the median).
+
+Command line options, lists are comma separated and swept:
+	--backend=<names>: Backends to run. Default every registered backend.
+	--size=<w>x<h>: Source image sizes. Default 1280x720.
+	--downsample=<n>: Downsample factors. Default 4.
+	--window-radius=<n>: Window radii. Default 4.
+	--max-disparity=<n>: Maximum disparities. Default 64.
+	--cross-difference=<n>: Maximum cross check difference. Default 8.
+	--occlusion-radius=<n>: Occlusion fill radius. Default 8.
+	--channels=<1|4>: Grey or rgba source images. Default 4.
+	--scene=<plane|slant|steps>: Ground truth disparity field. Default slant.
+	--texture=<dots|noise>: Texture of the pair. Default noise.
+	--seed=<n>: Seed of the pair. Default 0.
+	--warmup=<n>: Untimed runs before the repetitions. Default 2.
+	--repetitions=<n>: Timed runs. Default 10.
+	--format=<csv|json>: Output format. Default csv.
+	--output=<file>: Output file. Default standard output.
+	--device=<selection>: OpenCL device, see CLDevices.hpp.
+	--conformance: Check the backends against simple instead of timing them.
+	--decode=<files>: Time loading the image files as rgba and as grey instead of running the backends.
+	--trace=<file>: Write a Chrome trace of every run, see trace.hpp.
+	--perf: Count hardware events of the stages of the CPU backends, see perfCounters.hpp.
+	--threads=<n>: OpenMP thread counts, 0 for the default. Default 0.
+	--scaling: Same as --threads=1,2,4,8,16,32,64.
+	--omp-schedule=<list>: Schedules of the openmp stages, see OMPDepthEstimator.hpp.
+	--numa=<off|touch|interleave>: NUMA placements of the openmp stages. Default the one of the schedule.
+	--nodes=<n>: NUMA nodes the placed openmp stages run on, 0 for all. Default 0.
+	--row-window=<on|off|rows>: Row window mode of the CPU backends, see rowWindow.hpp. Default off.
+
+In conformance mode every backend runs once per parameter set on the
+same pair and the output of each of its stages is compared with the
+one of the simple backend. A pixel mismatches when it differs by more
+than the allowed difference of the stage, and a stage fails when more
+than its allowed fraction of pixels mismatch. Backends that do not
+expose their stages only have their depth map compared. The simple
+reference always runs without the row window mode, so with
+--row-window the simple backend is checked against it too. The program
+exits with status 1 if any stage fails.
+
+In decode mode every file is loaded warmup + repetitions times with
+imgLoad, once asking for rgba and once for grey, the way the OpenCL
+and the CPU backends load their sources. Each row has the statistics
+of one file and channel count. Color pngs loaded as grey are converted
+while they are decoded, see imageIO.hpp.
+--------------------------------------------------*/
+
+//Summary of the samples of one stage.
+struct Stats{
+	double median;
+	double p95;
+	double min;
+	double mean;
+	double cv;
+};
+
+//One output row.
+struct Result{
+	std::string backend;
+	uint32_t width;
+	uint32_t height;
+	uint32_t downsampleFactor;
+	uint32_t windowRadius;
+	uint32_t maxDisparity;
+	uint32_t threads;
+	std::string numa;
+	uint32_t nodes;
+	std::string stage;
+	uint32_t repetitions;
+	Stats stats;
+	double speedup;
+	DisparityError error;
+	bool counted;
+	uint64_t counters[PERF_COUNTERS];
+	uint64_t pixels;
+};
+
+//One conformance output row.
+struct Conformance{
+	std::string backend;
+	uint32_t width;
+	uint32_t height;
+	uint32_t downsampleFactor;
+	uint32_t windowRadius;
+	uint32_t maxDisparity;
+	std::string stage;
+	uint32_t maxDifference;
+	double mismatch;
+	bool passed;
+};
+
+//One decode timing output row.
+struct Decode{
+	std::string file;
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels;
+	uint32_t repetitions;
+	Stats stats;
+};
+
+//Allowed difference of a pixel and fraction of mismatching pixels of a stage.
+struct Tolerance{
+	uint32_t difference;
+	double mismatch;
+};
+
+//Tolerances in stage order. The preprocessing stages may round differently,
+//the disparity search may pick another one of two almost equal windows.
+static const Tolerance stageTolerances[DEPTH_STAGES] = {
+	{1, 0.0},
+	{1, 0.0},
+	{1, 0.0},
+	{0, 0.02},
+	{0, 0.02},
+	{0, 0.02},
+	{0, 0.02}
+};
+
+//Sweep settings.
+struct Settings{
+	std::vector<std::string> backends;
+	std::vector<uint32_t> widths;
+	std::vector<uint32_t> heights;
+	std::vector<uint32_t> downsampleFactors;
+	std::vector<uint32_t> windowRadii;
+	std::vector<uint32_t> maxDisparities;
+	uint32_t crossDifference;
+	uint32_t occlusionRadius;
+	uint32_t channels;
+	StereoScene scene;
+	StereoTexture texture;
+	uint32_t seed;
+	uint32_t warmup;
+	uint32_t repetitions;
+	bool perf;
+	std::vector<uint32_t> threads;
+	std::vector<std::string> placements;
+	std::vector<uint32_t> nodes;
+	std::string schedule;
+	std::string rowWindow;
+};
+
+//Parses a comma separated list of numbers or exits.
+static std::vector<uint32_t> parseNumbers(
+	const char* option,
+	const char* list
+){
+	std::vector<uint32_t> numbers;
+	for(const std::string& item : splitList(list)){
+		char* end;
+		unsigned long value = strtoul(item.c_str(), &end, 10);
+		if(*end != '\0'){
+			printf("Could not parse %s%s\n", option, list);
+			exit(EXIT_FAILURE);
+		}
+		numbers.push_back(value);
+	}
+	return numbers;
+}
+
+//Median, 95th percentile (nearest rank), minimum, mean and coefficient of variation of the samples.
+static Stats computeStats(
+	std::vector<double> samples
+){
+	std::sort(samples.begin(), samples.end());
+	uint32_t n = samples.size();
+
+	Stats stats;
+	stats.median = n % 2 ? samples[n/2] : (samples[n/2 - 1] + samples[n/2]) / 2;
+	stats.p95 = samples[(uint32_t)ceil(0.95 * n) - 1];
+	stats.min = samples[0];
+
+	double sum = 0.0;
+	for(double sample : samples){sum += sample;}
+	stats.mean = sum / n;
+
+	double variance = 0.0;
+	for(double sample : samples){variance += (sample - stats.mean) * (sample - stats.mean);}
+	variance = n > 1 ? variance / (n - 1) : 0.0;
+	stats.cv = stats.mean > 0.0 ? sqrt(variance) / stats.mean : 0.0;
+
+	return stats;
+}
+
+//Median of counter samples, PERF_MISSING if any sample is missing.
+static uint64_t medianCounter(
+	std::vector<uint64_t> samples
+){
+	for(uint64_t sample : samples){
+		if(sample == PERF_MISSING){return PERF_MISSING;}
+	}
+	std::sort(samples.begin(), samples.end());
+	uint32_t n = samples.size();
+	return n % 2 ? samples[n/2] : (samples[n/2 - 1] + samples[n/2]) / 2;
+}
+
+//Runs one backend with one parameter set and appends its rows to results.
+static void benchmarkBackend(
+	const std::string& name,
+	const Settings& settings,
+	const std::string& numa,
+	const uint32_t nodes,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const uint32_t maxDisparity,
+	std::vector<Result>& results
+){
+	DepthEstimator* estimator = createDepthEstimator(name.c_str(), downsampleFactor, windowRadius,
+		maxDisparity, settings.crossDifference, settings.occlusionRadius);
+	if(!estimator){
+		fprintf(stderr, "Skipping %s: unknown backend, unsupported parameters or no OpenCL device.\n", name.c_str());
+		return;
+	}
+
+	uint32_t channels = settings.channels;
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
+	StereoPair pair(width, height, channels, downsampleFactor, maxDisparity,
+		settings.scene, settings.texture, settings.seed);
+	unsigned char* img[2] = {pair.left, pair.right};
+	unsigned char* out = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	for(uint32_t i=0;i<settings.warmup;i++){
+		estimator->createDepthMap(img[0], img[1], width, height, width*channels, channels, out, W);
+	}
+
+	std::vector<std::vector<double>> stageSamples(DEPTH_STAGES);
+	std::vector<double> totalSamples;
+	bool staged = true;
+	for(uint32_t i=0;i<settings.repetitions;i++){
+		double times[DEPTH_STAGES];
+
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+
+		if(staged){
+			staged = estimator->timeStages(img[0], img[1], width, height, width*channels, channels, out, times);
+		}
+		if(!staged){
+			estimator->createDepthMap(img[0], img[1], width, height, width*channels, channels, out, W);
+		}
+
+		gettimeofday(&end, NULL);
+		traceSpan(name.c_str(), "backend", start, end);
+		totalSamples.push_back((double)(end.tv_usec - start.tv_usec) / 1000000 +
+			(double)(end.tv_sec - start.tv_sec));
+
+		for(uint32_t j=0;j<DEPTH_STAGES&&staged;j++){
+			stageSamples[j].push_back(times[j]);
+		}
+	}
+
+	//Count hardware events in runs of their own, counting changes how the views overlap.
+	std::vector<std::vector<uint64_t>> counterSamples(DEPTH_STAGES*PERF_COUNTERS);
+	bool counted = settings.perf;
+	if(counted){
+		PerfCounters perf;
+		for(uint32_t i=0;i<settings.repetitions&&counted;i++){
+			uint64_t counters[DEPTH_STAGES*PERF_COUNTERS];
+			counted = estimator->countStages(img[0], img[1], width, height, width*channels, channels, out, &perf, counters);
+			for(uint32_t j=0;j<DEPTH_STAGES*PERF_COUNTERS&&counted;j++){
+				counterSamples[j].push_back(counters[j]);
+			}
+		}
+	}
+
+	//Pixels processed by every stage.
+	const uint64_t stagePixels[DEPTH_STAGES] = {
+		2ull*width*height, 2ull*width*height, 2ull*W*H, (uint64_t)W*H, (uint64_t)W*H, (uint64_t)W*H, (uint64_t)W*H
+	};
+
+	Result result = {name, width, height, downsampleFactor, windowRadius, maxDisparity, (uint32_t)omp_get_max_threads(),
+		numa, nodes, "", settings.repetitions, {}, 1.0, pair.compare(out, W), counted, {}, (uint64_t)W*H};
+	uint64_t totalCounters[PERF_COUNTERS] = {};
+	for(uint32_t j=0;j<DEPTH_STAGES&&staged;j++){
+		result.stage = depthStageNames[j];
+		result.stats = computeStats(stageSamples[j]);
+		result.pixels = stagePixels[j];
+		for(uint32_t k=0;k<PERF_COUNTERS&&counted;k++){
+			result.counters[k] = medianCounter(counterSamples[j*PERF_COUNTERS + k]);
+			totalCounters[k] = result.counters[k] == PERF_MISSING||totalCounters[k] == PERF_MISSING ?
+				PERF_MISSING : totalCounters[k] + result.counters[k];
+		}
+		results.push_back(result);
+	}
+	result.stage = "total";
+	result.stats = computeStats(totalSamples);
+	result.pixels = (uint64_t)W*H;
+	for(uint32_t k=0;k<PERF_COUNTERS;k++){
+		result.counters[k] = totalCounters[k];
+	}
+	results.push_back(result);
+
+	free(out);
+	delete estimator;
+}
+
+//Allocates the planes of one pipeline run.
+static void allocatePlanes(
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t downsampleFactor,
+	DepthPlanes* planes
+){
+	size_t len = (size_t)(width / downsampleFactor) * (height / downsampleFactor);
+	for(uint32_t i=0;i<2;i++){
+		planes->grey[i] = (unsigned char*)malloc((size_t)width*height*sizeof(unsigned char));
+		planes->down[i] = (unsigned char*)malloc(len*sizeof(unsigned char));
+		planes->mean[i] = (unsigned char*)malloc(len*sizeof(unsigned char));
+		planes->disparity[i] = (unsigned char*)malloc(len*sizeof(unsigned char));
+	}
+	planes->cross = (unsigned char*)malloc(len*sizeof(unsigned char));
+	planes->out = (unsigned char*)malloc(len*sizeof(unsigned char));
+}
+
+static void freePlanes(
+	DepthPlanes* planes
+){
+	for(uint32_t i=0;i<2;i++){
+		free(planes->grey[i]);
+		free(planes->down[i]);
+		free(planes->mean[i]);
+		free(planes->disparity[i]);
+	}
+	free(planes->cross);
+	free(planes->out);
+}
+
+//Compares one or two planes of a stage with the reference and appends the row.
+static bool compareStage(
+	Conformance row,
+	const uint32_t stage,
+	const unsigned char* const* planes,
+	const unsigned char* const* reference,
+	const uint32_t count,
+	const size_t len,
+	std::vector<Conformance>& rows
+){
+	const Tolerance& tolerance = stageTolerances[stage];
+	uint32_t maxDifference = 0;
+	size_t mismatches = 0;
+	for(uint32_t p=0;p<count;p++){
+		for(size_t i=0;i<len;i++){
+			uint32_t difference = abs((int32_t)planes[p][i] - (int32_t)reference[p][i]);
+			maxDifference = std::max(maxDifference, difference);
+			mismatches += difference > tolerance.difference;
+		}
+	}
+
+	row.stage = depthStageNames[stage];
+	row.maxDifference = maxDifference;
+	row.mismatch = len > 0 ? (double)mismatches / (count*len) : 0.0;
+	row.passed = row.mismatch <= tolerance.mismatch;
+	rows.push_back(row);
+	return row.passed;
+}
+
+//Runs one backend with one parameter set and compares its stages with the reference planes.
+//Returns false if any stage fails.
+static bool checkBackend(
+	const std::string& name,
+	const Settings& settings,
+	const StereoPair& pair,
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const uint32_t maxDisparity,
+	const DepthPlanes& reference,
+	std::vector<Conformance>& rows
+){
+	DepthEstimator* estimator = createDepthEstimator(name.c_str(), downsampleFactor, windowRadius,
+		maxDisparity, settings.crossDifference, settings.occlusionRadius);
+	if(!estimator){
+		fprintf(stderr, "Skipping %s: unknown backend, unsupported parameters or no OpenCL device.\n", name.c_str());
+		return true;
+	}
+
+	uint32_t width = pair.width;
+	uint32_t height = pair.height;
+	uint32_t channels = pair.channels;
+	size_t len = (size_t)(width / downsampleFactor) * (height / downsampleFactor);
+
+	DepthPlanes planes;
+	allocatePlanes(width, height, downsampleFactor, &planes);
+
+	Conformance row = {name, width, height, downsampleFactor, windowRadius, maxDisparity, "", 0, 0.0, true};
+	bool passed = true;
+	if(estimator->capturePlanes(pair.left, pair.right, width, height, width*channels, channels, &planes)){
+		passed &= compareStage(row, 0, planes.grey, reference.grey, 2, (size_t)width*height, rows);
+		passed &= compareStage(row, 1, planes.down, reference.down, 2, len, rows);
+		passed &= compareStage(row, 2, planes.mean, reference.mean, 2, len, rows);
+		passed &= compareStage(row, 3, &planes.disparity[0], &reference.disparity[0], 1, len, rows);
+		passed &= compareStage(row, 4, &planes.disparity[1], &reference.disparity[1], 1, len, rows);
+		passed &= compareStage(row, 5, &planes.cross, &reference.cross, 1, len, rows);
+	}else{
+		estimator->createDepthMap(pair.left, pair.right, width, height, width*channels, channels, planes.out, width / downsampleFactor);
+	}
+	passed &= compareStage(row, 6, &planes.out, &reference.out, 1, len, rows);
+
+	freePlanes(&planes);
+	delete estimator;
+	return passed;
+}
+
+//Writes the conformance rows as csv or json.
+static void writeConformance(
+	FILE* file,
+	const std::string& format,
+	const std::vector<Conformance>& rows
+){
+	if(format == "csv"){
+		fprintf(file, "backend,width,height,downsample,window_radius,max_disparity,stage,max_difference,mismatch,result\n");
+	}else{
+		fprintf(file, "[\n");
+	}
+	for(uint32_t i=0;i<rows.size();i++){
+		const Conformance& r = rows[i];
+		if(format == "csv"){
+			fprintf(file, "%s,%u,%u,%u,%u,%u,%s,%u,%.6f,%s\n",
+				r.backend.c_str(), r.width, r.height, r.downsampleFactor, r.windowRadius, r.maxDisparity,
+				r.stage.c_str(), r.maxDifference, r.mismatch, r.passed ? "pass" : "fail");
+		}else{
+			fprintf(file, "\t{\"backend\": \"%s\", \"width\": %u, \"height\": %u, \"downsample\": %u, "
+				"\"window_radius\": %u, \"max_disparity\": %u, \"stage\": \"%s\", \"max_difference\": %u, "
+				"\"mismatch\": %.6f, \"result\": \"%s\"}%s\n",
+				r.backend.c_str(), r.width, r.height, r.downsampleFactor, r.windowRadius, r.maxDisparity,
+				r.stage.c_str(), r.maxDifference, r.mismatch, r.passed ? "pass" : "fail",
+				i + 1 < rows.size() ? "," : "");
+		}
+	}
+	if(format != "csv"){
+		fprintf(file, "]\n");
+	}
+}
+
+//Times loading an image file with the given channels.
+static Decode timeDecode(
+	const std::string& name,
+	const uint32_t channels,
+	const Settings& settings
+){
+	Decode row;
+	row.file = name;
+	row.channels = channels;
+	row.repetitions = settings.repetitions;
+
+	std::vector<double> samples;
+	for(uint32_t r=0;r<settings.warmup+settings.repetitions;r++){
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+
+		uint32_t c = channels;
+		unsigned char* img;
+		imgLoad(name.c_str(), &row.width, &row.height, &c, &img);
+
+		gettimeofday(&end, NULL);
+		free(img);
+
+		if(r >= settings.warmup){
+			samples.push_back((double)(end.tv_usec - start.tv_usec) / 1000000 +
+				(double)(end.tv_sec - start.tv_sec));
+		}
+	}
+
+	row.stats = computeStats(samples);
+	return row;
+}
+
+//Writes the decode timing rows.
+static void writeDecode(
+	FILE* file,
+	const std::string& format,
+	const std::vector<Decode>& rows
+){
+	if(format == "csv"){
+		fprintf(file, "file,width,height,channels,repetitions,median_s,p95_s,min_s,mean_s,cv\n");
+	}else{
+		fprintf(file, "[\n");
+	}
+	for(uint32_t i=0;i<rows.size();i++){
+		const Decode& r = rows[i];
+		if(format == "csv"){
+			fprintf(file, "%s,%u,%u,%u,%u,%.9f,%.9f,%.9f,%.9f,%.6f\n",
+				r.file.c_str(), r.width, r.height, r.channels, r.repetitions,
+				r.stats.median, r.stats.p95, r.stats.min, r.stats.mean, r.stats.cv);
+		}else{
+			fprintf(file, "\t{\"file\": \"%s\", \"width\": %u, \"height\": %u, \"channels\": %u, \"repetitions\": %u, "
+				"\"median_s\": %.9f, \"p95_s\": %.9f, \"min_s\": %.9f, \"mean_s\": %.9f, \"cv\": %.6f}%s\n",
+				r.file.c_str(), r.width, r.height, r.channels, r.repetitions,
+				r.stats.median, r.stats.p95, r.stats.min, r.stats.mean, r.stats.cv,
+				i + 1 < rows.size() ? "," : "");
+		}
+	}
+	if(format != "csv"){
+		fprintf(file, "]\n");
+	}
+}
+
+//Counter columns of a row: the counters, instructions per cycle and last level cache miss bytes per pixel.
+//Missing values are empty in csv and null in json.
+static std::string counterColumns(
+	const Result& r,
+	const bool json
+){
+	static const char* const names[] = {"cycles", "instructions", "ipc", "l1d_misses", "llc_misses", "branch_misses", "llc_bytes_per_pixel"};
+	const uint64_t* c = r.counters;
+	bool present[7] = {
+		r.counted&&c[PERF_CYCLES] != PERF_MISSING,
+		r.counted&&c[PERF_INSTRUCTIONS] != PERF_MISSING,
+		r.counted&&c[PERF_CYCLES] != PERF_MISSING&&c[PERF_INSTRUCTIONS] != PERF_MISSING&&c[PERF_CYCLES] > 0,
+		r.counted&&c[PERF_L1D_MISSES] != PERF_MISSING,
+		r.counted&&c[PERF_LLC_MISSES] != PERF_MISSING,
+		r.counted&&c[PERF_BRANCH_MISSES] != PERF_MISSING,
+		r.counted&&c[PERF_LLC_MISSES] != PERF_MISSING&&r.pixels > 0
+	};
+	char values[7][32];
+	snprintf(values[0], 32, "%" PRIu64, c[PERF_CYCLES]);
+	snprintf(values[1], 32, "%" PRIu64, c[PERF_INSTRUCTIONS]);
+	snprintf(values[2], 32, "%.4f", present[2] ? (double)c[PERF_INSTRUCTIONS] / c[PERF_CYCLES] : 0.0);
+	snprintf(values[3], 32, "%" PRIu64, c[PERF_L1D_MISSES]);
+	snprintf(values[4], 32, "%" PRIu64, c[PERF_LLC_MISSES]);
+	snprintf(values[5], 32, "%" PRIu64, c[PERF_BRANCH_MISSES]);
+	snprintf(values[6], 32, "%.4f", present[6] ? (double)c[PERF_LLC_MISSES] * 64 / r.pixels : 0.0);
+
+	std::string columns;
+	for(uint32_t i=0;i<7;i++){
+		if(json){
+			columns += std::string(", \"") + names[i] + "\": " + (present[i] ? values[i] : "null");
+		}else{
+			columns += std::string(",") + (present[i] ? values[i] : "");
+		}
+	}
+	return columns;
+}
+
+//Sets the speedup of every row over the row of the same backend, parameters and stage with the fewest threads.
+static void computeSpeedups(
+	std::vector<Result>& results
+){
+	for(Result& r : results){
+		const Result* base = &r;
+		for(const Result& other : results){
+			if(other.backend == r.backend&&other.width == r.width&&other.height == r.height&&
+				other.downsampleFactor == r.downsampleFactor&&other.windowRadius == r.windowRadius&&
+				other.maxDisparity == r.maxDisparity&&other.numa == r.numa&&other.nodes == r.nodes&&
+				other.stage == r.stage&&other.threads < base->threads){
+				base = &other;
+			}
+		}
+		r.speedup = r.stats.median > 0.0 ? base->stats.median / r.stats.median : 1.0;
+	}
+}
+
+//Writes the results as csv with one row per backend, parameter set and stage.
+static void writeCSV(
+	FILE* file,
+	const std::vector<Result>& results
+){
+	fprintf(file, "backend,width,height,downsample,window_radius,max_disparity,threads,numa,nodes,stage,repetitions,"
+		"median_s,p95_s,min_s,mean_s,cv,speedup,fps,"
+		"mae,rmse,bad1,bad2,cycles,instructions,ipc,l1d_misses,llc_misses,branch_misses,llc_bytes_per_pixel\n");
+	for(const Result& r : results){
+		fprintf(file, "%s,%u,%u,%u,%u,%u,%u,%s,%u,%s,%u,%.9f,%.9f,%.9f,%.9f,%.6f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f%s\n",
+			r.backend.c_str(), r.width, r.height, r.downsampleFactor, r.windowRadius, r.maxDisparity, r.threads,
+			r.numa.c_str(), r.nodes, r.stage.c_str(), r.repetitions, r.stats.median, r.stats.p95, r.stats.min, r.stats.mean,
+			r.stats.cv, r.speedup, r.stats.median > 0.0 ? 1.0 / r.stats.median : 0.0,
+			r.error.mae, r.error.rmse, r.error.bad1, r.error.bad2, counterColumns(r, false).c_str());
+	}
+}
+
+//Writes the results as a json array of objects with the same fields as the csv.
+static void writeJSON(
+	FILE* file,
+	const std::vector<Result>& results
+){
+	fprintf(file, "[\n");
+	for(uint32_t i=0;i<results.size();i++){
+		const Result& r = results[i];
+		fprintf(file, "\t{\"backend\": \"%s\", \"width\": %u, \"height\": %u, \"downsample\": %u, "
+			"\"window_radius\": %u, \"max_disparity\": %u, \"threads\": %u, \"numa\": \"%s\", \"nodes\": %u, "
+			"\"stage\": \"%s\", \"repetitions\": %u, "
+			"\"median_s\": %.9f, \"p95_s\": %.9f, \"min_s\": %.9f, \"mean_s\": %.9f, \"cv\": %.6f, \"speedup\": %.4f, "
+			"\"fps\": %.4f, "
+			"\"mae\": %.4f, \"rmse\": %.4f, \"bad1\": %.4f, \"bad2\": %.4f%s}%s\n",
+			r.backend.c_str(), r.width, r.height, r.downsampleFactor, r.windowRadius, r.maxDisparity, r.threads,
+			r.numa.c_str(), r.nodes, r.stage.c_str(), r.repetitions, r.stats.median, r.stats.p95, r.stats.min, r.stats.mean,
+			r.stats.cv, r.speedup, r.stats.median > 0.0 ? 1.0 / r.stats.median : 0.0,
+			r.error.mae, r.error.rmse, r.error.bad1, r.error.bad2, counterColumns(r, true).c_str(), i + 1 < results.size() ? "," : "");
+	}
+	fprintf(file, "]\n");
+}
+
+int main(int argc, char** argv){
+	Settings settings;
+	for(const char* name : depthEstimatorNames()){
+		settings.backends.push_back(name);
+	}
+	settings.widths = {1280};
+	settings.heights = {720};
+	settings.downsampleFactors = {4};
+	settings.windowRadii = {4};
+	settings.maxDisparities = {64};
+	settings.crossDifference = 8;
+	settings.occlusionRadius = 8;
+	settings.channels = 4;
+	settings.scene = SCENE_SLANT;
+	settings.texture = TEXTURE_NOISE;
+	settings.seed = 0;
+	settings.warmup = 2;
+	settings.repetitions = 10;
+	settings.perf = false;
+	settings.threads = {0};
+	settings.placements = {"default"};
+	settings.nodes = {0};
+	std::string format = "csv";
+	std::string outputName;
+	bool conformance = false;
+	std::vector<std::string> decodeFiles;
+
+	//Parse command line options.
+	for(int i=1;i<argc;i++){
+		const char* arg = argv[i];
+		const char* value = strchr(arg, '=');
+		std::string option = value ? std::string(arg, value + 1 - arg) : arg;
+		if(value){value++;}
+
+		if(option == "--backend="){
+			settings.backends = splitList(value);
+		}else if(option == "--size="){
+			settings.widths.clear();
+			settings.heights.clear();
+			for(const std::string& size : splitList(value)){
+				uint32_t w, h;
+				if(sscanf(size.c_str(), "%ux%u", &w, &h) != 2){
+					printf("Could not parse --size=%s\n", value);
+					return 1;
+				}
+				settings.widths.push_back(w);
+				settings.heights.push_back(h);
+			}
+		}else if(option == "--downsample="){
+			settings.downsampleFactors = parseNumbers(arg, value);
+		}else if(option == "--window-radius="){
+			settings.windowRadii = parseNumbers(arg, value);
+		}else if(option == "--max-disparity="){
+			settings.maxDisparities = parseNumbers(arg, value);
+		}else if(option == "--cross-difference="){
+			settings.crossDifference = atoi(value);
+		}else if(option == "--occlusion-radius="){
+			settings.occlusionRadius = atoi(value);
+		}else if(option == "--channels="){
+			settings.channels = atoi(value);
+		}else if(option == "--scene="){
+			if(!parseStereoScene(value, &settings.scene)){
+				printf("Unknown scene: %s\n", value);
+				return 1;
+			}
+		}else if(option == "--texture="){
+			if(!parseStereoTexture(value, &settings.texture)){
+				printf("Unknown texture: %s\n", value);
+				return 1;
+			}
+		}else if(option == "--seed="){
+			settings.seed = atoi(value);
+		}else if(option == "--warmup="){
+			settings.warmup = atoi(value);
+		}else if(option == "--repetitions="){
+			settings.repetitions = std::max(1, atoi(value));
+		}else if(option == "--format="){
+			format = value;
+		}else if(option == "--output="){
+			outputName = value;
+		}else if(option == "--device="){
+			setDeviceSelection(value);
+		}else if(option == "--trace="){
+			setTraceFile(value);
+		}else if(option == "--threads="){
+			settings.threads = parseNumbers(arg, value);
+		}else if(option == "--scaling"){
+			settings.threads = {1, 2, 4, 8, 16, 32, 64};
+		}else if(option == "--omp-schedule="){
+			settings.schedule = value;
+		}else if(option == "--numa="){
+			settings.placements = splitList(value);
+		}else if(option == "--nodes="){
+			settings.nodes = parseNumbers(arg, value);
+		}else if(option == "--row-window="){
+			settings.rowWindow = value;
+			setRowWindow(value);
+		}else if(option == "--perf"){
+			settings.perf = true;
+		}else if(option == "--conformance"){
+			conformance = true;
+		}else if(option == "--decode="){
+			decodeFiles = splitList(value);
+		}else{
+			printf("Unknown option: %s\n", arg);
+			return 1;
+		}
+	}
+
+	if(settings.channels != 1&&settings.channels != 4){
+		printf("Only grey and rgba images are supported!\n");
+		return 1;
+	}
+	if(format != "csv"&&format != "json"){
+		printf("Unknown format: %s\n", format.c_str());
+		return 1;
+	}
+
+	//Schedules given on the command line, or else in the environment.
+	if(settings.schedule.empty()&&getenv("DEPTH_OMP_SCHEDULE")){
+		settings.schedule = getenv("DEPTH_OMP_SCHEDULE");
+	}
+
+	if(!settings.schedule.empty()){
+		setOMPSchedule(settings.schedule.c_str());
+	}
+
+	//Decode timing replaces the sweep.
+	std::vector<Decode> decodes;
+	for(const std::string& name : decodeFiles){
+		fprintf(stderr, "Decoding %s\n", name.c_str());
+		decodes.push_back(timeDecode(name, 4, settings));
+		decodes.push_back(timeDecode(name, 1, settings));
+	}
+
+	//Sweep every parameter combination.
+	int defaultThreads = omp_get_max_threads();
+	std::string placedSchedule;
+	std::vector<Result> results;
+	std::vector<Conformance> rows;
+	bool passed = true;
+	for(uint32_t s=0;s<settings.widths.size()&&decodeFiles.empty();s++){
+		for(uint32_t downsampleFactor : settings.downsampleFactors){
+			for(uint32_t windowRadius : settings.windowRadii){
+				for(uint32_t maxDisparity : settings.maxDisparities){
+					if(conformance){
+						StereoPair pair(settings.widths[s], settings.heights[s], settings.channels, downsampleFactor,
+							maxDisparity, settings.scene, settings.texture, settings.seed);
+
+						//Reference planes from the single threaded backend, with all of its planes.
+						setRowWindow("off");
+						DepthEstimator* reference = createDepthEstimator("simple", downsampleFactor, windowRadius,
+							maxDisparity, settings.crossDifference, settings.occlusionRadius);
+						DepthPlanes planes;
+						allocatePlanes(pair.width, pair.height, downsampleFactor, &planes);
+						reference->capturePlanes(pair.left, pair.right, pair.width, pair.height,
+							pair.width*pair.channels, pair.channels, &planes);
+						delete reference;
+						setRowWindow(settings.rowWindow.empty() ? nullptr : settings.rowWindow.c_str());
+
+						for(const std::string& name : settings.backends){
+							if(name == "simple"&&rowWindowBatch() == 0){continue;}
+							fprintf(stderr, "Checking %s %ux%u factor %u radius %u disparity %u\n", name.c_str(),
+								settings.widths[s], settings.heights[s], downsampleFactor, windowRadius, maxDisparity);
+							passed &= checkBackend(name, settings, pair, downsampleFactor, windowRadius,
+								maxDisparity, planes, rows);
+						}
+
+						freePlanes(&planes);
+						continue;
+					}
+
+					for(uint32_t threads : settings.threads){
+						omp_set_num_threads(threads ? threads : defaultThreads);
+						for(const std::string& numa : settings.placements){
+							for(uint32_t nodes : settings.nodes){
+								//Placement on top of the schedule, the backends read it when they are created.
+								placedSchedule = settings.schedule;
+								if(numa != "default"){
+									placedSchedule += ",numa=" + numa;
+								}
+								placedSchedule += ",nodes=" + std::to_string(nodes);
+								setOMPSchedule(placedSchedule.c_str());
+
+								for(const std::string& name : settings.backends){
+									fprintf(stderr, "%s %ux%u factor %u radius %u disparity %u threads %d numa %s nodes %u\n",
+										name.c_str(), settings.widths[s], settings.heights[s], downsampleFactor, windowRadius,
+										maxDisparity, omp_get_max_threads(), numa.c_str(), nodes);
+									benchmarkBackend(name, settings, numa, nodes, settings.widths[s], settings.heights[s],
+										downsampleFactor, windowRadius, maxDisparity, results);
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	FILE* file = stdout;
+	if(!outputName.empty()){
+		file = fopen(outputName.c_str(), "w");
+		if(!file){
+			printf("Could not open %s!\n", outputName.c_str());
+			return 1;
+		}
+	}
+
+	computeSpeedups(results);
+	if(!decodeFiles.empty()){
+		writeDecode(file, format, decodes);
+	}else if(conformance){
+		writeConformance(file, format, rows);
+	}else if(format == "json"){
+		writeJSON(file, results);
+	}else{
+		writeCSV(file, results);
+	}
+
+	if(file != stdout){
+		fclose(file);
+	}
+
+	return passed ? 0 : 1;
+}
@@ -6,55 +6,28 @@
 #include <cmath>
 #include <sys/time.h>
 
-ComputeApp::ComputeApp(){
-	//Error handle.
-	cl_int err = CL_SUCCESS;
-
-	//Get platforms.
-	uint32_t numPlatforms = 0;
-	err = clGetPlatformIDs(0, nullptr, &numPlatforms);
-	if(err != CL_SUCCESS){
-		std::cout<<"Could not get platform count!\n";
-		exit(EXIT_FAILURE);
-	}
-	
-	if(numPlatforms <= 0){
-		std::cout<<"No platforms found!\n";
-		exit(EXIT_FAILURE);
-	}
-
-	std::vector<cl_platform_id> platforms(numPlatforms);
-	err = clGetPlatformIDs(numPlatforms, platforms.data(), nullptr);
-	if(err != CL_SUCCESS){
-		std::cout<<"Could not get platforms!\n";
-		exit(EXIT_FAILURE);
-	}
+#include "CLDevices.hpp"
 
-	//Use the first available platform.
-	platform = platforms[0];
+ComputeApp::ComputeApp(){
+	//Use the selected device.
+	CLDevice selected = selectDevice(nullptr);
+	platform = selected.platform;
+	device = selected.device;
 
-	//Get devices.
-	uint32_t numDevices = 0;
-	err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 0, nullptr, &numDevices);
-	if(err != CL_SUCCESS){
-		std::cout<<"Could not get device count!\n";
-		exit(EXIT_FAILURE);
-	}
+	prepare();
+}
 
-	if(numDevices <= 0){
-		std::cout<<"No supported devices found!\n";
-		exit(EXIT_FAILURE);
-	}
+ComputeApp::ComputeApp(cl_platform_id platform, cl_device_id device){
+	//Use the given device.
+	this->platform = platform;
+	this->device = device;
 
-	std::vector<cl_device_id> devices(numDevices);
-	err = clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, numDevices, devices.data(), nullptr);
-	if(err != CL_SUCCESS){
-		std::cout<<"Could not get devices!\n";
-		exit(EXIT_FAILURE);
-	}
+	prepare();
+}
 
-	//Use the first suitable device.
-	device = devices[0];
+void ComputeApp::prepare(){
+	//Error handle.
+	cl_int err = CL_SUCCESS;
 
 	//Create context.
 	context = clCreateContext(0, 1, &device, nullptr, nullptr, &err);
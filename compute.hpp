@@ -7,8 +7,11 @@
 
 struct ComputeApp{
 	ComputeApp();
+	ComputeApp(cl_platform_id platform, cl_device_id device);
 	~ComputeApp();
 
+	void prepare();
+
 	void sqMatrixProduct(
 		float* a,
 		float* b,
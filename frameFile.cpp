@@ -0,0 +1,202 @@
+#include "frameFile.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "util.hpp"
+
+#define FRAME_HEADER_FIELDS 16
+#define FRAME_MAGIC 0x52465453 //"STFR" read as little endian.
+#define FRAME_VERSION 1
+#define FRAME_ALIGNMENT 4096
+
+//Reads a little endian uint32 from the header.
+static uint32_t headerField(
+	const unsigned char* header,
+	const uint32_t index
+){
+	const unsigned char* p = header + index*4;
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//Maps a frame file into memory and validates its header.
+FrameFile::FrameFile(
+	const char* filename
+){
+	fd = open(filename, O_RDONLY);
+	if(fd < 0){
+		printf("Could not open %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	struct stat info;
+	if(fstat(fd, &info) != 0||(size_t)info.st_size < FRAME_HEADER_FIELDS*4){
+		printf("%s is not a frame file!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	size = info.st_size;
+
+	data = (unsigned char*)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+	if(data == MAP_FAILED){
+		printf("Could not map %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	//Frames are normally walked from first to last.
+	madvise(data, size, MADV_SEQUENTIAL);
+
+	if(headerField(data, 0) != FRAME_MAGIC||headerField(data, 1) != FRAME_VERSION){
+		printf("%s is not a frame file!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	width = headerField(data, 2);
+	height = headerField(data, 3);
+	channels = headerField(data, 4);
+	stride = headerField(data, 5);
+	frameCount = headerField(data, 6);
+	layout = headerField(data, 7);
+	offset = headerField(data, 8);
+
+	if((channels != 1&&channels != 4)||stride < (size_t)width*channels||layout > FRAME_PLANAR||offset < FRAME_HEADER_FIELDS*4){
+		printf("Unsupported frame file header in %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	//Both views of every frame must fit behind the offset. Divides instead of multiplying so no header overflows.
+	imageBytes = (size_t)stride*height;
+	if(offset > size||(imageBytes > 0&&2*(size_t)frameCount > (size - offset) / imageBytes)){
+		printf("%s is truncated!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+FrameFile::~FrameFile(){
+	munmap(data, size);
+	close(fd);
+}
+
+//Image by its position in the file.
+const unsigned char* FrameFile::image(
+	const size_t index
+){
+	return data + offset + index*imageBytes;
+}
+
+//Left image of a frame.
+const unsigned char* FrameFile::left(
+	const uint32_t frame
+){
+	return image(layout == FRAME_PLANAR ? frame : 2*(size_t)frame);
+}
+
+//Right image of a frame.
+const unsigned char* FrameFile::right(
+	const uint32_t frame
+){
+	return image(layout == FRAME_PLANAR ? (size_t)frameCount + frame : 2*(size_t)frame + 1);
+}
+
+//Starts paging in both images of a frame.
+void FrameFile::prefetch(
+	const uint32_t frame
+){
+	if(frame >= frameCount){return;}
+
+	const unsigned char* images[2] = {left(frame), right(frame)};
+	for(const unsigned char* img : images){
+		//madvise needs a page aligned start.
+		size_t begin = (img - data) & ~(size_t)(FRAME_ALIGNMENT - 1);
+		madvise(data + begin, img - data - begin + imageBytes, MADV_WILLNEED);
+	}
+}
+
+//Writes a little endian uint32 into the header.
+static void setHeaderField(
+	unsigned char* header,
+	const uint32_t index,
+	const uint32_t value
+){
+	unsigned char* p = header + index*4;
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+//Packs pairs of image files into a frame file with packed rows.
+void packFrameFile(
+	const char* filename,
+	const std::vector<std::string>& leftNames,
+	const std::vector<std::string>& rightNames,
+	const uint32_t channels,
+	const uint32_t layout
+){
+	if(leftNames.size() != rightNames.size()||leftNames.empty()){
+		printf("Frame files need the same number of left and right images!\n");
+		exit(EXIT_FAILURE);
+	}
+	uint32_t frames = leftNames.size();
+
+	FILE* file = fopen(filename, "wb");
+	if(!file){
+		printf("Could not open %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	//Images in file order.
+	std::vector<const std::string*> order;
+	for(uint32_t i=0;i<frames;i++){
+		if(layout == FRAME_PLANAR){
+			order.push_back(&leftNames[i]);
+		}else{
+			order.push_back(&leftNames[i]);
+			order.push_back(&rightNames[i]);
+		}
+	}
+	if(layout == FRAME_PLANAR){
+		for(uint32_t i=0;i<frames;i++){
+			order.push_back(&rightNames[i]);
+		}
+	}
+
+	uint32_t width = 0, height = 0;
+	for(uint32_t i=0;i<order.size();i++){
+		unsigned char* img;
+		uint32_t w, h, c = channels;
+		imgLoad(order[i]->c_str(), &w, &h, &c, &img);
+
+		//The header and its padding go in front of the first image.
+		if(i == 0){
+			width = w;
+			height = h;
+
+			unsigned char header[FRAME_ALIGNMENT] = {};
+			setHeaderField(header, 0, FRAME_MAGIC);
+			setHeaderField(header, 1, FRAME_VERSION);
+			setHeaderField(header, 2, width);
+			setHeaderField(header, 3, height);
+			setHeaderField(header, 4, channels);
+			setHeaderField(header, 5, width*channels);
+			setHeaderField(header, 6, frames);
+			setHeaderField(header, 7, layout);
+			setHeaderField(header, 8, FRAME_ALIGNMENT);
+			fwrite(header, 1, FRAME_ALIGNMENT, file);
+		}else if(w != width||h != height){
+			printf("%s does not match the size of the first frame!\n", order[i]->c_str());
+			exit(EXIT_FAILURE);
+		}
+
+		if(fwrite(img, 1, (size_t)w*h*c, file) != (size_t)w*h*c){
+			printf("Could not write %s!\n", filename);
+			exit(EXIT_FAILURE);
+		}
+		free(img);
+	}
+
+	fclose(file);
+}
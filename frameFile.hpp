@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*--------------------------------------------------
+Raw stereo frame files, read through mmap so the estimators work
+straight from the page cache without a copy per frame.
+
+Header, 64 bytes of little endian uint32 fields:
+	0: Magic "STFR".
+	1: Version, 1.
+	2: Width in pixels.
+	3: Height in pixels.
+	4: Channels, 1 (grey) or 4 (rgba).
+	5: Stride, bytes between rows (at least width * channels).
+	6: Number of stereo frames.
+	7: Layout, 0 for interleaved (L0 R0 L1 R1 ...) or 1 for planar (L0 L1 ... R0 R1 ...).
+	8: Offset of the first image from the start of the file.
+	9-15: Reserved, zero.
+
+Every image is stride * height bytes and images follow each other
+without padding. Frame files are written with the first image at a
+page boundary.
+--------------------------------------------------*/
+
+enum FrameLayout{
+	FRAME_INTERLEAVED = 0,
+	FRAME_PLANAR = 1
+};
+
+struct FrameFile{
+	FrameFile(
+		const char* filename
+	);
+	~FrameFile();
+
+	//Left and right images of a frame, pointing into the mapped file.
+	const unsigned char* left(
+		const uint32_t frame
+	);
+
+	const unsigned char* right(
+		const uint32_t frame
+	);
+
+	//Asks the kernel to start reading a frame ahead of use.
+	void prefetch(
+		const uint32_t frame
+	);
+
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels;
+	uint32_t stride;
+	uint32_t frameCount;
+	uint32_t layout;
+
+	private:
+
+	const unsigned char* image(
+		const size_t index
+	);
+
+	int fd;
+	unsigned char* data;
+	size_t size;
+	size_t offset;
+	size_t imageBytes;
+};
+
+//Packs pairs of image files into a frame file. Every image is converted to the given channels.
+void packFrameFile(
+	const char* filename,
+	const std::vector<std::string>& leftNames,
+	const std::vector<std::string>& rightNames,
+	const uint32_t channels,
+	const uint32_t layout
+);
@@ -0,0 +1,690 @@
+#include "imageIO.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <zlib.h>
+
+#include "lodepng.h"
+
+//Returns the extension of a file name without the dot, or an empty string.
+static std::string fileExtension(
+	const char* filename
+){
+	const char* dot = strrchr(filename, '.');
+	const char* slash = strrchr(filename, '/');
+	if(!dot||(slash&&dot < slash)){return "";}
+
+	std::string ext(dot + 1);
+	std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+	return ext;
+}
+
+//Opens a file or exits.
+static FILE* openFile(
+	const char* filename,
+	const char* mode
+){
+	FILE* file = fopen(filename, mode);
+	if(!file){
+		printf("Could not open %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	return file;
+}
+
+//Reads exactly len bytes or exits.
+static void readBytes(
+	FILE* file,
+	const char* filename,
+	void* data,
+	size_t len
+){
+	if(fread(data, 1, len, file) != len){
+		printf("Unexpected end of file in %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Writes exactly len bytes or exits.
+static void writeBytes(
+	FILE* file,
+	const char* filename,
+	const void* data,
+	size_t len
+){
+	if(fwrite(data, 1, len, file) != len){
+		printf("Could not write %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Grey value of an rgb pixel. Same float luminance, truncated, as the greyscale stage of the backends,
+//so images converted on load give the same depth maps as rgba images converted by the pipeline.
+static unsigned char luminance(
+	const unsigned char* p
+){
+	return (unsigned int)(
+		p[0] * 0.2126f +
+		p[1] * 0.7152f +
+		p[2] * 0.0722f
+	);
+}
+
+//Scales a sample in the range 0-maxval to 8 bits, rounding to the nearest value.
+static unsigned char scaleSample(
+	const uint32_t value,
+	const uint32_t maxval
+){
+	return maxval == 255 ? value : (value * 255 + maxval / 2) / maxval;
+}
+
+//Converts between grey, rgb and rgba. The grey value of a color is its luminance.
+void convertChannels(
+	const unsigned char* image,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const uint32_t outChannels,
+	unsigned char* out
+){
+	size_t N = (size_t)width * height;
+	for(size_t i=0;i<N;i++){
+		const unsigned char* p = image + i*channels;
+		unsigned char* q = out + i*outChannels;
+
+		if(outChannels == 1){
+			q[0] = channels == 1 ? p[0] : luminance(p);
+		}else{
+			for(uint32_t j=0;j<3;j++){
+				q[j] = channels == 1 ? p[0] : p[j];
+			}
+			if(outChannels == 4){
+				q[3] = channels == 4 ? p[3] : 255;
+			}
+		}
+	}
+}
+
+//Inflates a zlib stream with the system zlib, used by lodepng through its custom_zlib hook.
+//The context holds the expected size of the output, which is grown if it turns out too small.
+static unsigned zlibInflate(
+	unsigned char** out,
+	size_t* outsize,
+	const unsigned char* in,
+	size_t insize,
+	const LodePNGDecompressSettings* settings
+){
+	size_t capacity = *(const size_t*)settings->custom_context;
+	if(capacity == 0){capacity = insize * 4;}
+	unsigned char* data = (unsigned char*)malloc(capacity);
+
+	z_stream stream = {};
+	stream.next_in = (Bytef*)in;
+	stream.avail_in = insize;
+	if(!data||inflateInit(&stream) != Z_OK){
+		free(data);
+		return 1;
+	}
+
+	int result = Z_OK;
+	size_t size = 0;
+	while(result == Z_OK){
+		if(size == capacity){
+			capacity *= 2;
+			unsigned char* grown = (unsigned char*)realloc(data, capacity);
+			if(!grown){break;}
+			data = grown;
+		}
+		stream.next_out = data + size;
+		stream.avail_out = capacity - size;
+		result = inflate(&stream, Z_NO_FLUSH);
+		size = capacity - stream.avail_out;
+	}
+	inflateEnd(&stream);
+
+	if(result != Z_STREAM_END){
+		free(data);
+		return 1;
+	}
+	*out = data;
+	*outsize = size;
+	return 0;
+}
+
+//Reverses the png filter of a scanline in place. prev is the unfiltered previous scanline, or zeros.
+static bool unfilterRow(
+	unsigned char* row,
+	const unsigned char* prev,
+	const uint32_t filter,
+	const uint32_t len,
+	const uint32_t bpp
+){
+	switch(filter){
+		case 0: break;
+		case 1:
+			for(uint32_t i=bpp;i<len;i++){row[i] += row[i-bpp];}
+			break;
+		case 2:
+			for(uint32_t i=0;i<len;i++){row[i] += prev[i];}
+			break;
+		case 3:
+			for(uint32_t i=0;i<bpp;i++){row[i] += prev[i] >> 1;}
+			for(uint32_t i=bpp;i<len;i++){row[i] += (row[i-bpp] + prev[i]) >> 1;}
+			break;
+		case 4:
+			for(uint32_t i=0;i<bpp;i++){row[i] += prev[i];}
+			for(uint32_t i=bpp;i<len;i++){
+				int a = row[i-bpp], b = prev[i], c = prev[i-bpp];
+				int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2*c);
+				row[i] += (pa <= pb&&pa <= pc) ? a : (pb <= pc ? b : c);
+			}
+			break;
+		default: return false;
+	}
+	return true;
+}
+
+//Decodes an 8bit rgb or rgba png straight into grey. Each scanline is inflated, unfiltered and
+//converted on its own, so the full color image never exists in memory. Returns false on errors.
+static bool pngReadGrey(
+	const unsigned char* png,
+	const size_t size,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t bpp,
+	unsigned char* out
+){
+	//Find the compressed data, which may be split over several IDAT chunks.
+	std::vector<unsigned char> idat;
+	const unsigned char* end = png + size;
+	for(const unsigned char* chunk = png + 8;chunk + 12 <= end;chunk = lodepng_chunk_next_const(chunk, end)){
+		uint32_t len = lodepng_chunk_length(chunk);
+		if(len > (size_t)(end - chunk) - 12){return false;}
+
+		//Chunk crc covers the type and the data.
+		const unsigned char* c = chunk + 8 + len;
+		uint32_t crc = ((uint32_t)c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
+		if(crc32(0, chunk + 4, len + 4) != crc){return false;}
+
+		if(lodepng_chunk_type_equals(chunk, "IDAT")){
+			const unsigned char* data = lodepng_chunk_data_const(chunk);
+			idat.insert(idat.end(), data, data + len);
+		}else if(lodepng_chunk_type_equals(chunk, "IEND")){
+			break;
+		}
+	}
+
+	z_stream stream = {};
+	stream.next_in = idat.data();
+	stream.avail_in = idat.size();
+	if(inflateInit(&stream) != Z_OK){return false;}
+
+	//Scanlines are a filter byte followed by the pixels.
+	uint32_t len = width * bpp;
+	std::vector<unsigned char> rows(2*(len + 1), 0);
+	unsigned char* line = rows.data();
+	unsigned char* prev = rows.data() + len + 1;
+
+	bool ok = true;
+	for(uint32_t j=0;j<height&&ok;j++){
+		stream.next_out = line;
+		stream.avail_out = len + 1;
+		int result = inflate(&stream, Z_SYNC_FLUSH);
+		ok = (result == Z_OK||result == Z_STREAM_END)&&stream.avail_out == 0;
+		ok = ok&&unfilterRow(line + 1, prev + 1, line[0], len, bpp);
+
+		for(uint32_t i=0;i<width&&ok;i++){
+			const unsigned char* p = line + 1 + i*bpp;
+			out[(size_t)j*width + i] = luminance(p);
+		}
+		std::swap(line, prev);
+	}
+	inflateEnd(&stream);
+	return ok;
+}
+
+//Decodes a png image using lodepng with the zlib inflater. Grey images stay grey, everything else is
+//expanded to rgba, unless grey is asked for and the image is 8bit rgb or rgba without interlacing,
+//in which case it is decoded straight into grey.
+static void pngRead(
+	const char* filename,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	unsigned char** image
+){
+	unsigned char* png = nullptr;
+	size_t size = 0;
+	unsigned error = lodepng_load_file(&png, &size, filename);
+
+	LodePNGState state;
+	lodepng_state_init(&state);
+	if(!error){
+		error = lodepng_inspect(width, height, &state, png, size);
+	}
+
+	const LodePNGColorMode& color = state.info_png.color;
+	bool color8 = color.bitdepth == 8&&(color.colortype == LCT_RGB||color.colortype == LCT_RGBA);
+	if(!error&&*channels == 1&&color8&&state.info_png.interlace_method == 0){
+		*image = (unsigned char*)malloc((size_t)*width * *height);
+		if(!pngReadGrey(png, size, *width, *height, color.colortype == LCT_RGB ? 3 : 4, *image)){
+			printf("Could not decode %s!\n", filename);
+			exit(EXIT_FAILURE);
+		}
+	}else if(!error){
+		bool grey = color.colortype == LCT_GREY;
+		*channels = grey ? 1 : 4;
+
+		//Size of the filtered scanlines, used to size the inflate buffer.
+		size_t expected = (size_t)*height * (1 + ((size_t)*width * lodepng_get_bpp(&color) + 7) / 8);
+		state.decoder.zlibsettings.custom_zlib = zlibInflate;
+		state.decoder.zlibsettings.custom_context = &expected;
+		state.info_raw.colortype = grey ? LCT_GREY : LCT_RGBA;
+		state.info_raw.bitdepth = 8;
+		error = lodepng_decode(image, width, height, &state, png, size);
+	}
+
+	lodepng_state_cleanup(&state);
+	free(png);
+	if(error){
+		printf("%s\n", lodepng_error_text(error));
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Png encoder settings.
+struct PngProfile{
+	const char* name;
+	unsigned btype;
+	unsigned windowsize;
+	unsigned lazymatching;
+	unsigned nicematch;
+	LodePNGFilterStrategy filter;
+	unsigned autoConvert;
+};
+
+//Every png encoder profile. The first one is lodepng's default.
+static const PngProfile pngProfiles[] = {
+	{"default", 2, 2048, 1, 128, LFS_MINSUM, 1},
+	{"fast", 2, 256, 0, 16, LFS_TWO, 0},
+	{"store", 0, 2048, 0, 128, LFS_ZERO, 0}
+};
+
+//Chosen profile, or nullptr until the first png is written.
+static const PngProfile* pngProfile = nullptr;
+
+//Chooses the png encoder profile by name. Returns false for unknown names.
+bool setPngProfile(
+	const char* name
+){
+	for(const PngProfile& profile : pngProfiles){
+		if(strcmp(profile.name, name) == 0){
+			pngProfile = &profile;
+			return true;
+		}
+	}
+	return false;
+}
+
+//Current png encoder profile. Unless one was chosen it comes from DEPTH_PNG_PROFILE.
+static const PngProfile* currentPngProfile(){
+	if(!pngProfile){
+		pngProfile = &pngProfiles[0];
+		const char* env = getenv("DEPTH_PNG_PROFILE");
+		if(env&&!setPngProfile(env)){
+			printf("Unknown png profile: %s!\n", env);
+			exit(EXIT_FAILURE);
+		}
+	}
+	return pngProfile;
+}
+
+//Encodes a grey or rgba image as png using lodepng and the current encoder profile.
+static void pngWrite(
+	const char* filename,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const unsigned char* image
+){
+	const PngProfile* profile = currentPngProfile();
+	LodePNGColorType type = channels == 1 ? LCT_GREY : LCT_RGBA;
+
+	LodePNGState state;
+	lodepng_state_init(&state);
+	state.info_raw.colortype = type;
+	state.info_raw.bitdepth = 8;
+	state.info_png.color.colortype = type;
+	state.info_png.color.bitdepth = 8;
+	state.encoder.zlibsettings.btype = profile->btype;
+	state.encoder.zlibsettings.windowsize = profile->windowsize;
+	state.encoder.zlibsettings.lazymatching = profile->lazymatching;
+	state.encoder.zlibsettings.nicematch = profile->nicematch;
+	state.encoder.filter_strategy = profile->filter;
+	state.encoder.auto_convert = profile->autoConvert;
+
+	unsigned char* png = nullptr;
+	size_t size = 0;
+	unsigned error = lodepng_encode(&png, &size, image, width, height, &state);
+	if(!error){
+		error = lodepng_save_file(png, size, filename);
+	}
+
+	lodepng_state_cleanup(&state);
+	free(png);
+	if(error){
+		printf("%s\n", lodepng_error_text(error));
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Reads the next number of a PNM header, skipping whitespace and comments.
+static uint32_t pnmNumber(
+	FILE* file,
+	const char* filename
+){
+	int c = fgetc(file);
+	while(c != EOF&&(isspace(c)||c == '#')){
+		if(c == '#'){
+			while(c != EOF&&c != '\n'){c = fgetc(file);}
+		}
+		c = fgetc(file);
+	}
+
+	uint32_t value = 0;
+	if(!isdigit(c)){
+		printf("Invalid PNM header in %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	while(isdigit(c)){
+		value = value * 10 + (c - '0');
+		c = fgetc(file);
+	}
+	return value;
+}
+
+//Reads a binary grey (P5) or rgb (P6) PNM image. Rgb images are expanded to rgba.
+static void pnmRead(
+	const char* filename,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	unsigned char** image
+){
+	FILE* file = openFile(filename, "rb");
+
+	char magic[2];
+	readBytes(file, filename, magic, 2);
+	if(magic[0] != 'P'||(magic[1] != '5'&&magic[1] != '6')){
+		printf("Only binary PGM and PPM images are supported: %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	uint32_t w = pnmNumber(file, filename);
+	uint32_t h = pnmNumber(file, filename);
+	uint32_t maxval = pnmNumber(file, filename);
+	if(maxval == 0||maxval > 65535){
+		printf("Invalid PNM maxval in %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	uint32_t samples = magic[1] == '5' ? 1 : 3;
+	uint32_t bytes = maxval > 255 ? 2 : 1;
+	std::vector<unsigned char> data((size_t)w*h*samples*bytes);
+	readBytes(file, filename, data.data(), data.size());
+	fclose(file);
+
+	//Scale samples to 8 bits. 16bit samples are big endian.
+	std::vector<unsigned char> pixels((size_t)w*h*samples);
+	for(size_t i=0;i<pixels.size();i++){
+		uint32_t value = bytes == 2 ? (data[i*2] << 8 | data[i*2+1]) : data[i];
+		pixels[i] = scaleSample(value, maxval);
+	}
+
+	*width = w;
+	*height = h;
+	*channels = samples == 1 ? 1 : 4;
+	*image = (unsigned char*)malloc((size_t)w*h*(*channels));
+	convertChannels(pixels.data(), w, h, samples, *channels, *image);
+}
+
+//Writes a grey image as binary PGM and an rgba image as binary PPM.
+static void pnmWrite(
+	const char* filename,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const unsigned char* image
+){
+	//The extension decides between grey and color.
+	uint32_t samples = fileExtension(filename) == "ppm" ? 3 : 1;
+	std::vector<unsigned char> pixels((size_t)width*height*samples);
+	convertChannels(image, width, height, channels, samples, pixels.data());
+
+	FILE* file = openFile(filename, "wb");
+	fprintf(file, "P%c\n%u %u\n255\n", samples == 1 ? '5' : '6', width, height);
+	writeBytes(file, filename, pixels.data(), pixels.size());
+	fclose(file);
+}
+
+//Parses the dimensions of a raw image from a file name such as left.640x480.raw.
+static void rawSize(
+	const char* filename,
+	uint32_t* width,
+	uint32_t* height
+){
+	std::string name(filename);
+	size_t ext = name.rfind('.');
+	size_t dims = ext == std::string::npos||ext == 0 ? std::string::npos : name.rfind('.', ext - 1);
+
+	if(dims == std::string::npos||sscanf(name.c_str() + dims + 1, "%ux%u", width, height) != 2){
+		printf("Raw image names must end with the dimensions, eg. left.640x480.raw: %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+//Reads 8bit grey samples without a header.
+static void rawRead(
+	const char* filename,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	unsigned char** image
+){
+	rawSize(filename, width, height);
+	*channels = 1;
+
+	FILE* file = openFile(filename, "rb");
+	*image = (unsigned char*)malloc((size_t)*width * *height);
+	readBytes(file, filename, *image, (size_t)*width * *height);
+	fclose(file);
+}
+
+//Writes 8bit grey samples without a header.
+static void rawWrite(
+	const char* filename,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const unsigned char* image
+){
+	std::vector<unsigned char> pixels((size_t)width*height);
+	convertChannels(image, width, height, channels, 1, pixels.data());
+
+	FILE* file = openFile(filename, "wb");
+	writeBytes(file, filename, pixels.data(), pixels.size());
+	fclose(file);
+}
+
+//Reads 16bit little endian grey samples without a header, scaled to 8 bits like 16bit PNM samples.
+static void raw16Read(
+	const char* filename,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	unsigned char** image
+){
+	rawSize(filename, width, height);
+	*channels = 1;
+
+	size_t N = (size_t)*width * *height;
+	std::vector<unsigned char> data(N*2);
+	FILE* file = openFile(filename, "rb");
+	readBytes(file, filename, data.data(), data.size());
+	fclose(file);
+
+	*image = (unsigned char*)malloc(N);
+	for(size_t i=0;i<N;i++){
+		(*image)[i] = scaleSample(data[i*2] | data[i*2+1] << 8, 65535);
+	}
+}
+
+//Writes 16bit little endian grey samples without a header. Samples are scaled by 257 to span the full range.
+static void raw16Write(
+	const char* filename,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const unsigned char* image
+){
+	size_t N = (size_t)width * height;
+	std::vector<unsigned char> pixels(N);
+	convertChannels(image, width, height, channels, 1, pixels.data());
+
+	std::vector<unsigned char> data(N*2);
+	for(size_t i=0;i<N;i++){
+		data[i*2] = pixels[i];
+		data[i*2+1] = pixels[i];
+	}
+
+	FILE* file = openFile(filename, "wb");
+	writeBytes(file, filename, data.data(), data.size());
+	fclose(file);
+}
+
+//Reads a grey (Pf) or rgb (PF) portable float map. Samples are clamped to 0-255, rgb is expanded to rgba.
+static void pfmRead(
+	const char* filename,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	unsigned char** image
+){
+	FILE* file = openFile(filename, "rb");
+
+	char magic[3] = {};
+	uint32_t w, h;
+	float scale;
+	if(fscanf(file, "%2s %u %u %f", magic, &w, &h, &scale) != 4||magic[0] != 'P'||(magic[1] != 'f'&&magic[1] != 'F')){
+		printf("Invalid PFM header in %s!\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	fgetc(file);
+
+	uint32_t samples = magic[1] == 'f' ? 1 : 3;
+	std::vector<float> data((size_t)w*h*samples);
+	readBytes(file, filename, data.data(), data.size()*sizeof(float));
+	fclose(file);
+
+	//A positive scale means big endian samples.
+	if(scale > 0.0f){
+		for(float& value : data){
+			unsigned char* b = (unsigned char*)&value;
+			std::swap(b[0], b[3]);
+			std::swap(b[1], b[2]);
+		}
+	}
+
+	//Rows are stored from the bottom up.
+	std::vector<unsigned char> pixels((size_t)w*h*samples);
+	for(uint32_t j=0;j<h;j++){
+		for(uint32_t i=0;i<w*samples;i++){
+			float value = data[(size_t)(h-1-j)*w*samples + i];
+			pixels[(size_t)j*w*samples + i] = std::isfinite(value) ? (unsigned char)std::clamp(std::round(value), 0.0f, 255.0f) : 0;
+		}
+	}
+
+	*width = w;
+	*height = h;
+	*channels = samples == 1 ? 1 : 4;
+	*image = (unsigned char*)malloc((size_t)w*h*(*channels));
+	convertChannels(pixels.data(), w, h, samples, *channels, *image);
+}
+
+//Writes a grey image as Pf and an rgba image as PF portable float map, little endian.
+static void pfmWrite(
+	const char* filename,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const unsigned char* image
+){
+	uint32_t samples = channels == 1 ? 1 : 3;
+	std::vector<unsigned char> pixels((size_t)width*height*samples);
+	convertChannels(image, width, height, channels, samples, pixels.data());
+
+	//Rows are stored from the bottom up.
+	std::vector<float> data(pixels.size());
+	for(uint32_t j=0;j<height;j++){
+		for(uint32_t i=0;i<width*samples;i++){
+			data[(size_t)(height-1-j)*width*samples + i] = pixels[(size_t)j*width*samples + i];
+		}
+	}
+
+	FILE* file = openFile(filename, "wb");
+	fprintf(file, "P%c\n%u %u\n-1.0\n", samples == 1 ? 'f' : 'F', width, height);
+	writeBytes(file, filename, data.data(), data.size()*sizeof(float));
+	fclose(file);
+}
+
+//Every registered format, starting with the built in ones.
+static std::vector<ImageFormat>& formats(){
+	static std::vector<ImageFormat> entries = {
+		{"png", pngRead, pngWrite},
+		{"pgm", pnmRead, pnmWrite},
+		{"ppm", pnmRead, pnmWrite},
+		{"raw", rawRead, rawWrite},
+		{"raw16", raw16Read, raw16Write},
+		{"pfm", pfmRead, pfmWrite}
+	};
+	return entries;
+}
+
+//Adds an image format, replacing any format with the same extension.
+void registerImageFormat(
+	const char* extension,
+	ImageReader read,
+	ImageWriter write
+){
+	std::vector<ImageFormat>& entries = formats();
+	for(uint32_t i=0;i<entries.size();i++){
+		if(strcmp(entries[i].extension, extension) == 0){
+			entries[i].read = read;
+			entries[i].write = write;
+			return;
+		}
+	}
+	entries.push_back({extension, read, write});
+}
+
+//Chooses the format of a file by its extension. Exits on unknown extensions.
+const ImageFormat* findImageFormat(
+	const char* filename
+){
+	std::string ext = fileExtension(filename);
+	for(const ImageFormat& format : formats()){
+		if(ext == format.extension){
+			return &format;
+		}
+	}
+
+	printf("Unknown image format: %s!\n", filename);
+	exit(EXIT_FAILURE);
+}
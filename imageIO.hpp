@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cinttypes>
+
+/*--------------------------------------------------
+Image file formats, selected by the file extension:
+	.png         : lodepng with the zlib inflater, grey or rgba.
+	.pgm, .ppm   : Binary PNM (P5, P6), 8 or 16 bits per sample.
+	.raw         : 8bit grey samples without a header.
+	.raw16       : 16bit little endian grey samples without a header.
+	.pfm         : Portable float map, grey (Pf) or rgb (PF).
+
+Raw files carry no size, so their names must end with the
+dimensions, eg. left.640x480.raw. 16bit samples are scaled to
+8 bits on load, rounding to the nearest value, and back on write.
+PFM samples hold pixel values in the range 0-255. Files without a
+known extension are rejected.
+
+Color images loaded as grey use the same truncated float luminance
+as the greyscale stage of the backends.
+
+Images in memory are 8bit grey (1 channel) or rgba (4 channels).
+
+Png encoder profiles, chosen with setPngProfile or DEPTH_PNG_PROFILE:
+	default : lodepng defaults, best compression.
+	fast    : Up filter on every row, 256 byte window, no lazy matching.
+	store   : Uncompressed deflate blocks, no filter.
+--------------------------------------------------*/
+
+//Readers get the wanted channels (0 for any) and set the channels they produced,
+//which imgLoad converts if they still differ.
+typedef void (*ImageReader)(
+	const char* filename,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	unsigned char** image
+);
+
+typedef void (*ImageWriter)(
+	const char* filename,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const unsigned char* image
+);
+
+//An image file format and its reader and writer.
+struct ImageFormat{
+	const char* extension;
+	ImageReader read;
+	ImageWriter write;
+};
+
+void registerImageFormat(
+	const char* extension,
+	ImageReader read,
+	ImageWriter write
+);
+
+const ImageFormat* findImageFormat(
+	const char* filename
+);
+
+void convertChannels(
+	const unsigned char* image,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const uint32_t outChannels,
+	unsigned char* out
+);
+
+bool setPngProfile(
+	const char* name
+);
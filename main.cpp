@@ -3,14 +3,22 @@
 #include <string>
 #include <vector>
 #include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <time.h>
+#include <sys/time.h>
 
 #include "util.hpp"
 #include "compute.hpp"
-#include "simpleDepthEstimator.hpp"
+#include "CLDevices.hpp"
+#include "DepthEstimator.hpp"
+#include "frameFile.hpp"
+#include "imageIO.hpp"
+#include "trace.hpp"
 #include "OMPDepthEstimator.hpp"
-#include "CLDepthEstimator.hpp"
-#include "CLDepthEstimator2.hpp"
+#include "rowWindow.hpp"
+#include "roofline.hpp"
 
 /*--------------------------------------------------
 Constructor arguments:
@@ -19,9 +27,234 @@ Constructor arguments:
 	3: Maximum disparity value for the disparity maps.
 	4: Maximum permitted difference in the cross check calculation.
 	5: Radius of the window patch in the occlusion fill calculation.
+
+Command line options:
+	--device=<selection>: OpenCL device to use, see CLDevices.hpp for the selection strings.
+	--list-devices: Print the available OpenCL devices and exit.
+	--backend=<names>: Comma separated depth estimator backends to run, see DepthEstimator.hpp for the names.
+		fastest times every backend on a frame of the source size and runs the fastest one.
+	--list-backends: Print the available backends and exit.
+	--left=<file>, --right=<file>: Source images, see imageIO.hpp for the formats. Default im0.png and im1.png.
+	--out-format=<extension>: Format of the <backend>_out depth maps. Default png.
+	--strip-rows=<n>: Process the images in strips of n depth map rows, see DepthEstimator::createDepthMapTiled.
+	--roi=<x>,<y>,<w>,<h>[/...]: Only compute the depth map inside these rectangles of depth map pixels.
+	--png-profile=<default|fast|store>: Png encoder profile, see imageIO.hpp.
+	--trace=<file>: Write a Chrome trace of the run, see trace.hpp. Also DEPTH_TRACE=<file>.
+	--omp-schedule=<list>: Schedules of the openmp stages, see OMPDepthEstimator.hpp. Also DEPTH_OMP_SCHEDULE=<list>.
+	--row-window=<on|off|rows>: Row window mode of the CPU backends, see rowWindow.hpp. Also DEPTH_ROW_WINDOW=<mode>.
+	--peaks=<on|off>: Measure the machine peaks and print the fraction of them every CPU stage reaches, see roofline.hpp.
+		Also DEPTH_PEAKS=<mode>. Default off.
+	--frames=<file>: Process every frame of a frame file instead, writing <backend>_out<frame> depth maps.
+	--pack-frames=<file>: Pack comma separated --left and --right image lists into a grey frame file and exit.
+	--pack-layout=<interleaved|planar>: Frame layout used by --pack-frames. Default interleaved.
 --------------------------------------------------*/
 
+//Builds a backend by name. fastest builds the backend that is fastest on a frame of the source size.
+static DepthEstimator* createNamedEstimator(
+	const std::string& name,
+	const std::string& leftName,
+	const std::string& framesName
+){
+	if(name != "fastest"){
+		return createDepthEstimator(name.c_str(), 4, 4, 64, 8, 8);
+	}
+
+	uint32_t w, h;
+	if(!framesName.empty()){
+		FrameFile frames(framesName.c_str());
+		w = frames.width;
+		h = frames.height;
+	}else{
+		unsigned char* img;
+		imgLoad(leftName.c_str(), &w, &h, &img);
+		free(img);
+	}
+
+	const char* chosen = nullptr;
+	DepthEstimator* estimator = createFastestDepthEstimator(w, h, 4, 4, 64, 8, 8, &chosen);
+	if(estimator){
+		printf("Fastest backend for %ux%u: %s\n", w, h, chosen);
+	}
+	return estimator;
+}
+
+//Runs an estimator on every frame of a frame file straight from the mapped file.
+static void processFrames(
+	DepthEstimator* estimator,
+	const char* framesName,
+	const std::string& outPrefix,
+	const std::string& outFormat,
+	const uint32_t stripRows
+){
+	FrameFile frames(framesName);
+	uint32_t W = frames.width / estimator->downsampleFactor;
+	uint32_t H = frames.height / estimator->downsampleFactor;
+	unsigned char* out = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	frames.prefetch(0);
+	for(uint32_t i=0;i<frames.frameCount;i++){
+		frames.prefetch(i + 1);
+		estimator->createDepthMapTiled(frames.left(i), frames.right(i), frames.width, frames.height,
+			frames.stride, frames.channels, out, W, stripRows);
+		imgWrite((outPrefix + std::to_string(i) + "." + outFormat).c_str(), W, H, 1, out);
+	}
+
+	gettimeofday(&end, NULL);
+	double elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
+		(double)(end.tv_sec - start.tv_sec);
+	printf("%u frames in %f seconds, %f frames per second.\n", frames.frameCount, elapsed, frames.frameCount / elapsed);
+
+	free(out);
+}
+
+//Runs an estimator inside regions of a stereo pair and writes the depth map, which is zero outside them.
+static void processRegions(
+	DepthEstimator* estimator,
+	const char* left_name,
+	const char* right_name,
+	const char* out_name,
+	const std::vector<DepthRegion>& regions
+){
+	unsigned char* img[2];
+	uint32_t w, h, c = 0;
+	imgLoadPair(left_name, right_name, &w, &h, &c, img);
+
+	uint32_t W = w / estimator->downsampleFactor;
+	uint32_t H = h / estimator->downsampleFactor;
+	unsigned char* out = (unsigned char*)calloc(W*H, sizeof(unsigned char));
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	estimator->createDepthMapRegions(img[0], img[1], w, h, w*c, c, regions, out, W);
+
+	gettimeofday(&end, NULL);
+	double elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
+		(double)(end.tv_sec - start.tv_sec);
+	printf("%zu regions: %f seconds.\n", regions.size(), elapsed);
+
+	imgWrite(out_name, W, H, 1, out);
+
+	free(img[0]);
+	free(img[1]);
+	free(out);
+}
+
+//Runs an estimator on a stereo pair in strips and writes the depth map. Both images are decoded whole first,
+//only the backend works one band at a time; frame files page their rows in instead, see processFrames.
+static void processTiled(
+	DepthEstimator* estimator,
+	const char* left_name,
+	const char* right_name,
+	const char* out_name,
+	const uint32_t stripRows
+){
+	unsigned char* img[2];
+	uint32_t w, h, c = 0;
+	imgLoadPair(left_name, right_name, &w, &h, &c, img);
+
+	uint32_t W = w / estimator->downsampleFactor;
+	uint32_t H = h / estimator->downsampleFactor;
+	unsigned char* out = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	estimator->createDepthMapTiled(img[0], img[1], w, h, w*c, c, out, W, stripRows);
+
+	gettimeofday(&end, NULL);
+	double elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
+		(double)(end.tv_sec - start.tv_sec);
+	printf("%u rows in strips of %u: %f seconds.\n", H, stripRows, elapsed);
+
+	imgWrite(out_name, W, H, 1, out);
+
+	free(img[0]);
+	free(img[1]);
+	free(out);
+}
+
 int main(int argc, char** argv){
+	//Backends run when none are given.
+	std::string backends = "opencl,opencl2,multicl";
+	std::string leftName = "im0.png";
+	std::string rightName = "im1.png";
+	std::string outFormat = "png";
+	std::string framesName;
+	std::string packName;
+	uint32_t packLayout = FRAME_INTERLEAVED;
+	uint32_t stripRows = 0;
+	std::vector<DepthRegion> regions;
+
+	//Parse command line options.
+	for(int i=1;i<argc;i++){
+		if(strncmp(argv[i], "--device=", 9) == 0){
+			setDeviceSelection(argv[i] + 9);
+		}else if(strcmp(argv[i], "--list-devices") == 0){
+			printDevices();
+			return 0;
+		}else if(strncmp(argv[i], "--omp-schedule=", 15) == 0){
+			setOMPSchedule(argv[i] + 15);
+		}else if(strncmp(argv[i], "--row-window=", 13) == 0){
+			setRowWindow(argv[i] + 13);
+		}else if(strncmp(argv[i], "--peaks=", 8) == 0){
+			setPeaks(argv[i] + 8);
+		}else if(strncmp(argv[i], "--backend=", 10) == 0){
+			backends = argv[i] + 10;
+		}else if(strcmp(argv[i], "--list-backends") == 0){
+			for(const char* name : depthEstimatorNames()){
+				printf("%s\n", name);
+			}
+			return 0;
+		}else if(strncmp(argv[i], "--left=", 7) == 0){
+			leftName = argv[i] + 7;
+		}else if(strncmp(argv[i], "--right=", 8) == 0){
+			rightName = argv[i] + 8;
+		}else if(strncmp(argv[i], "--out-format=", 13) == 0){
+			outFormat = argv[i] + 13;
+		}else if(strncmp(argv[i], "--strip-rows=", 13) == 0){
+			stripRows = atoi(argv[i] + 13);
+		}else if(strncmp(argv[i], "--roi=", 6) == 0){
+			for(const char* p = argv[i] + 6;*p;){
+				DepthRegion region;
+				int len = 0;
+				if(sscanf(p, "%u,%u,%u,%u%n", &region.x, &region.y, &region.width, &region.height, &len) != 4){
+					printf("Could not parse the regions: %s\n", argv[i] + 6);
+					return 1;
+				}
+				regions.push_back(region);
+				p += len;
+				if(*p == '/'){p++;}
+			}
+		}else if(strncmp(argv[i], "--png-profile=", 14) == 0){
+			if(!setPngProfile(argv[i] + 14)){
+				printf("Unknown png profile: %s\n", argv[i] + 14);
+				return 1;
+			}
+		}else if(strncmp(argv[i], "--trace=", 8) == 0){
+			setTraceFile(argv[i] + 8);
+		}else if(strncmp(argv[i], "--frames=", 9) == 0){
+			framesName = argv[i] + 9;
+		}else if(strncmp(argv[i], "--pack-frames=", 14) == 0){
+			packName = argv[i] + 14;
+		}else if(strcmp(argv[i], "--pack-layout=planar") == 0){
+			packLayout = FRAME_PLANAR;
+		}else if(strcmp(argv[i], "--pack-layout=interleaved") == 0){
+			packLayout = FRAME_INTERLEAVED;
+		}else{
+			printf("Unknown option: %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if(!packName.empty()){
+		packFrameFile(packName.c_str(), splitList(leftName), splitList(rightName), 1, packLayout);
+		return 0;
+	}
+
 	//Square matrix multiplication.
 	/*
 	{
@@ -47,15 +280,34 @@ int main(int argc, char** argv){
 	}
 	*/
 
+	//Start the trace clock before any work when DEPTH_TRACE is set.
+	traceEnabled();
+
 	//Stereo image depth estimators.
-	SimpleDepthEstimator sde(4, 4, 64, 8, 8);
-	OMPDepthEstimator mpd(4, 4, 64, 8, 8);
-	CLDepthEstimator cld(4, 4, 64, 8, 8);
-	CLDepthEstimator2 cld2(4, 4, 64, 8, 8); //In order for the optimizations to work properly, the arguments for CLD2 should not be changed.
-	//cld.printInfo();
-	//cld2.printInfo();
-	//sde.createDepthMap("im0.png", "im1.png", "simple_out.png");
-	//mpd.createDepthMap("im0.png", "im1.png", "openmp_out.png");
-	cld.createDepthMap("im0.png", "im1.png", "opencl_out.png");
-	cld2.createDepthMap("im0.png", "im1.png", "opencl2_out.png");
-}	
+	for(const std::string& name : splitList(backends)){
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+
+		DepthEstimator* estimator = createNamedEstimator(name, leftName, framesName);
+		if(!estimator){
+			printf("Unknown or unsupported backend, or no OpenCL device: %s\n", name.c_str());
+			return 1;
+		}
+
+		//estimator->printInfo();
+		std::string outName = name + "_out." + outFormat;
+		if(!framesName.empty()){
+			processFrames(estimator, framesName.c_str(), name + "_out", outFormat, stripRows);
+		}else if(!regions.empty()){
+			processRegions(estimator, leftName.c_str(), rightName.c_str(), outName.c_str(), regions);
+		}else if(stripRows > 0){
+			processTiled(estimator, leftName.c_str(), rightName.c_str(), outName.c_str(), stripRows);
+		}else{
+			estimator->createDepthMap(leftName.c_str(), rightName.c_str(), outName.c_str());
+		}
+		delete estimator;
+
+		gettimeofday(&end, NULL);
+		traceSpan(name.c_str(), "backend", start, end);
+	}
+}
@@ -0,0 +1,140 @@
+#include "numaNodes.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+//Parses a sysfs CPU list such as "0-3,8-11".
+static std::vector<uint32_t> parseCpuList(
+	const char* list
+){
+	std::vector<uint32_t> cpus;
+	for(const char* p = list;*p&&*p != '\n';){
+		char* end;
+		uint32_t first = strtoul(p, &end, 10);
+		uint32_t last = first;
+		if(end == p){break;}
+		p = end;
+		if(*p == '-'){
+			last = strtoul(p + 1, &end, 10);
+			p = end;
+		}
+		for(uint32_t cpu=first;cpu<=last;cpu++){
+			cpus.push_back(cpu);
+		}
+		if(*p == ','){p++;}
+	}
+	return cpus;
+}
+
+//Reads the nodes from sysfs, or makes one node of the online CPUs.
+static std::vector<NumaNode> readNodes(){
+	std::vector<NumaNode> nodes;
+
+	DIR* dir = opendir("/sys/devices/system/node");
+	if(dir){
+		while(struct dirent* entry = readdir(dir)){
+			if(strncmp(entry->d_name, "node", 4) != 0||entry->d_name[4] < '0'||entry->d_name[4] > '9'){continue;}
+
+			char path[300];
+			snprintf(path, sizeof(path), "/sys/devices/system/node/%s/cpulist", entry->d_name);
+			FILE* file = fopen(path, "r");
+			if(!file){continue;}
+			char list[4096] = "";
+			if(!fgets(list, sizeof(list), file)){list[0] = '\0';}
+			fclose(file);
+
+			NumaNode node = {(uint32_t)atoi(entry->d_name + 4), parseCpuList(list)};
+			if(!node.cpus.empty()){nodes.push_back(node);}
+		}
+		closedir(dir);
+	}
+
+	//Node order, readdir returns them in any order.
+	std::sort(nodes.begin(), nodes.end(), [](const NumaNode& a, const NumaNode& b){return a.id < b.id;});
+
+	if(nodes.empty()){
+		NumaNode node = {0, {}};
+		long count = sysconf(_SC_NPROCESSORS_ONLN);
+		for(long cpu=0;cpu<(count > 0 ? count : 1);cpu++){
+			node.cpus.push_back(cpu);
+		}
+		nodes.push_back(node);
+	}
+	return nodes;
+}
+
+//Nodes of the machine, read on the first call.
+const std::vector<NumaNode>& numaNodes(){
+	static const std::vector<NumaNode> nodes = readNodes();
+	return nodes;
+}
+
+//Pins the calling thread to one CPU. Returns false if the kernel refused.
+bool pinThread(
+	const uint32_t cpu
+){
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+//Rounds bytes up to whole pages, at least one.
+static size_t pageBytes(
+	const size_t bytes
+){
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t size = (bytes + page - 1) / page * page;
+	return size > 0 ? size : page;
+}
+
+//Maps bytes rounded up to whole pages straight from the kernel, so ranges of it can be bound to nodes.
+//The pages are fresh, they carry no binding of an earlier plane and are placed when first touched.
+void* allocatePages(
+	const size_t bytes
+){
+	void* data = mmap(nullptr, pageBytes(bytes), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+	if(data == MAP_FAILED){
+		printf("Could not allocate %zu bytes!\n", bytes);
+		exit(EXIT_FAILURE);
+	}
+	return data;
+}
+
+//Unmaps pages of allocatePages, bytes as passed to it.
+void freePages(
+	void* data,
+	const size_t bytes
+){
+	if(data){munmap(data, pageBytes(bytes));}
+}
+
+//Binds the pages holding rows [rowBegin, rowEnd) of a plane of rowBytes wide rows to a node,
+//moving pages that were already touched. Pages shared with the neighbouring bands go to the band that is bound last.
+void bindRows(
+	void* data,
+	const size_t rowBytes,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	const uint32_t node
+){
+	if(rowEnd <= rowBegin){return;}
+
+	size_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t begin = (uintptr_t)data + rowBegin * rowBytes;
+	uintptr_t end = (uintptr_t)data + rowEnd * rowBytes;
+	begin = begin / page * page;
+
+	unsigned long mask[16] = {};
+	if(node >= sizeof(mask) * 8){return;}
+	mask[node / (sizeof(unsigned long) * 8)] = 1ul << (node % (sizeof(unsigned long) * 8));
+	syscall(SYS_mbind, begin, end - begin, MPOL_BIND, mask, sizeof(mask) * 8, MPOL_MF_MOVE);
+}
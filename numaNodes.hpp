@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cinttypes>
+#include <cstddef>
+#include <vector>
+
+/*--------------------------------------------------
+NUMA topology, thread pinning and page placement through the
+kernel interfaces directly (sysfs, sched_setaffinity and mbind),
+so no NUMA library is needed.
+
+Machines without /sys/devices/system/node are treated as one
+node holding every online CPU. Placement requests the kernel
+refuses (eg. a single node kernel without mbind) are ignored.
+--------------------------------------------------*/
+
+//CPUs of every NUMA node that has any, in node order.
+struct NumaNode{
+	uint32_t id;
+	std::vector<uint32_t> cpus;
+};
+
+//Nodes of the machine, read on the first call.
+const std::vector<NumaNode>& numaNodes();
+
+//Pins the calling thread to one CPU. Returns false if the kernel refused.
+bool pinThread(
+	const uint32_t cpu
+);
+
+//Maps bytes rounded up to whole pages straight from the kernel, so ranges of it can be bound to nodes.
+//The pages are fresh, they carry no binding of an earlier plane and are placed when first touched.
+void* allocatePages(
+	const size_t bytes
+);
+
+//Unmaps pages of allocatePages, bytes as passed to it.
+void freePages(
+	void* data,
+	const size_t bytes
+);
+
+//Binds the pages holding rows [rowBegin, rowEnd) of a plane of rowBytes wide rows to a node,
+//moving pages that were already touched.
+void bindRows(
+	void* data,
+	const size_t rowBytes,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	const uint32_t node
+);
@@ -0,0 +1,147 @@
+#include "perfCounters.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+const char* const perfCounterNames[PERF_COUNTERS] = {
+	"cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses"
+};
+
+//Type and config of every counter.
+static const uint32_t counterTypes[PERF_COUNTERS] = {
+	PERF_TYPE_HARDWARE,
+	PERF_TYPE_HARDWARE,
+	PERF_TYPE_HW_CACHE,
+	PERF_TYPE_HARDWARE,
+	PERF_TYPE_HARDWARE
+};
+
+static const uint64_t counterConfigs[PERF_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+
+//Opens one user space counter on a thread, returns -1 on failure.
+static int openCounter(
+	const uint32_t counter,
+	const int tid
+){
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = counterTypes[counter];
+	attr.config = counterConfigs[counter];
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED|PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(SYS_perf_event_open, &attr, tid, -1, -1, 0);
+}
+
+//Opens the counters on the calling thread. Counters that fail here are not tried on other threads.
+PerfCounters::PerfCounters(){
+	ThreadGroup group;
+	group.tid = syscall(SYS_gettid);
+	for(uint32_t i=0;i<PERF_COUNTERS;i++){
+		group.fds[i] = openCounter(i, group.tid);
+		opened[i] = group.fds[i] >= 0;
+		begin[i] = 0;
+	}
+	threads.push_back(group);
+	reset();
+}
+
+PerfCounters::~PerfCounters(){
+	for(ThreadGroup& group : threads){
+		for(uint32_t i=0;i<PERF_COUNTERS;i++){
+			if(group.fds[i] >= 0){close(group.fds[i]);}
+		}
+	}
+}
+
+//Whether any counter could be opened.
+bool PerfCounters::available(){
+	for(uint32_t i=0;i<PERF_COUNTERS;i++){
+		if(opened[i]){return true;}
+	}
+	return false;
+}
+
+//Opens the available counters on another thread of the process.
+void PerfCounters::openThread(
+	const int tid
+){
+	ThreadGroup group;
+	group.tid = tid;
+	for(uint32_t i=0;i<PERF_COUNTERS;i++){
+		group.fds[i] = opened[i] ? openCounter(i, tid) : -1;
+	}
+	threads.push_back(group);
+}
+
+//Sums the counters of every thread, opening counters on threads started since the last read.
+void PerfCounters::read(
+	uint64_t* values
+){
+	DIR* dir = opendir("/proc/self/task");
+	if(dir){
+		while(struct dirent* entry = readdir(dir)){
+			if(entry->d_name[0] == '.'){continue;}
+			int tid = atoi(entry->d_name);
+			bool known = false;
+			for(const ThreadGroup& group : threads){
+				if(group.tid == tid){known = true; break;}
+			}
+			if(!known){openThread(tid);}
+		}
+		closedir(dir);
+	}
+
+	for(uint32_t i=0;i<PERF_COUNTERS;i++){
+		values[i] = 0;
+	}
+	for(const ThreadGroup& group : threads){
+		for(uint32_t i=0;i<PERF_COUNTERS;i++){
+			if(group.fds[i] < 0){continue;}
+
+			//Value, time enabled and time running.
+			uint64_t data[3];
+			if(::read(group.fds[i], data, sizeof(data)) != sizeof(data)||data[2] == 0){continue;}
+			values[i] += data[2] < data[1] ? (uint64_t)((double)data[0] * data[1] / data[2]) : data[0];
+		}
+	}
+}
+
+//Starts counting a stage.
+void PerfCounters::start(){
+	read(begin);
+}
+
+//Adds the counts since start to a stage of the pipeline.
+void PerfCounters::stop(
+	const uint32_t stage
+){
+	uint64_t end[PERF_COUNTERS];
+	read(end);
+	for(uint32_t i=0;i<PERF_COUNTERS;i++){
+		if(opened[i]){
+			stages[stage][i] += end[i] > begin[i] ? end[i] - begin[i] : 0;
+		}
+	}
+}
+
+//Clears the stage counts.
+void PerfCounters::reset(){
+	for(uint32_t j=0;j<10;j++){
+		for(uint32_t i=0;i<PERF_COUNTERS;i++){
+			stages[j][i] = opened[i] ? 0 : PERF_MISSING;
+		}
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cinttypes>
+#include <vector>
+
+/*--------------------------------------------------
+Hardware performance counters through perf_event_open, counted in
+user space over every thread of the process.
+
+Counters:
+	cycles        : CPU cycles.
+	instructions  : Retired instructions.
+	l1d_misses    : L1 data cache read misses.
+	llc_misses    : Last level cache misses.
+	branch_misses : Mispredicted branches.
+
+Counters the kernel or the machine does not provide (eg. in most
+virtual machines, or with perf_event_paranoid above 2) are reported
+as missing. Multiplexed counters are scaled by their enabled and
+running times.
+--------------------------------------------------*/
+
+#define PERF_COUNTERS 5
+
+enum{
+	PERF_CYCLES,
+	PERF_INSTRUCTIONS,
+	PERF_L1D_MISSES,
+	PERF_LLC_MISSES,
+	PERF_BRANCH_MISSES
+};
+
+extern const char* const perfCounterNames[PERF_COUNTERS];
+
+//Value of a counter that could not be opened.
+#define PERF_MISSING UINT64_MAX
+
+struct PerfCounters{
+	PerfCounters();
+	~PerfCounters();
+
+	//Whether any counter could be opened.
+	bool available();
+
+	//Starts counting a stage.
+	void start();
+
+	//Adds the counts since start to a stage of the pipeline, 0-9 as the stage times.
+	void stop(
+		const uint32_t stage
+	);
+
+	//Clears the stage counts.
+	void reset();
+
+	//Counts of every pipeline stage, PERF_MISSING for missing counters.
+	uint64_t stages[10][PERF_COUNTERS];
+
+	private:
+
+	//Sums the counters of every thread, opening counters on threads started since the last read.
+	void read(
+		uint64_t* values
+	);
+
+	void openThread(
+		const int tid
+	);
+
+	//Counter group of one thread. fds[i] is -1 for missing counters.
+	struct ThreadGroup{
+		int tid;
+		int fds[PERF_COUNTERS];
+	};
+
+	std::vector<ThreadGroup> threads;
+	bool opened[PERF_COUNTERS];
+	uint64_t begin[PERF_COUNTERS];
+};
@@ -0,0 +1,203 @@
+#include "roofline.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <omp.h>
+#include <sys/time.h>
+
+//Elements of each triad array, 64 MiB of doubles.
+#define TRIAD_ELEMENTS (1u << 23)
+
+//Independent multiply-add chains and iterations per thread of the arithmetic microbenchmark.
+#define FMA_LANES 32
+#define FMA_ITERATIONS (1u << 22)
+
+//Keeps the microbenchmark results alive.
+static volatile double peakSink;
+
+static const char* commandLinePeaks = nullptr;
+
+//Seconds between two times.
+static double seconds(
+	const struct timeval& start,
+	const struct timeval& end
+){
+	return (double)(end.tv_usec - start.tv_usec) / 1000000 +
+		(double)(end.tv_sec - start.tv_sec);
+}
+
+//Work of the ten pipeline stages, in the order of the stage times.
+void pipelineWork(
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const uint32_t maxDisparity,
+	StageWork* work
+){
+	double w = width;
+	double h = height;
+	double W = width / downsampleFactor;
+	double H = height / downsampleFactor;
+	double f = downsampleFactor;
+	double window = (2.0 * windowRadius + 1) * (2.0 * windowRadius + 1);
+
+	//Disparity candidates of a row, the same for both search directions.
+	double candidates = 0;
+	for(uint32_t j=0;j<width / downsampleFactor;j++){
+		candidates += std::min(maxDisparity, j + 1);
+	}
+
+	for(uint32_t i=0;i<2;i++){
+		work[0+i*3] = {w*h*channels + w*h, channels == 1 ? 0.0 : 5*w*h};
+		work[1+i*3] = {f*f*W*H + W*H, W*H*(f*f + 1)};
+		work[2+i*3] = {2*W*H, W*H*(window + 1)};
+		work[6+i] = {5*W*H, H*candidates*(window*8 + 5)};
+	}
+	work[8] = {3*W*H, 2*W*H};
+	work[9] = {2*W*H, W*H};
+}
+
+//Best triad bandwidth on threads threads in GB/s.
+static double measureBandwidth(
+	const uint32_t threads
+){
+	double* a = (double*)malloc(TRIAD_ELEMENTS*sizeof(double));
+	double* b = (double*)malloc(TRIAD_ELEMENTS*sizeof(double));
+	double* c = (double*)malloc(TRIAD_ELEMENTS*sizeof(double));
+	if(!a||!b||!c){
+		printf("Could not allocate the bandwidth microbenchmark!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	//Touch the pages on the threads that use them.
+	#pragma omp parallel for schedule(static) num_threads(threads)
+	for(uint32_t i=0;i<TRIAD_ELEMENTS;i++){
+		a[i] = 0.0;
+		b[i] = 1.0;
+		c[i] = 2.0;
+	}
+
+	double best = 0.0;
+	for(uint32_t k=0;k<5;k++){
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+
+		#pragma omp parallel for schedule(static) num_threads(threads)
+		for(uint32_t i=0;i<TRIAD_ELEMENTS;i++){
+			a[i] = b[i] + 3.0 * c[i];
+		}
+
+		gettimeofday(&end, NULL);
+		best = std::max(best, 3.0 * TRIAD_ELEMENTS * sizeof(double) / seconds(start, end));
+	}
+	peakSink = a[TRIAD_ELEMENTS / 2];
+
+	free(a);
+	free(b);
+	free(c);
+	return best / 1e9;
+}
+
+//Best float multiply-add rate on threads threads in GFLOP/s.
+static double measureFlops(
+	const uint32_t threads
+){
+	double best = 0.0;
+	for(uint32_t k=0;k<3;k++){
+		uint32_t team = 1;
+		struct timeval start, end;
+		gettimeofday(&start, NULL);
+
+		#pragma omp parallel num_threads(threads)
+		{
+			float acc[FMA_LANES];
+			for(uint32_t i=0;i<FMA_LANES;i++){
+				acc[i] = 1.0f + i * 0.001f;
+			}
+			for(uint32_t j=0;j<FMA_ITERATIONS;j++){
+				#pragma omp simd
+				for(uint32_t i=0;i<FMA_LANES;i++){
+					acc[i] = acc[i] * 0.999999f + 0.000001f;
+				}
+			}
+			float sum = 0.0f;
+			for(uint32_t i=0;i<FMA_LANES;i++){
+				sum += acc[i];
+			}
+
+			#pragma omp critical
+			peakSink = peakSink + sum;
+
+			#pragma omp single
+			team = omp_get_num_threads();
+		}
+
+		gettimeofday(&end, NULL);
+		best = std::max(best, 2.0 * FMA_LANES * FMA_ITERATIONS * team / seconds(start, end));
+	}
+	return best / 1e9;
+}
+
+//Sets whether the CPU backends measure the machine peaks, on or off. Overrides DEPTH_PEAKS.
+void setPeaks(
+	const char* spec
+){
+	commandLinePeaks = spec;
+}
+
+//Peaks of the host on 1 thread, or on every OpenMP thread with 0, measured on the first call for the thread count.
+//Returns nullptr while the peaks are off.
+const MachinePeaks* machinePeaks(
+	const uint32_t threads
+){
+	const char* spec = commandLinePeaks;
+	if(spec == nullptr){spec = getenv("DEPTH_PEAKS");}
+	if(spec == nullptr||strcmp(spec, "off") == 0){return nullptr;}
+	if(strcmp(spec, "on") != 0){
+		printf("Unknown peaks mode: %s!\n", spec);
+		exit(EXIT_FAILURE);
+	}
+
+	static std::mutex mutex;
+	static std::map<uint32_t, MachinePeaks> peaks;
+	std::lock_guard<std::mutex> lock(mutex);
+
+	uint32_t team = threads ? threads : omp_get_max_threads();
+	if(peaks.count(team) == 0){
+		peaks[team] = {measureBandwidth(team), measureFlops(team), team};
+	}
+	return &peaks[team];
+}
+
+//Prints the peaks and the threads they were taken on, nothing if peaks is nullptr.
+void printMachinePeaks(
+	const MachinePeaks* peaks
+){
+	if(!peaks){return;}
+	printf("Machine peaks       : %.2f GB/s, %.2f GFLOP/s on %u thread%s.\n", peaks->bandwidth, peaks->flops,
+		peaks->threads, peaks->threads == 1 ? "" : "s");
+}
+
+//Prints the time of a stage with its achieved GB/s and GFLOP/s, and the fraction of peaks unless peaks is nullptr.
+void printStageTime(
+	const char* name,
+	const double seconds,
+	const StageWork& work,
+	const MachinePeaks* peaks
+){
+	double bandwidth = seconds > 0 ? work.bytes / seconds / 1e9 : 0.0;
+	double flops = seconds > 0 ? work.flops / seconds / 1e9 : 0.0;
+
+	if(peaks){
+		printf("%s: %f S. %8.2f GB/s (%5.1f%%) %8.2f GFLOP/s (%5.1f%%)\n", name, seconds,
+			bandwidth, 100 * bandwidth / peaks->bandwidth, flops, 100 * flops / peaks->flops);
+	}else{
+		printf("%s: %f S. %8.2f GB/s %8.2f GFLOP/s\n", name, seconds, bandwidth, flops);
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cinttypes>
+
+/*--------------------------------------------------
+Roofline figures of the pipeline stages.
+
+The work of every stage is counted analytically from the frame
+and the parameters:
+	bytes : Every input plane read once and the output written
+	        once, the windows of the filters assumed to hit cache.
+	flops : Arithmetic of the inner loops, integer sums of the
+	        box filters included and a multiply-add counted as two.
+	        A disparity candidate costs (2r+1)^2 * 8 for the window
+	        sums and 5 for the correlation and comparison; left and
+	        right view candidates stop at the image border.
+	        Occlusion fill counts only the test of every pixel, the
+	        windows of the holes depend on the data.
+
+The machine peaks are measured by a small built-in microbenchmark:
+a triad over arrays well beyond the last level cache for bandwidth,
+and independent float multiply-add chains for arithmetic, with the
+instructions the build targets. They are taken once per process and
+thread count on first use, on one thread for the single threaded
+simple backend and on every OpenMP thread for the others, and only
+when enabled with setPeaks or DEPTH_PEAKS=on, since the triad alone
+streams 192 MiB. Otherwise the stages are reported without a
+fraction of peak. They are host peaks, device stages are always
+reported without one.
+--------------------------------------------------*/
+
+//Bytes moved and arithmetic operations of one stage.
+struct StageWork{
+	double bytes;
+	double flops;
+};
+
+//Measured host peaks in GB/s and GFLOP/s on threads host threads.
+struct MachinePeaks{
+	double bandwidth;
+	double flops;
+	uint32_t threads;
+};
+
+//Work of the ten pipeline stages, in the order of the stage times.
+void pipelineWork(
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const uint32_t downsampleFactor,
+	const uint32_t windowRadius,
+	const uint32_t maxDisparity,
+	StageWork* work
+);
+
+//Sets whether the CPU backends measure the machine peaks, on or off. Overrides DEPTH_PEAKS.
+void setPeaks(
+	const char* spec
+);
+
+//Peaks of the host on 1 thread, or on every OpenMP thread with 0, measured on the first call for the thread count.
+//Returns nullptr while the peaks are off.
+const MachinePeaks* machinePeaks(
+	const uint32_t threads
+);
+
+//Prints the peaks and the threads they were taken on, nothing if peaks is nullptr.
+void printMachinePeaks(
+	const MachinePeaks* peaks
+);
+
+//Prints the time of a stage with its achieved GB/s and GFLOP/s, and the fraction of peaks unless peaks is nullptr.
+void printStageTime(
+	const char* name,
+	const double seconds,
+	const StageWork& work,
+	const MachinePeaks* peaks
+);
@@ -0,0 +1,331 @@
+#include "rowWindow.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <sys/time.h>
+
+#include "trace.hpp"
+
+static const char* commandLineWindow = nullptr;
+
+//Sets the row window mode of the CPU backends, on, off or the batch rows. Overrides DEPTH_ROW_WINDOW.
+void setRowWindow(
+	const char* spec
+){
+	commandLineWindow = spec;
+}
+
+//Batch rows of the row window mode, 0 when it is off.
+uint32_t rowWindowBatch(){
+	const char* spec = commandLineWindow;
+	if(spec == nullptr){spec = getenv("DEPTH_ROW_WINDOW");}
+	if(spec == nullptr||strcmp(spec, "off") == 0){return 0;}
+	if(strcmp(spec, "on") == 0){return 8;}
+
+	char* end;
+	uint32_t batch = strtoul(spec, &end, 10);
+	if(*spec == '\0'||*end != '\0'){
+		printf("Could not parse the row window: %s!\n", spec);
+		exit(EXIT_FAILURE);
+	}
+	return batch;
+}
+
+//Greyscale rows [rowBegin, rowEnd) of a source 8bit rgba image. Grey sources are copied as they are.
+void greyRows(
+	const unsigned char* img,
+	const uint32_t width,
+	const uint32_t stride,
+	const uint32_t channels,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* out
+){
+	for(uint32_t j=rowBegin;j<rowEnd;j++){
+		const unsigned char* row = img + (size_t)j*stride;
+		if(channels == 1){
+			memcpy(out + (size_t)j*width, row, width);
+			continue;
+		}
+
+		for(uint32_t i=0;i<width;i++){
+			out[i+(size_t)j*width] = (unsigned int)(
+				row[i*4  ] * 0.2126f +
+				row[i*4+1] * 0.7152f +
+				row[i*4+2] * 0.0722f
+			);
+		}
+	}
+}
+
+//Downsampled rows [rowBegin, rowEnd) of an image, averaging the pixel intensities.
+void downsampleRows(
+	const unsigned char* img,
+	const uint32_t width,
+	const uint32_t factor,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* out
+){
+	uint32_t w = width / factor;
+	for(uint32_t i=rowBegin;i<rowEnd;i++){
+		for(uint32_t j=0;j<w;j++){
+			uint32_t val = 0;
+			uint32_t I = i * factor;
+			uint32_t J = j * factor;
+			for(uint32_t m=I;m<I+factor;m++){
+				for(uint32_t n=J;n<J+factor;n++){
+					val += img[n+m*width];
+				}
+			}
+			out[j+i*w] = val / (factor * factor);
+		}
+	}
+}
+
+//Mean filtered rows [rowBegin, rowEnd) of an image.
+void filterRows(
+	const unsigned char* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t radius,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* out
+){
+	for(int32_t i=(int32_t)rowBegin;i<(int32_t)rowEnd;i++){
+		for(int32_t j=0;j<(int32_t)width;j++){
+			uint32_t val = 0;
+			for(int32_t m=i-(int32_t)radius;m<=i+(int32_t)radius;m++){
+				for(int32_t n=j-(int32_t)radius;n<=j+(int32_t)radius;n++){
+					if(0<=m&&m<(int32_t)height&&0<=n&&n<(int32_t)width){
+						val += img[n+m*width];
+					}
+				}
+			}
+			uint32_t d = radius*2+1;
+			out[j+i*width] = val / (d*d);
+		}
+	}
+}
+
+//Disparity rows [rowBegin, rowEnd) of a map. Reads the rows radius above and below them.
+void disparityRows(
+	const unsigned char* img_0,
+	const unsigned char* img_1,
+	const unsigned char* mean_0,
+	const unsigned char* mean_1,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	const uint32_t radius,
+	const uint32_t maxDisparity,
+	const int32_t direction,
+	unsigned char* out
+){
+	for(int32_t i=(int32_t)rowBegin;i<(int32_t)rowEnd;i++){
+		for(int32_t j=0;j<(int32_t)width;j++){
+
+			float top_zncc = -1.0f;
+			float temp_zncc = -1.0f;
+			unsigned char disparity = 0;
+
+			float std_0 = 0.0f;
+			float std_1 = 0.0f;
+			float numer = 0.0f;
+			float denom_0 = 0.0f;
+			float denom_1 = 0.0f;
+
+			for(int32_t d=0;d<(int32_t)maxDisparity;d++){
+				if((j+direction*d)<0||(int32_t)width<=(j+direction*d)){break;}
+				numer = 0.0f;
+				denom_0 = 0.0f;
+				denom_1 = 0.0f;
+
+				for(int32_t m=i-(int32_t)radius;m<=i+(int32_t)radius;m++){
+					for(int32_t n=j-(int32_t)radius;n<=j+(int32_t)radius;n++){
+						if(0<=m&&m<(int32_t)height&&0<=(n+direction*d)&&(n+direction*d)<(int32_t)width&&0<=n&&n<(int32_t)width){
+							std_0 = img_0[n+m*width] - mean_0[j+i*width];
+							std_1 = img_1[n+m*width+direction*d] - mean_1[j+i*width+direction*d];
+							numer += std_0 * std_1;
+							denom_0 += std_0 * std_0;
+							denom_1 += std_1 * std_1;
+						}
+					}
+				}
+
+				temp_zncc = numer / (sqrt(denom_0) * sqrt(denom_1));
+				if(temp_zncc > top_zncc){
+					top_zncc = temp_zncc;
+					disparity = d;
+				}
+			}
+			out[j+i*width] = disparity;
+		}
+	}
+}
+
+//Cross checks rows [rowBegin, rowEnd) of the left map against the right one in place.
+void crossRows(
+	unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	const unsigned char maxDifference
+){
+	for(uint32_t i=rowBegin*width;i<rowEnd*width;i++){
+		if(abs(left[i] - right[i]) > maxDifference){left[i] = 0;}
+	}
+}
+
+//Occlusion filled rows [rowBegin, rowEnd) of a cross checked map. Reads the rows radius above and below them.
+void fillRows(
+	const unsigned char* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t radius,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* out
+){
+	for(int32_t i=(int32_t)rowBegin;i<(int32_t)rowEnd;i++){
+		for(int32_t j=0;j<(int32_t)width;j++){
+			if(img[j+i*width] > 0){
+				out[j+i*width] = img[j+i*width];
+			}else{
+				float numer = 0.0f;
+				uint32_t denom = 0;
+				for(int32_t m=i-(int32_t)radius;m<=i+(int32_t)radius;m++){
+					for(int32_t n=j-(int32_t)radius;n<=j+(int32_t)radius;n++){
+						if(0<=m&&m<(int32_t)height&&0<=n&&n<(int32_t)width){
+							if(img[n+m*width] > 0){
+								numer += img[n+m*width];
+								denom++;
+							}
+						}
+					}
+				}
+				out[j+i*width] = (unsigned char)(numer/denom);
+			}
+		}
+	}
+}
+
+//Adds the seconds since start to *elapsed and restarts start.
+static void lap(
+	struct timeval* start,
+	double* elapsed
+){
+	struct timeval end;
+	gettimeofday(&end, NULL);
+	*elapsed += (double)(end.tv_usec - start->tv_usec) / 1000000 +
+		(double)(end.tv_sec - start->tv_sec);
+	*start = end;
+}
+
+//Creates the disparity rows [rowBegin, rowEnd) of both views straight from the source images through a row window
+//of batch rows. The window holds the downsampled rows [first, last) of both views, which are moved to its top
+//when the next batch no longer needs the rows above them.
+void windowDisparity(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	const uint32_t factor,
+	const uint32_t radius,
+	const uint32_t maxDisparity,
+	const uint32_t batch,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* disparity_0,
+	unsigned char* disparity_1,
+	double* times,
+	DepthPlanes* planes
+){
+	const unsigned char* img[2] = {left, right};
+	unsigned char* disparity[2] = {disparity_0, disparity_1};
+	uint32_t W = width / factor;
+	uint32_t H = height / factor;
+
+	struct timeval start, time;
+	gettimeofday(&start, NULL);
+	time = start;
+
+	//The source rows below the last downsampled row are only needed for the grey planes.
+	for(uint32_t v=0;v<2&&planes&&rowEnd == H;v++){
+		greyRows(img[v], width, stride, channels, H*factor, height, planes->grey[v]);
+		lap(&time, &times[0+v*3]);
+	}
+	if(rowEnd <= rowBegin){return;}
+
+	//Window, filtered rows at the places of their downsampled rows, and the grey source rows of one downsampled row.
+	uint32_t rows = 2*radius + batch;
+	unsigned char* down[2];
+	unsigned char* mean[2];
+	unsigned char* grey[2];
+	for(uint32_t v=0;v<2;v++){
+		down[v] = (unsigned char*)malloc(rows*W*sizeof(unsigned char));
+		mean[v] = (unsigned char*)malloc(rows*W*sizeof(unsigned char));
+		grey[v] = (unsigned char*)malloc(factor*width*sizeof(unsigned char));
+	}
+
+	uint32_t first = rowBegin > radius ? rowBegin - radius : 0;
+	uint32_t last = first;
+	for(uint32_t batchBegin=rowBegin;batchBegin<rowEnd;batchBegin+=batch){
+		uint32_t batchEnd = std::min(batchBegin + batch, rowEnd);
+
+		//Drop the rows above the windows of the batch.
+		uint32_t top = batchBegin > radius ? batchBegin - radius : 0;
+		if(top > first){
+			for(uint32_t v=0;v<2;v++){
+				memmove(down[v], down[v] + (top - first)*W, (last - top)*W);
+			}
+			first = top;
+		}
+
+		//Downsample the rows below the windows of the batch.
+		uint32_t bottom = std::min(batchEnd + radius, H);
+		for(uint32_t v=0;v<2;v++){
+			for(uint32_t i=last;i<bottom;i++){
+				greyRows(img[v] + (size_t)i*factor*stride, width, stride, channels, 0, factor, grey[v]);
+				if(planes){memcpy(planes->grey[v] + (size_t)i*factor*width, grey[v], factor*width);}
+				lap(&time, &times[0+v*3]);
+
+				downsampleRows(grey[v], width, factor, 0, 1, down[v] + (i - first)*W);
+				if(planes){memcpy(planes->down[v] + i*W, down[v] + (i - first)*W, W);}
+				lap(&time, &times[1+v*3]);
+			}
+		}
+		last = bottom;
+
+		//Filter and match the batch, counting the rows from the top of the window.
+		uint32_t begin = batchBegin - first;
+		uint32_t end = batchEnd - first;
+		for(uint32_t v=0;v<2;v++){
+			filterRows(down[v], W, H - first, radius, begin, end, mean[v]);
+			if(planes){memcpy(planes->mean[v] + batchBegin*W, mean[v] + begin*W, (end - begin)*W);}
+			lap(&time, &times[2+v*3]);
+		}
+		for(uint32_t v=0;v<2;v++){
+			disparityRows(down[v], down[1-v], mean[v], mean[1-v], W, H - first, begin, end, radius, maxDisparity, -1+v*2,
+				disparity[v] + first*W);
+			if(planes){memcpy(planes->disparity[v] + batchBegin*W, disparity[v] + batchBegin*W, (end - begin)*W);}
+			lap(&time, &times[6+v]);
+		}
+	}
+
+	for(uint32_t v=0;v<2;v++){
+		free(down[v]);
+		free(mean[v]);
+		free(grey[v]);
+	}
+
+	traceSpan("row window", "stage", start, time);
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cinttypes>
+
+#include "DepthEstimator.hpp"
+
+/*--------------------------------------------------
+Row kernels of the CPU stages and the row window mode of the
+CPU backends.
+
+The kernels compute the rows [rowBegin, rowEnd) of one stage. Rows
+outside [0, height) are left out of the windows, so a kernel also
+runs on a part of a plane: img pointing at the row first of the
+plane, height reduced by first and the rows counted from first.
+
+In row window mode the simple and openmp backends do not
+materialize the grey, downsampled and filtered planes. The
+disparity maps are computed batch rows at a time from a window of
+2 * windowRadius + batch downsampled rows per view, which is slid
+down the image. Every new downsampled row is made from the
+downsampleFactor source rows under it, converted to grey into a
+scratch row. With the default batch of 8 rows the window of a 720
+pixel wide map takes about 12 KiB per view and stays in L1 or L2.
+Cross check and occlusion fill run on the whole disparity maps as
+before. The stage times of windowDisparity are summed over the rows
+of its band, the openmp backend reports the slowest of its bands.
+
+The mode is enabled with setRowWindow or the DEPTH_ROW_WINDOW
+environment variable, as on, off or the batch rows. Runs counting
+hardware events run the stages one after another instead, the
+stages of a window cannot be counted apart.
+--------------------------------------------------*/
+
+//Sets the row window mode of the CPU backends, on, off or the batch rows. Overrides DEPTH_ROW_WINDOW.
+void setRowWindow(
+	const char* spec
+);
+
+//Batch rows of the row window mode, 0 when it is off.
+uint32_t rowWindowBatch();
+
+//Greyscale rows [rowBegin, rowEnd) of a source 8bit rgba image. Grey sources are copied as they are.
+void greyRows(
+	const unsigned char* img,
+	const uint32_t width,
+	const uint32_t stride,
+	const uint32_t channels,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* out
+);
+
+//Downsampled rows [rowBegin, rowEnd) of an image, averaging the pixel intensities.
+void downsampleRows(
+	const unsigned char* img,
+	const uint32_t width,
+	const uint32_t factor,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* out
+);
+
+//Mean filtered rows [rowBegin, rowEnd) of an image.
+void filterRows(
+	const unsigned char* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t radius,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* out
+);
+
+//Disparity rows [rowBegin, rowEnd) of a map. Reads the rows radius above and below them.
+void disparityRows(
+	const unsigned char* img_0,
+	const unsigned char* img_1,
+	const unsigned char* mean_0,
+	const unsigned char* mean_1,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	const uint32_t radius,
+	const uint32_t maxDisparity,
+	const int32_t direction,
+	unsigned char* out
+);
+
+//Cross checks rows [rowBegin, rowEnd) of the left map against the right one in place.
+void crossRows(
+	unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	const unsigned char maxDifference
+);
+
+//Occlusion filled rows [rowBegin, rowEnd) of a cross checked map. Reads the rows radius above and below them.
+void fillRows(
+	const unsigned char* img,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t radius,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* out
+);
+
+//Creates the disparity rows [rowBegin, rowEnd) of both views straight from the source images through a row window
+//of batch rows, see above. The stage times are added to times[0..7] in the order of a pipeline run. The rows
+//computed of every stage are copied into planes unless it is nullptr.
+void windowDisparity(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	const uint32_t factor,
+	const uint32_t radius,
+	const uint32_t maxDisparity,
+	const uint32_t batch,
+	const uint32_t rowBegin,
+	const uint32_t rowEnd,
+	unsigned char* disparity_0,
+	unsigned char* disparity_1,
+	double* times,
+	DepthPlanes* planes
+);
@@ -2,10 +2,14 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include <sys/time.h>
 
 #include "util.hpp"
+#include "roofline.hpp"
+#include "trace.hpp"
+#include "rowWindow.hpp"
 
 /*-------------------------------------------
 This is the single threaded implementation 
@@ -19,13 +23,9 @@ SimpleDepthEstimator::SimpleDepthEstimator(
 	const unsigned char maxDisparity,
 	const unsigned char maxCrossDifference,
 	const uint32_t occlusionRadius
-){
-	this->downsampleFactor = downsampleFactor;
-	this->windowRadius = windowRadius;
-	this->maxDisparity = maxDisparity;
-	this->maxCrossDifference = maxCrossDifference;
-	this->occlusionRadius = occlusionRadius;
-}
+):
+	DepthEstimator(downsampleFactor, windowRadius, maxDisparity, maxCrossDifference, occlusionRadius)
+{}
 
 //Create a depth map from left and right source images.
 void SimpleDepthEstimator::createDepthMap(
@@ -33,132 +33,288 @@ void SimpleDepthEstimator::createDepthMap(
 	const char* right_name,
 	const char* out_name
 ){
-	//Load images.
+	//Load images as grey. Both are decoded at once, color pngs are converted to grey while they are decoded.
 	unsigned char* img[2];
-	uint32_t w, h;
+	uint32_t w, h, c = 1;
 
-	imgLoad(left_name, &w, &h, &img[0]);
-	imgLoad(right_name, &w, &h, &img[1]);
+	imgLoadPair(left_name, right_name, &w, &h, &c, img);
 
 	uint32_t W = w / downsampleFactor;
 	uint32_t H = h / downsampleFactor;
 
+	unsigned char* out = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+
+	double times[10];
+
+	//Start measuring execution time.
+	struct timeval time_start, time_end;
+	gettimeofday(&time_start, NULL);
+
+	runPipeline(img[0], img[1], w, h, w*c, c, out, times, nullptr, nullptr);
+
+	//Finish measuring execution time.
+	gettimeofday(&time_end, NULL);
+
+	//Write the final image into a file as grey.
+	imgWrite(out_name, W, H, 1, out);
+
+	free(img[0]);
+	free(img[1]);
+	free(out);
+
+	//Print total execution time.
+	double elapsed = (double)(time_end.tv_usec - time_start.tv_usec) / 1000000 +
+		(double)(time_end.tv_sec - time_start.tv_sec);
+	printf("---Simple Depth Estimator---\nTotal execution time: %f S.\n", elapsed);
+
+	//Stage rates against the peaks of one thread of the machine.
+	StageWork work[10];
+	pipelineWork(w, h, c, downsampleFactor, windowRadius, maxDisparity, work);
+	const MachinePeaks* peaks = machinePeaks(1);
+	printMachinePeaks(peaks);
+
+	printStageTime("Left greyscale      ", times[0], work[0], peaks);
+	printStageTime("Left downsample     ", times[1], work[1], peaks);
+	printStageTime("Left filter         ", times[2], work[2], peaks);
+	printStageTime("Right greyscale     ", times[3], work[3], peaks);
+	printStageTime("Right downsample    ", times[4], work[4], peaks);
+	printStageTime("Right filter        ", times[5], work[5], peaks);
+	printStageTime("Left disparity      ", times[6], work[6], peaks);
+	printStageTime("Right disparity     ", times[7], work[7], peaks);
+	printStageTime("Cross check         ", times[8], work[8], peaks);
+	printStageTime("Occlusion fill      ", times[9], work[9], peaks);
+	printf("\n");
+}
+
+//Create a depth map from caller owned grey or rgba images in memory.
+void SimpleDepthEstimator::createDepthMap(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	const uint32_t outStride
+){
+	checkLayout(width, stride, channels, outStride);
+
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+	double times[10];
+
+	if(outStride == W){
+		runPipeline(left, right, width, height, stride, channels, out, times, nullptr, nullptr);
+		return;
+	}
+
+	//Padded output rows.
+	unsigned char* temp = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+	runPipeline(left, right, width, height, stride, channels, temp, times, nullptr, nullptr);
+	for(uint32_t i=0;i<H;i++){
+		memcpy(out + (size_t)i*outStride, temp + (size_t)i*W, W);
+	}
+	free(temp);
+}
+
+//Run the pipeline once and report the stage times.
+bool SimpleDepthEstimator::timeStages(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	double* times
+){
+	checkLayout(width, stride, channels, width / downsampleFactor);
+
+	double pipelineTimes[10];
+	runPipeline(left, right, width, height, stride, channels, out, pipelineTimes, nullptr, nullptr);
+	foldStageTimes(pipelineTimes, times);
+	return true;
+}
+
+//Run the pipeline once and count the hardware events of every stage.
+bool SimpleDepthEstimator::countStages(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	PerfCounters* perf,
+	uint64_t* counters
+){
+	checkLayout(width, stride, channels, width / downsampleFactor);
+	if(!perf->available()){return false;}
+
+	double times[10];
+	perf->reset();
+	runPipeline(left, right, width, height, stride, channels, out, times, nullptr, perf);
+	foldStageCounters(perf->stages, counters);
+	return true;
+}
+
+//Run the pipeline once and copy the output of every stage into planes.
+bool SimpleDepthEstimator::capturePlanes(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	DepthPlanes* planes
+){
+	checkLayout(width, stride, channels, width / downsampleFactor);
+
+	double times[10];
+	runPipeline(left, right, width, height, stride, channels, planes->out, times, planes, nullptr);
+	return true;
+}
+
+//Runs every stage from the greyscale conversion to the occlusion fill. Stage times are written into times[0..9].
+//The output of every stage is copied into planes and the hardware events of every stage counted into perf
+//unless they are nullptr.
+void SimpleDepthEstimator::runPipeline(
+	const unsigned char* left,
+	const unsigned char* right,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
+	unsigned char* out,
+	double* times,
+	DepthPlanes* planes,
+	PerfCounters* perf
+){
+	const unsigned char* img[2] = {left, right};
+	uint32_t W = width / downsampleFactor;
+	uint32_t H = height / downsampleFactor;
+
+	//Row window mode unless hardware events are counted, see rowWindow.hpp.
+	uint32_t batch = perf == nullptr ? rowWindowBatch() : 0;
+	if(batch){
+		unsigned char* disparity[2];
+		disparity[0] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+		disparity[1] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
+		for(uint32_t i=0;i<8;i++){
+			times[i] = 0.0;
+		}
+
+		windowDisparity(left, right, width, height, stride, channels, downsampleFactor, windowRadius, maxDisparity, batch,
+			0, H, disparity[0], disparity[1], times, planes);
+
+		crossCheck(disparity[0], disparity[1], W, H, maxCrossDifference, &times[8]);
+		if(planes){
+			memcpy(planes->cross, disparity[0], W*H);
+		}
+		occlusionFill(disparity[0], W, H, occlusionRadius, out, &times[9]);
+
+		free(disparity[0]);
+		free(disparity[1]);
+		return;
+	}
+
 	//Allocate memory for images.
 	unsigned char* grey[2];
 	unsigned char* down[2];
 	unsigned char* mean[2];
 
-	grey[0] = (unsigned char*)malloc(w*h*sizeof(unsigned char));
-	grey[1] = (unsigned char*)malloc(w*h*sizeof(unsigned char));
+	grey[0] = (unsigned char*)malloc(width*height*sizeof(unsigned char));
+	grey[1] = (unsigned char*)malloc(width*height*sizeof(unsigned char));
 	down[0] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
 	down[1] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
 	mean[0] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
 	mean[1] = (unsigned char*)malloc(W*H*sizeof(unsigned char));
 
-	double times[11];
-
-	//Start measuring execution time.
-	struct timeval time_start, time_end;
-	gettimeofday(&time_start, NULL);
-
 	//Prepare left and right images.
 	for(uint32_t i=0;i<2;i++){
-		makeImgGrey(img[i], w, h, grey[i], &times[0+i*3]);
-		downsampleImg(grey[i], w, h, downsampleFactor, down[i], &times[1+i*3]);
+		if(perf){perf->start();}
+		makeImgGrey(img[i], width, height, stride, channels, grey[i], &times[0+i*3]);
+		if(perf){perf->stop(0+i*3);}
+		if(perf){perf->start();}
+		downsampleImg(grey[i], width, height, downsampleFactor, down[i], &times[1+i*3]);
+		if(perf){perf->stop(1+i*3);}
+		if(perf){perf->start();}
 		filterImg(down[i], W, H, windowRadius, mean[i], &times[2+i*3]);
+		if(perf){perf->stop(2+i*3);}
+	}
+
+	if(planes){
+		for(uint32_t i=0;i<2;i++){
+			memcpy(planes->grey[i], grey[i], width*height);
+			memcpy(planes->down[i], down[i], W*H);
+			memcpy(planes->mean[i], mean[i], W*H);
+		}
 	}
 
 	//Create left and right disparity maps.
 	for(uint32_t i=0;i<2;i++){
+		if(perf){perf->start();}
 		calcDisparity(down[i], down[1-i], mean[i], mean[1-i], W, H, windowRadius, maxDisparity, -1+i*2, grey[i], &times[6+i]);
+		if(perf){perf->stop(6+i);}
+	}
+
+	if(planes){
+		memcpy(planes->disparity[0], grey[0], W*H);
+		memcpy(planes->disparity[1], grey[1], W*H);
 	}
 
 	//Combine images and apply post processing.
+	if(perf){perf->start();}
 	crossCheck(grey[0], grey[1], W, H, maxCrossDifference, &times[8]);
-	occlusionFill(grey[0], W, H, occlusionRadius, mean[0], &times[9]);
-
-	//Finish measuring execution time.
-	gettimeofday(&time_end, NULL);
-
-	//Write the final image into a file.
-	makeImgRGBA(mean[0], W, H, grey[1], &times[10]);
-	imgWrite(out_name, W, H, grey[1]);
+	if(perf){perf->stop(8);}
+	if(planes){
+		memcpy(planes->cross, grey[0], W*H);
+	}
+	if(perf){perf->start();}
+	occlusionFill(grey[0], W, H, occlusionRadius, out, &times[9]);
+	if(perf){perf->stop(9);}
 
-	free(img[0]);
-	free(img[1]);
 	free(grey[0]);
 	free(grey[1]);
 	free(down[0]);
 	free(down[1]);
 	free(mean[0]);
 	free(mean[1]);
-
-	//Print total execution time.
-	double elapsed = (double)(time_end.tv_usec - time_start.tv_usec) / 1000000 +
-		(double)(time_end.tv_sec - time_start.tv_sec);
-	printf("---Simple Depth Estimator---\nTotal execution time: %f S.\n", elapsed);
-
-	printf("Left greyscale      : %f S.\n", times[0]);
-	printf("Left downsample     : %f S.\n", times[1]);
-	printf("Left filter         : %f S.\n", times[2]);
-	printf("Right greyscale     : %f S.\n", times[3]);
-	printf("Right downsample    : %f S.\n", times[4]);
-	printf("Right filter        : %f S.\n", times[5]);
-	printf("Left disparity      : %f S.\n", times[6]);
-	printf("Right disparity     : %f S.\n", times[7]);
-	printf("Cross check         : %f S.\n", times[8]);
-	printf("Occlusion fill      : %f S.\n", times[9]);
-	printf("Convert rgba        : %f S.\n\n", times[10]);
 }
 
-//Create a greyscale image based on source 8bit rgba image.
+//Create a greyscale image based on source 8bit rgba image. Grey sources are copied as they are.
 void SimpleDepthEstimator::makeImgGrey(
 	const unsigned char* img,
 	const uint32_t width,
 	const uint32_t height,
+	const uint32_t stride,
+	const uint32_t channels,
 	unsigned char* out,
 	double* elapsed
 ){
 	struct timeval start, end;
 	gettimeofday(&start, NULL);
 
-	uint32_t N = width * height;
-	for(uint32_t i=0;i<N;i++){
-		out[i] = (unsigned int)(
-			img[i*4  ] * 0.2126f +
-			img[i*4+1] * 0.7152f +
-			img[i*4+2] * 0.0722f
-		);
-	}
-
-	gettimeofday(&end, NULL);
-	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
-		(double)(end.tv_sec - start.tv_sec);
-}
-
-//Make an rgba image based on source greyscale image.
-void SimpleDepthEstimator::makeImgRGBA(
-	const unsigned char* img,
-	const uint32_t width,
-	const uint32_t height,
-	unsigned char* out,
-	double* elapsed
-){
-	struct timeval start, end;
-	gettimeofday(&start, NULL);
+	for(uint32_t j=0;j<height;j++){
+		const unsigned char* row = img + (size_t)j*stride;
+		if(channels == 1){
+			memcpy(out + (size_t)j*width, row, width);
+			continue;
+		}
 
-	uint32_t N = width * height;
-	for(uint32_t i=0;i<N;i++){
-		uint32_t I = i * 4;
-		out[I  ] = img[i];
-		out[I+1] = img[i];
-		out[I+2] = img[i];
-		out[I+3] = 255;
+		for(uint32_t i=0;i<width;i++){
+			out[i+(size_t)j*width] = (unsigned int)(
+				row[i*4  ] * 0.2126f +
+				row[i*4+1] * 0.7152f +
+				row[i*4+2] * 0.0722f
+			);
+		}
 	}
 
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("greyscale", "stage", start, end);
 }
 
 //Downsample the image by averaging pixel intensities.
@@ -192,6 +348,7 @@ void SimpleDepthEstimator::downsampleImg(
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("downsample", "stage", start, end);
 }
 
 //Apply a mean filter to the image.
@@ -224,6 +381,7 @@ void SimpleDepthEstimator::filterImg(
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("filter", "stage", start, end);
 }
 
 //Create a disparity map from source images.
@@ -287,6 +445,7 @@ void SimpleDepthEstimator::calcDisparity(
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("disparity", "stage", start, end);
 }
 
 //Compare and combine left and right images. Resulting image will be saved to "left".
@@ -309,6 +468,7 @@ void SimpleDepthEstimator::crossCheck(
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("cross check", "stage", start, end);
 }
 
 //Fill blank spaces left by cross check.
@@ -348,4 +508,5 @@ void SimpleDepthEstimator::occlusionFill(
 	gettimeofday(&end, NULL);
 	*elapsed = (double)(end.tv_usec - start.tv_usec) / 1000000 +
 		(double)(end.tv_sec - start.tv_sec);
+	traceSpan("occlusion fill", "stage", start, end);
 }
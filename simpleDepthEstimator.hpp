@@ -2,7 +2,9 @@
 
 #include <cinttypes>
 
-struct SimpleDepthEstimator{
+#include "DepthEstimator.hpp"
+
+struct SimpleDepthEstimator : DepthEstimator{
 	SimpleDepthEstimator(
 		const uint32_t downsampleFactor,
 		const uint32_t windowRadius,
@@ -16,28 +18,75 @@ struct SimpleDepthEstimator{
 		const char* left_name,
 		const char* right_name,
 		const char* out_name
-	);
+	) override;
+
+	void createDepthMap(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		const uint32_t outStride
+	) override;
+
+	using DepthEstimator::createDepthMap;
+
+	bool timeStages(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		double* times
+	) override;
 
-	uint32_t downsampleFactor;
-	uint32_t windowRadius;
-	unsigned char maxDisparity;
-	unsigned char maxCrossDifference;
-	uint32_t occlusionRadius;
+	bool countStages(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		unsigned char* out,
+		PerfCounters* perf,
+		uint64_t* counters
+	) override;
+
+	bool capturePlanes(
+		const unsigned char* left,
+		const unsigned char* right,
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
+		DepthPlanes* planes
+	) override;
 
 	private:
 
-	void makeImgGrey(
-		const unsigned char* img,
+	void runPipeline(
+		const unsigned char* left,
+		const unsigned char* right,
 		const uint32_t width,
 		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
 		unsigned char* out,
-		double* elapsed
+		double* times,
+		DepthPlanes* planes,
+		PerfCounters* perf
 	);
 
-	void makeImgRGBA(
+	void makeImgGrey(
 		const unsigned char* img,
 		const uint32_t width,
 		const uint32_t height,
+		const uint32_t stride,
+		const uint32_t channels,
 		unsigned char* out,
 		double* elapsed
 	);
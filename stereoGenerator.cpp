@@ -0,0 +1,236 @@
+#include "stereoGenerator.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+//Integer hash used for every random value, so pairs only depend on the seed.
+static uint32_t hash(
+	uint32_t x,
+	uint32_t y,
+	uint32_t seed
+){
+	uint32_t h = x*0x8da6b343u ^ y*0xd8163841u ^ seed*0xcb1ab31fu;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+//Bilinear value noise with the given cell size, 0-1.
+static float valueNoise(
+	const uint32_t x,
+	const uint32_t y,
+	const uint32_t cell,
+	const uint32_t seed
+){
+	uint32_t cx = x/cell, cy = y/cell;
+	float fx = (float)(x%cell)/cell, fy = (float)(y%cell)/cell;
+	float v00 = (hash(cx, cy, seed) & 0xffff)/65535.0f;
+	float v10 = (hash(cx+1, cy, seed) & 0xffff)/65535.0f;
+	float v01 = (hash(cx, cy+1, seed) & 0xffff)/65535.0f;
+	float v11 = (hash(cx+1, cy+1, seed) & 0xffff)/65535.0f;
+	float top = v00 + (v10 - v00)*fx;
+	float bottom = v01 + (v11 - v01)*fx;
+	return top + (bottom - top)*fy;
+}
+
+//Texture value of a source pixel. Detail is never finer than a
+//downsampled pixel so it survives the downsampling.
+static unsigned char texel(
+	const uint32_t x,
+	const uint32_t y,
+	const uint32_t c,
+	const uint32_t factor,
+	const StereoTexture texture,
+	const uint32_t seed
+){
+	if(texture == TEXTURE_DOTS){
+		return (hash(x/factor, y/factor, seed) & 1) ? 255 : 0;
+	}
+	uint32_t s = seed + c*0x9e3779b9u;
+	float v = 0.5f*valueNoise(x, y, 8*factor, s)
+		+ 0.3f*valueNoise(x, y, 2*factor, s + 1)
+		+ 0.2f*((hash(x/factor, y/factor, s + 2) & 0xff)/255.0f);
+	return (unsigned char)(v*255.0f + 0.5f);
+}
+
+//Ground truth disparity of a downsampled pixel.
+static uint32_t sceneDisparity(
+	const uint32_t x,
+	const uint32_t y,
+	const uint32_t w,
+	const uint32_t h,
+	const uint32_t maxDisparity,
+	const StereoScene scene,
+	const uint32_t seed
+){
+	uint32_t d = 0;
+	switch(scene){
+		case SCENE_PLANE:
+			d = maxDisparity/2;
+			break;
+		case SCENE_SLANT:{
+			float t = 0.8f*x/w + 0.2f*y/h;
+			d = (uint32_t)(maxDisparity/8.0f + t*(maxDisparity*3/4.0f - maxDisparity/8.0f) + 0.5f);
+			break;
+		}
+		case SCENE_STEPS:{
+			d = maxDisparity/4;
+			//Three rectangles, later ones are nearer and drawn on top.
+			for(uint32_t i=0;i<3;i++){
+				uint32_t rw = w/6 + hash(i, 0, seed)%(w/4 + 1);
+				uint32_t rh = h/6 + hash(i, 1, seed)%(h/4 + 1);
+				uint32_t rx = hash(i, 2, seed)%(w - rw + 1);
+				uint32_t ry = hash(i, 3, seed)%(h - rh + 1);
+				if(x >= rx&&x < rx + rw&&y >= ry&&y < ry + rh){
+					d = maxDisparity*(4 + i)/8;
+				}
+			}
+			break;
+		}
+	}
+	return maxDisparity > 0&&d >= maxDisparity ? maxDisparity - 1 : d;
+}
+
+//Generates a stereo pair and its ground truth.
+StereoPair::StereoPair(
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const uint32_t downsampleFactor,
+	const uint32_t maxDisparity,
+	const StereoScene scene,
+	const StereoTexture texture,
+	const uint32_t seed
+):
+	width(width),
+	height(height),
+	channels(channels),
+	downsampleFactor(downsampleFactor)
+{
+	if(downsampleFactor == 0||maxDisparity > 256||width < downsampleFactor||height < downsampleFactor){
+		printf("Unsupported synthetic stereo pair!\n");
+		exit(EXIT_FAILURE);
+	}
+	const uint32_t f = downsampleFactor;
+
+	//Blocks cover the whole image, the ground truth only the downsampled one.
+	uint32_t blocksX = (width + f - 1)/f, blocksY = (height + f - 1)/f;
+	uint32_t outW = width/f, outH = height/f;
+
+	left = (unsigned char*)malloc((size_t)width*height*channels);
+	right = (unsigned char*)malloc((size_t)width*height*channels);
+	disparity = (unsigned char*)malloc((size_t)outW*outH);
+	visible = (unsigned char*)malloc((size_t)outW*outH);
+	if(!left||!right||!disparity||!visible){
+		printf("Could not allocate synthetic stereo pair!\n");
+		exit(EXIT_FAILURE);
+	}
+
+	#pragma omp parallel
+	{
+		std::vector<uint32_t> d(blocksX);
+		std::vector<int32_t> owner(blocksX);
+
+		#pragma omp for schedule(dynamic)
+		for(uint32_t by=0;by<blocksY;by++){
+			//A left block at x is seen at x - d in the right view. Nearer
+			//blocks hide farther ones that land on the same place.
+			for(uint32_t bx=0;bx<blocksX;bx++){
+				d[bx] = sceneDisparity(bx, by, outW ? outW : 1, outH ? outH : 1, maxDisparity, scene, seed);
+				owner[bx] = -1;
+			}
+			for(uint32_t bx=0;bx<blocksX;bx++){
+				if(bx < d[bx]){continue;}
+				uint32_t t = bx - d[bx];
+				if(owner[t] < 0||d[owner[t]] < d[bx]){
+					owner[t] = bx;
+				}
+			}
+
+			if(by < outH){
+				for(uint32_t bx=0;bx<outW;bx++){
+					disparity[by*outW + bx] = d[bx];
+					visible[by*outW + bx] = bx >= d[bx]&&owner[bx - d[bx]] == (int32_t)bx;
+				}
+			}
+
+			for(uint32_t y=by*f;y<(by + 1)*f&&y<height;y++){
+				for(uint32_t x=0;x<width;x++){
+					size_t i = ((size_t)y*width + x)*channels;
+					int32_t o = owner[x/f];
+					for(uint32_t c=0;c<channels;c++){
+						left[i + c] = texel(x, y, c, f, texture, seed);
+						//Uncovered parts of the right view get texture of their own.
+						right[i + c] = o >= 0&&o*f + x%f < width
+							? texel(o*f + x%f, y, c, f, texture, seed)
+							: texel(x, y, c, f, texture, seed ^ 0x5bd1e995u);
+					}
+				}
+			}
+		}
+	}
+}
+
+StereoPair::~StereoPair(){
+	free(left);
+	free(right);
+	free(disparity);
+	free(visible);
+}
+
+//Compares a depth map with the ground truth over the visible pixels.
+DisparityError StereoPair::compare(
+	const unsigned char* depth,
+	const uint32_t depthStride
+){
+	uint32_t outW = width/downsampleFactor, outH = height/downsampleFactor;
+	double absolute = 0.0, squared = 0.0;
+	uint64_t bad1 = 0, bad2 = 0, pixels = 0;
+	for(uint32_t y=0;y<outH;y++){
+		for(uint32_t x=0;x<outW;x++){
+			if(!visible[y*outW + x]){continue;}
+			int32_t e = std::abs((int32_t)depth[(size_t)y*depthStride + x] - (int32_t)disparity[y*outW + x]);
+			absolute += e;
+			squared += (double)e*e;
+			bad1 += e > 1;
+			bad2 += e > 2;
+			pixels++;
+		}
+	}
+
+	DisparityError error = {0.0, 0.0, 0.0, 0.0, (uint32_t)pixels};
+	if(pixels > 0){
+		error.mae = absolute/pixels;
+		error.rmse = sqrt(squared/pixels);
+		error.bad1 = (double)bad1/pixels;
+		error.bad2 = (double)bad2/pixels;
+	}
+	return error;
+}
+
+//Scene by name.
+bool parseStereoScene(
+	const char* name,
+	StereoScene* scene
+){
+	if(strcmp(name, "plane") == 0){*scene = SCENE_PLANE; return true;}
+	if(strcmp(name, "slant") == 0){*scene = SCENE_SLANT; return true;}
+	if(strcmp(name, "steps") == 0){*scene = SCENE_STEPS; return true;}
+	return false;
+}
+
+//Texture by name.
+bool parseStereoTexture(
+	const char* name,
+	StereoTexture* texture
+){
+	if(strcmp(name, "dots") == 0){*texture = TEXTURE_DOTS; return true;}
+	if(strcmp(name, "noise") == 0){*texture = TEXTURE_NOISE; return true;}
+	return false;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cinttypes>
+
+/*--------------------------------------------------
+Synthetic stereo pairs with a known disparity field.
+
+Scenes, disparities in downsampled pixels:
+	plane : Fronto-parallel plane at maxDisparity / 2.
+	slant : Plane slanted from maxDisparity / 8 on the left to
+	        3 * maxDisparity / 4 on the right, rising slightly downwards.
+	steps : Background at maxDisparity / 4 with rectangles at
+	        up to 3 * maxDisparity / 4 in front of it.
+
+Textures:
+	dots  : Random black and white dots.
+	noise : Smooth value noise with fine detail, different per channel.
+
+The disparity is constant over every downsampleFactor * downsampleFactor
+block and a multiple of downsampleFactor in source pixels, so the
+downsampled images are an exact stereo pair of the ground truth. The
+right image is the left one warped by the disparity; parts of it that
+no left pixel maps to are filled with fresh texture.
+--------------------------------------------------*/
+
+enum StereoScene{
+	SCENE_PLANE,
+	SCENE_SLANT,
+	SCENE_STEPS
+};
+
+enum StereoTexture{
+	TEXTURE_DOTS,
+	TEXTURE_NOISE
+};
+
+//Disparity errors against the ground truth, counted over the visible pixels.
+struct DisparityError{
+	double mae;
+	double rmse;
+	double bad1;
+	double bad2;
+	uint32_t pixels;
+};
+
+struct StereoPair{
+	StereoPair(
+		const uint32_t width,
+		const uint32_t height,
+		const uint32_t channels,
+		const uint32_t downsampleFactor,
+		const uint32_t maxDisparity,
+		const StereoScene scene,
+		const StereoTexture texture,
+		const uint32_t seed
+	);
+	~StereoPair();
+
+	//The pair owns its images, copies would free them twice.
+	StereoPair(const StereoPair&) = delete;
+	StereoPair& operator=(const StereoPair&) = delete;
+
+	//Compare a depth map with the ground truth. bad1 and bad2 are the fractions
+	//of pixels that are off by more than 1 and 2.
+	DisparityError compare(
+		const unsigned char* depth,
+		const uint32_t depthStride
+	);
+
+	uint32_t width;
+	uint32_t height;
+	uint32_t channels;
+	uint32_t downsampleFactor;
+
+	//Source images, width * height * channels bytes with packed rows.
+	unsigned char* left;
+	unsigned char* right;
+
+	//Left view disparity and whether the pixel is seen by the right view,
+	//(width / downsampleFactor) * (height / downsampleFactor) bytes each.
+	unsigned char* disparity;
+	unsigned char* visible;
+};
+
+bool parseStereoScene(
+	const char* name,
+	StereoScene* scene
+);
+
+bool parseStereoTexture(
+	const char* name,
+	StereoTexture* texture
+);
@@ -0,0 +1,151 @@
+#include "trace.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define TRACE_HOST_PID 1
+#define TRACE_DEVICE_PID 2
+
+//One complete ("X") event.
+struct TraceEvent{
+	std::string name;
+	const char* category;
+	uint32_t pid;
+	uint32_t tid;
+	double begin;
+	double duration;
+	std::string args;
+};
+
+static std::mutex traceMutex;
+static std::vector<TraceEvent> traceEvents;
+static std::string traceFile;
+static struct timeval traceStart;
+static std::atomic<bool> traceChecked(false);
+static std::atomic<bool> traceOn(false);
+static uint32_t deviceQueues = 0;
+static std::atomic<uint32_t> threadCount(0);
+
+//Small index of the calling thread, in the order threads first record a span.
+static uint32_t threadIndex(){
+	thread_local uint32_t index = threadCount++;
+	return index;
+}
+
+//Microseconds from the start of the trace.
+static double traceTime(
+	const struct timeval& time
+){
+	return (double)(time.tv_sec - traceStart.tv_sec) * 1000000 + (double)(time.tv_usec - traceStart.tv_usec);
+}
+
+//Quotes a string for json.
+static std::string jsonString(
+	const std::string& text
+){
+	std::string quoted = "\"";
+	for(char c : text){
+		if(c == '"'||c == '\\'){quoted += '\\';}
+		quoted += c;
+	}
+	return quoted + "\"";
+}
+
+//Writes the trace file, registered with atexit.
+static void writeTrace(){
+	std::lock_guard<std::mutex> lock(traceMutex);
+
+	FILE* file = fopen(traceFile.c_str(), "w");
+	if(!file){
+		printf("Could not open %s!\n", traceFile.c_str());
+		return;
+	}
+
+	fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	fprintf(file, "\t{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"host\"}},\n", TRACE_HOST_PID);
+	fprintf(file, "\t{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": \"OpenCL device\"}}", TRACE_DEVICE_PID);
+	for(uint32_t i=0;i<threadCount;i++){
+		fprintf(file, ",\n\t{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %u, \"args\": {\"name\": \"thread %u\"}}",
+			TRACE_HOST_PID, i, i);
+	}
+	for(uint32_t i=0;i<deviceQueues;i++){
+		fprintf(file, ",\n\t{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %u, \"args\": {\"name\": \"queue %u\"}}",
+			TRACE_DEVICE_PID, i, i);
+	}
+	for(const TraceEvent& e : traceEvents){
+		fprintf(file, ",\n\t{\"name\": %s, \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %u, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f%s%s}",
+			jsonString(e.name).c_str(), e.category, e.pid, e.tid, e.begin, e.duration,
+			e.args.empty() ? "" : ", \"args\": ", e.args.c_str());
+	}
+	fprintf(file, "\n]}\n");
+	fclose(file);
+}
+
+//Enables tracing into filename. Overrides DEPTH_TRACE.
+void setTraceFile(
+	const char* filename
+){
+	std::lock_guard<std::mutex> lock(traceMutex);
+	if(!traceOn){
+		gettimeofday(&traceStart, NULL);
+		atexit(writeTrace);
+	}
+	traceFile = filename;
+	traceChecked = true;
+	traceOn = true;
+}
+
+//Whether spans are recorded. DEPTH_TRACE is read on first use.
+bool traceEnabled(){
+	if(!traceChecked){
+		const char* env = getenv("DEPTH_TRACE");
+		if(env&&*env){
+			setTraceFile(env);
+		}
+		traceChecked = true;
+	}
+	return traceOn;
+}
+
+//Records a span of the calling host thread.
+void traceSpan(
+	const char* name,
+	const char* category,
+	const struct timeval& start,
+	const struct timeval& end
+){
+	if(!traceEnabled()){return;}
+
+	uint32_t tid = threadIndex();
+	std::lock_guard<std::mutex> lock(traceMutex);
+	traceEvents.push_back({name, category, TRACE_HOST_PID, tid, traceTime(start), traceTime(end) - traceTime(start), ""});
+}
+
+//Records an OpenCL command on the track of its queue.
+void traceDeviceSpan(
+	const char* name,
+	const uint32_t queue,
+	const struct timeval& hostStart,
+	const uint64_t deviceStart,
+	const uint64_t queued,
+	const uint64_t submit,
+	const uint64_t start,
+	const uint64_t end
+){
+	if(!traceEnabled()){return;}
+
+	double base = traceTime(hostStart);
+	char args[160];
+	snprintf(args, sizeof(args), "{\"queued_us\": %.3f, \"submit_us\": %.3f, \"start_us\": %.3f, \"end_us\": %.3f}",
+		base + (double)(int64_t)(queued - deviceStart) / 1000, base + (double)(int64_t)(submit - deviceStart) / 1000,
+		base + (double)(int64_t)(start - deviceStart) / 1000, base + (double)(int64_t)(end - deviceStart) / 1000);
+
+	std::lock_guard<std::mutex> lock(traceMutex);
+	if(queue >= deviceQueues){deviceQueues = queue + 1;}
+	traceEvents.push_back({name, "device", TRACE_DEVICE_PID, queue,
+		base + (double)(int64_t)(start - deviceStart) / 1000, (double)(end - start) / 1000, args});
+}
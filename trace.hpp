@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cinttypes>
+#include <sys/time.h>
+
+/*--------------------------------------------------
+Timeline of a run in the Chrome trace event format, for
+chrome://tracing or ui.perfetto.dev.
+
+Tracing is enabled with setTraceFile or the DEPTH_TRACE
+environment variable and the file is written when the program
+exits. Host spans (stages, decoding, encoding, uploads) go on
+one track per host thread, OpenCL commands on one track per
+command queue of the device process. Device timestamps are
+moved onto the host clock by lining up the first queued command
+with the host time the pipeline was started.
+--------------------------------------------------*/
+
+//Enables tracing into filename. Overrides DEPTH_TRACE.
+void setTraceFile(
+	const char* filename
+);
+
+bool traceEnabled();
+
+//Records a span of the calling host thread.
+void traceSpan(
+	const char* name,
+	const char* category,
+	const struct timeval& start,
+	const struct timeval& end
+);
+
+//Records an OpenCL command from its profiling info in nanoseconds of the device clock.
+//hostStart is the host time matching deviceStart, usually the first queued time of a run.
+void traceDeviceSpan(
+	const char* name,
+	const uint32_t queue,
+	const struct timeval& hostStart,
+	const uint64_t deviceStart,
+	const uint64_t queued,
+	const uint64_t submit,
+	const uint64_t start,
+	const uint64_t end
+);
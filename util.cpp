@@ -8,7 +8,8 @@
 #include <cmath>
 #include <sys/time.h>
 
-#include "lodepng.h"
+#include "imageIO.hpp"
+#include "trace.hpp"
 
 //Matrix product for two square matrices.
 void sqMatrixProduct(
@@ -51,30 +52,132 @@ void printSqMatrix(
 	std::cout<<std::endl;
 }
 
-//Decodes an png image using lodepng.
+//Loads an image as 8bit rgba. The file format is chosen by the extension, see imageIO.hpp.
 void imgLoad(
 	const char* filename,
 	uint32_t* width,
 	uint32_t* height,
 	unsigned char** image
 ){
-	unsigned error = lodepng_decode32_file(image, width, height, filename);
-	if(error){
-		std::cout<<lodepng_error_text(error)<<"\n";
+	uint32_t channels = 4;
+	imgLoad(filename, width, height, &channels, image);
+}
+
+//Loads an image as 8bit grey or rgba. If channels is 0 the image keeps the channels of the file
+//and channels is set to them, otherwise the image is converted to the given channels.
+void imgLoad(
+	const char* filename,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	unsigned char** image
+){
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	//Readers may honor the wanted channels themselves.
+	uint32_t c = *channels;
+	findImageFormat(filename)->read(filename, width, height, &c, image);
+
+	if(*channels == 0){
+		*channels = c;
+	}else if(*channels != c){
+		unsigned char* img = (unsigned char*)malloc(*width * *height * *channels);
+		convertChannels(*image, *width, *height, c, *channels, img);
+		free(*image);
+		*image = img;
+	}
+
+	gettimeofday(&end, NULL);
+	char name[256];
+	snprintf(name, sizeof(name), "decode %s", filename);
+	traceSpan(name, "io", start, end);
+}
+
+//Loads a stereo pair, decoding both images at the same time on two threads. Channels are asked for
+//as in imgLoad, with 0 the images keep the channels of the left file and the right image is
+//converted to them. Exits unless the sizes match.
+void imgLoadPair(
+	const char* left_name,
+	const char* right_name,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	unsigned char** images
+){
+	const char* names[2] = {left_name, right_name};
+	uint32_t w[2], h[2], c[2] = {*channels, *channels};
+
+	#pragma omp parallel for num_threads(2)
+	for(uint32_t i=0;i<2;i++){
+		imgLoad(names[i], &w[i], &h[i], &c[i], &images[i]);
+	}
+
+	checkPair(names, w, h);
+
+	if(c[1] != c[0]){
+		unsigned char* img = (unsigned char*)malloc(w[1] * h[1] * c[0]);
+		convertChannels(images[1], w[1], h[1], c[1], c[0], img);
+		free(images[1]);
+		images[1] = img;
+	}
+
+	*width = w[0];
+	*height = h[0];
+	*channels = c[0];
+}
+
+//Exits unless the left and right images of a pair have the same size.
+void checkPair(
+	const char** names,
+	const uint32_t* widths,
+	const uint32_t* heights
+){
+	if(widths[0] != widths[1]||heights[0] != heights[1]){
+		printf("%s and %s have different sizes!\n", names[0], names[1]);
 		exit(EXIT_FAILURE);
 	}
 }
 
-//Write image to disk as png.
+//Writes an 8bit rgba image to disk. The file format is chosen by the extension, see imageIO.hpp.
 void imgWrite(
 	const char* filename,
 	const uint32_t width,
 	const uint32_t height,
 	const unsigned char* image
 ){
-	unsigned error = lodepng_encode32_file(filename, image, width, height);
-	if(error){
-		std::cout<<lodepng_error_text(error)<<"\n";
-		exit(EXIT_FAILURE);
+	imgWrite(filename, width, height, 4, image);
+}
+
+//Writes an 8bit grey or rgba image to disk.
+void imgWrite(
+	const char* filename,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const unsigned char* image
+){
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+
+	findImageFormat(filename)->write(filename, width, height, channels, image);
+
+	gettimeofday(&end, NULL);
+	char name[256];
+	snprintf(name, sizeof(name), "encode %s", filename);
+	traceSpan(name, "io", start, end);
+}
+
+//Splits a comma separated list, skipping empty entries.
+std::vector<std::string> splitList(
+	const std::string& list
+){
+	std::vector<std::string> items;
+	for(size_t begin=0;begin<=list.size();){
+		size_t end = list.find(',', begin);
+		if(end == std::string::npos){end = list.size();}
+		if(end > begin){items.push_back(list.substr(begin, end - begin));}
+		begin = end + 1;
 	}
+	return items;
 }
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <cinttypes>
+#include <string>
+#include <vector>
 
 void sqMatrixProduct(
 	const float* a,
@@ -21,9 +23,44 @@ void imgLoad(
 	unsigned char** image
 );
 
+void imgLoad(
+	const char* filename,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	unsigned char** image
+);
+
+void imgLoadPair(
+	const char* left_name,
+	const char* right_name,
+	uint32_t* width,
+	uint32_t* height,
+	uint32_t* channels,
+	unsigned char** images
+);
+
+void checkPair(
+	const char** names,
+	const uint32_t* widths,
+	const uint32_t* heights
+);
+
 void imgWrite(
 	const char* filename,
 	const uint32_t width,
 	const uint32_t height,
 	const unsigned char* image
 );
+
+void imgWrite(
+	const char* filename,
+	const uint32_t width,
+	const uint32_t height,
+	const uint32_t channels,
+	const unsigned char* image
+);
+
+std::vector<std::string> splitList(
+	const std::string& list
+);